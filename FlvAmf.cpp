@@ -0,0 +1,245 @@
+﻿#include <string.h>
+
+#include "FlvAmf.h"
+
+/*
+AMF0 编码(所有整数和double都是大端):
+    Number          0x00 + 8字节double
+    Boolean         0x01 + 1字节
+    String          0x02 + 2字节长度 + UTF-8
+    Object          0x03 + 属性 * N + 0x00 0x00 0x09
+    Null/Undefined  0x05/0x06
+    Reference       0x07 + 2字节序号
+    ECMA Array      0x08 + 4字节个数 + 属性 * N + 0x00 0x00 0x09
+    Strict Array    0x0a + 4字节个数 + 值 * 个数
+    Date            0x0b + 8字节double(ms) + 2字节时区
+    Long String     0x0c + 4字节长度 + UTF-8
+    XML Document    0x0f + 4字节长度 + UTF-8
+    Typed Object    0x10 + 2字节长度的类名 + 属性 * N + 0x00 0x00 0x09
+属性: 2字节长度的key(不带类型) + 值
+ */
+static const int nMaxDepth = 64; // 嵌套层数限制, 防止恶意数据导致栈溢出
+
+static inline uint32_t ShowU16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t ShowU32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+bool FlvAmfValue::StrEquals(const char *sz) const
+{
+    size_t nLen = strlen(sz);
+    return pStr != NULL && nStrLen == nLen && memcmp(pStr, sz, nLen) == 0;
+}
+
+bool FlvAmfProperty::KeyEquals(const char *sz, uint32_t nLen) const
+{
+    return nKeyLen == nLen && memcmp(pKey, sz, nLen) == 0;
+}
+
+CFlvAmfReader::CFlvAmfReader(const uint8_t *pData, uint32_t nLen)
+{
+    _pData = pData;
+    _nLen = nLen;
+    _nPos = 0;
+}
+
+double CFlvAmfReader::ReadNumber(const uint8_t *p)
+{
+    uint64_t n = ((uint64_t)ShowU32(p) << 32) | ShowU32(p + 4);
+    double d;
+    memcpy(&d, &n, 8);
+    return d;
+}
+
+int CFlvAmfReader::Read(FlvAmfValue &value)
+{
+    if (!ReadValue(value, 0))
+    {
+        _nPos = _nLen;
+        return 0;
+    }
+    return 1;
+}
+
+int CFlvAmfReader::ReadValue(FlvAmfValue &value, int nDepth)
+{
+    if (_nPos >= _nLen || nDepth > nMaxDepth)
+        return 0;
+
+    value = FlvAmfValue();
+    value.nType = _pData[_nPos++];
+    uint32_t nLeft = _nLen - _nPos;
+    const uint8_t *p = _pData + _nPos;
+
+    switch (value.nType)
+    {
+    case AMF0_NUMBER:
+        if (nLeft < 8)
+            return 0;
+        value.dNumber = ReadNumber(p);
+        _nPos += 8;
+        return 1;
+
+    case AMF0_BOOLEAN:
+        if (nLeft < 1)
+            return 0;
+        value.bBool = (p[0] != 0);
+        _nPos += 1;
+        return 1;
+
+    case AMF0_STRING:
+        if (nLeft < 2 || nLeft - 2 < ShowU16(p))
+            return 0;
+        value.nStrLen = ShowU16(p);
+        value.pStr = p + 2;
+        _nPos += 2 + value.nStrLen;
+        return 1;
+
+    case AMF0_LONG_STRING:
+    case AMF0_XML_DOCUMENT:
+        if (nLeft < 4 || nLeft - 4 < ShowU32(p))
+            return 0;
+        value.nStrLen = ShowU32(p);
+        value.pStr = p + 4;
+        _nPos += 4 + value.nStrLen;
+        return 1;
+
+    case AMF0_NULL:
+    case AMF0_UNDEFINED:
+    case AMF0_UNSUPPORTED:
+    case AMF0_OBJECT_END: // 只在属性列表中出现, 由调用者判断
+        return 1;
+
+    case AMF0_REFERENCE:
+        if (nLeft < 2)
+            return 0;
+        value.nRef = (uint16_t)ShowU16(p);
+        _nPos += 2;
+        return 1;
+
+    case AMF0_DATE:
+        if (nLeft < 10)
+            return 0;
+        value.dNumber = ReadNumber(p);
+        value.nTimeZone = (int16_t)ShowU16(p + 8);
+        _nPos += 10;
+        return 1;
+
+    case AMF0_OBJECT:
+        value.pData = p;
+        if (!ReadProperties(nDepth + 1))
+            return 0;
+        value.nDataLen = (uint32_t)(_pData + _nPos - p);
+        return 1;
+
+    case AMF0_TYPED_OBJECT:
+        if (nLeft < 2 || nLeft - 2 < ShowU16(p))
+            return 0;
+        value.nStrLen = ShowU16(p);
+        value.pStr = p + 2;
+        _nPos += 2 + value.nStrLen;
+        value.pData = _pData + _nPos;
+        if (!ReadProperties(nDepth + 1))
+            return 0;
+        value.nDataLen = (uint32_t)(_pData + _nPos - value.pData);
+        return 1;
+
+    case AMF0_ECMA_ARRAY:
+        if (nLeft < 4)
+            return 0;
+        value.nCount = ShowU32(p);
+        _nPos += 4;
+        value.pData = _pData + _nPos;
+        if (!ReadProperties(nDepth + 1))
+            return 0;
+        value.nDataLen = (uint32_t)(_pData + _nPos - value.pData);
+        return 1;
+
+    case AMF0_STRICT_ARRAY:
+        if (nLeft < 4)
+            return 0;
+        value.nCount = ShowU32(p);
+        _nPos += 4;
+        value.pData = _pData + _nPos;
+        for (uint32_t i = 0; i < value.nCount; i++)
+        {
+            if (!SkipValue(nDepth + 1))
+                return 0;
+        }
+        value.nDataLen = (uint32_t)(_pData + _nPos - value.pData);
+        return 1;
+
+    default: // MovieClip, RecordSet, AMF3等
+        return 0;
+    }
+}
+
+int CFlvAmfReader::SkipValue(int nDepth)
+{
+    FlvAmfValue value;
+    return ReadValue(value, nDepth);
+}
+
+// 很多文件的ECMA Array没有结束标记, 数据结束也认为属性列表结束
+int CFlvAmfReader::ReadProperties(int nDepth)
+{
+    while (_nPos < _nLen)
+    {
+        if (_nLen - _nPos < 2)
+            return 0;
+
+        uint32_t nKeyLen = ShowU16(_pData + _nPos);
+        if (nKeyLen == 0 && _nPos + 2 < _nLen && _pData[_nPos + 2] == AMF0_OBJECT_END)
+        {
+            _nPos += 3;
+            return 1;
+        }
+
+        if (_nLen - _nPos - 2 < nKeyLen)
+            return 0;
+        _nPos += 2 + nKeyLen;
+        if (!SkipValue(nDepth))
+            return 0;
+    }
+
+    return 1;
+}
+
+CFlvAmfIterator::CFlvAmfIterator(const FlvAmfValue &container)
+    : _reader(container.pData, container.IsContainer() ? container.nDataLen : 0)
+{
+    _bArray = (container.nType == AMF0_STRICT_ARRAY);
+    _nLeft = container.nCount;
+}
+
+int CFlvAmfIterator::Next(FlvAmfProperty &prop)
+{
+    // 每次读取都检查长度, 内容不完整时在出错的位置停止
+    if (_bArray)
+    {
+        if (_nLeft == 0)
+            return 0;
+        _nLeft--;
+        prop.pKey = NULL;
+        prop.nKeyLen = 0;
+        return _reader.ReadValue(prop.value, 1);
+    }
+
+    const uint8_t *p = _reader._pData + _reader._nPos;
+    uint32_t nLeft = _reader._nLen - _reader._nPos;
+    if (nLeft < 2)
+        return 0;
+
+    prop.nKeyLen = ShowU16(p);
+    if (prop.nKeyLen == 0 && nLeft >= 3 && p[2] == AMF0_OBJECT_END)
+        return 0;
+
+    prop.pKey = p + 2;
+    _reader._nPos += 2 + prop.nKeyLen;
+    return _reader.ReadValue(prop.value, 1);
+}
@@ -0,0 +1,108 @@
+﻿#ifndef FLVAMF_H
+#define FLVAMF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// AMF0数据类型
+enum
+{
+    AMF0_NUMBER = 0x00,
+    AMF0_BOOLEAN = 0x01,
+    AMF0_STRING = 0x02,
+    AMF0_OBJECT = 0x03,
+    AMF0_MOVIECLIP = 0x04, // 保留, 不支持
+    AMF0_NULL = 0x05,
+    AMF0_UNDEFINED = 0x06,
+    AMF0_REFERENCE = 0x07,
+    AMF0_ECMA_ARRAY = 0x08,
+    AMF0_OBJECT_END = 0x09,
+    AMF0_STRICT_ARRAY = 0x0a,
+    AMF0_DATE = 0x0b,
+    AMF0_LONG_STRING = 0x0c,
+    AMF0_UNSUPPORTED = 0x0d,
+    AMF0_RECORDSET = 0x0e, // 保留, 不支持
+    AMF0_XML_DOCUMENT = 0x0f,
+    AMF0_TYPED_OBJECT = 0x10,
+};
+
+/*
+一个AMF0值的视图, 字符串和复杂类型都指向原始数据, 不复制也不申请内存.
+Object/ECMA Array/Strict Array/Typed Object 只记录内容的位置, 用CFlvAmfIterator遍历其中的属性或元素.
+ */
+struct FlvAmfValue
+{
+    int nType;              // AMF0_XXX
+    double dNumber;         // Number; Date的毫秒数
+    bool bBool;             // Boolean
+    int nTimeZone;          // Date的时区(分钟)
+    uint16_t nRef;          // Reference的对象序号
+    uint32_t nCount;        // ECMA Array中声明的元素个数(不一定准确), Strict Array的元素个数
+    const uint8_t *pStr;    // String/Long String/XML Document的内容; Typed Object的类名
+    uint32_t nStrLen;
+    const uint8_t *pData;   // 复杂类型的内容: 第一个属性(或元素)开始, 到结束标记(包含)为止
+    uint32_t nDataLen;
+
+    FlvAmfValue() : nType(AMF0_UNDEFINED), dNumber(0), bBool(false), nTimeZone(0), nRef(0), nCount(0),
+                    pStr(NULL), nStrLen(0), pData(NULL), nDataLen(0) {}
+
+    bool IsContainer() const
+    {
+        return nType == AMF0_OBJECT || nType == AMF0_ECMA_ARRAY || nType == AMF0_STRICT_ARRAY || nType == AMF0_TYPED_OBJECT;
+    }
+    // 与key比较字符串内容, 不需要'\0'结尾
+    bool StrEquals(const char *sz) const;
+};
+
+// Object/ECMA Array的一个属性; Strict Array的元素没有key(nKeyLen为0)
+struct FlvAmfProperty
+{
+    const uint8_t *pKey;
+    uint32_t nKeyLen;
+    FlvAmfValue value;
+
+    bool KeyEquals(const char *sz, uint32_t nLen) const;
+};
+
+// 顺序读取AMF0值(例如Script Tag中的"onMetaData"和后面的ECMA Array)
+class CFlvAmfReader
+{
+public:
+    CFlvAmfReader(const uint8_t *pData, uint32_t nLen);
+
+    // 读取一个值, 复杂类型会跳过全部内容. 数据不完整或者类型不支持时返回0, 之后不能再读取
+    int Read(FlvAmfValue &value);
+    bool End() { return _nPos >= _nLen; }
+    uint32_t Pos() { return _nPos; }
+
+    // 大端的8字节double
+    static double ReadNumber(const uint8_t *p);
+
+private:
+    friend class CFlvAmfIterator;
+
+    int ReadValue(FlvAmfValue &value, int nDepth);
+    int ReadProperties(int nDepth); // 跳过属性, 直到结束标记(或者数据结束)
+    int SkipValue(int nDepth);
+
+    const uint8_t *_pData;
+    uint32_t _nLen;
+    uint32_t _nPos;
+};
+
+// 遍历复杂类型的属性(Object/ECMA Array/Typed Object)或者元素(Strict Array)
+class CFlvAmfIterator
+{
+public:
+    CFlvAmfIterator(const FlvAmfValue &container);
+
+    // 取出下一个属性, 没有更多属性或者格式错误时返回0
+    int Next(FlvAmfProperty &prop);
+
+private:
+    CFlvAmfReader _reader;
+    bool _bArray;     // Strict Array: 元素没有key
+    uint32_t _nLeft;  // Strict Array剩余的元素个数
+};
+
+#endif // FLVAMF_H
@@ -0,0 +1,71 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include "FlvArena.h"
+
+static const size_t nArenaAlign = 16;
+
+CFlvArena::CFlvArena(size_t nChunkSize)
+{
+    _nCur = 0;
+    _nChunkSize = nChunkSize;
+    _nBytesUsed = 0;
+    _nBytesReserved = 0;
+}
+
+CFlvArena::~CFlvArena()
+{
+    Release();
+}
+
+/*
+1. 从当前块开始找能放下的块(Reset()之后的块是空的, 可以重复使用)
+2. 都放不下就申请新块, 超过块大小的请求单独申请一个刚好够用的块
+ */
+void *CFlvArena::Alloc(size_t nSize)
+{
+    nSize = (nSize + nArenaAlign - 1) & ~(nArenaAlign - 1);
+
+    for (; _nCur < _vChunk.size(); _nCur++)
+    {
+        Chunk &chunk = _vChunk[_nCur];
+        if (chunk.nSize - chunk.nUsed >= nSize)
+        {
+            void *p = chunk.pData + chunk.nUsed;
+            chunk.nUsed += nSize;
+            _nBytesUsed += nSize;
+            return p;
+        }
+    }
+
+    Chunk chunk;
+    chunk.nSize = nSize > _nChunkSize ? nSize : _nChunkSize;
+    chunk.pData = (uint8_t *)malloc(chunk.nSize); // malloc的返回值至少16字节对齐
+    if (chunk.pData == NULL)
+        return NULL;
+    chunk.nUsed = nSize;
+    _vChunk.push_back(chunk);
+    _nCur = _vChunk.size() - 1;
+    _nBytesUsed += nSize;
+    _nBytesReserved += chunk.nSize;
+
+    return chunk.pData;
+}
+
+void CFlvArena::Reset()
+{
+    for (size_t i = 0; i < _vChunk.size(); i++)
+        _vChunk[i].nUsed = 0;
+    _nCur = 0;
+    _nBytesUsed = 0;
+}
+
+void CFlvArena::Release()
+{
+    for (size_t i = 0; i < _vChunk.size(); i++)
+        free(_vChunk[i].pData);
+    _vChunk.clear();
+    _nCur = 0;
+    _nBytesUsed = 0;
+    _nBytesReserved = 0;
+}
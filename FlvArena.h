@@ -0,0 +1,41 @@
+﻿#ifndef FLVARENA_H
+#define FLVARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// 解析器使用的内存池: 按块(默认1MB)申请内存, 分配时只移动指针, 不支持单独释放.
+// Reset()之后所有已分配的内存一次性作废, 块本身保留下来重复使用.
+class CFlvArena
+{
+public:
+    CFlvArena(size_t nChunkSize = 1024 * 1024);
+    virtual ~CFlvArena();
+
+    void *Alloc(size_t nSize); // 16字节对齐
+    void Reset();              // 作废所有分配, 保留内存块
+    void Release();            // 释放所有内存块
+
+    size_t BytesUsed() { return _nBytesUsed; }       // 当前已分配的字节数
+    size_t BytesReserved() { return _nBytesReserved; } // 向系统申请的总字节数
+
+private:
+    CFlvArena(const CFlvArena &);
+    CFlvArena &operator=(const CFlvArena &);
+
+    struct Chunk
+    {
+        uint8_t *pData;
+        size_t nSize;
+        size_t nUsed;
+    };
+
+    std::vector<Chunk> _vChunk;
+    size_t _nCur; // 当前正在分配的块
+    size_t _nChunkSize;
+    size_t _nBytesUsed;
+    size_t _nBytesReserved;
+};
+
+#endif // FLVARENA_H
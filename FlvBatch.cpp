@@ -0,0 +1,537 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "FlvParser.h"
+#include "FlvReader.h"
+#include "FlvDumpSink.h"
+#include "FlvThreadPool.h"
+#include "FlvIndex.h"
+#include "FlvBatch.h"
+#include "FlvQueue.h"
+#include "FlvWriter.h"
+
+using namespace std;
+
+/* 
+1. 读取文件
+2. 开始解析, 未解析完的Tag留在缓冲区中等待下一次读取
+3. 缓冲区放不下下一个Tag时按parser.NeedBytes()扩大, 超过nMaxBuffer时停止, nNeedBytes返回需要的大小
+ */
+static int64_t Process(istream &fin, CFlvParser &parser, int64_t nMaxBuffer, bool bVerbose, CFlvMetrics *pMetrics,
+                       int64_t &nNeedBytes)
+{
+    CFlvInputBuffer buf(2 * 1024 * 1024); // 2MB
+    nNeedBytes = 0;
+
+    while (1)
+    {
+        if (parser.NeedBytes() > buf.Capacity() && !buf.Grow(parser.NeedBytes(), nMaxBuffer))
+        {
+            nNeedBytes = parser.NeedBytes();
+            break;
+        }
+        if (buf.Fill(fin) <= 0)
+            break;
+
+        int64_t nUsedLen = 0;
+        parser.Parse(buf.Data(), buf.Size(), nUsedLen);
+        buf.Consume(nUsedLen);
+    }
+
+    if (bVerbose)
+        cout << "input: read " << buf.BytesRead() << " bytes, copied " << buf.BytesCopied()
+             << " bytes, " << buf.Refills() << " refills" << endl;
+    if (pMetrics != NULL)
+    {
+        pMetrics->nBytesRead += buf.BytesRead();
+        pMetrics->nBytesCopied += buf.BytesCopied();
+        pMetrics->nRefills += buf.Refills();
+    }
+    return buf.BytesRead();
+}
+
+/*
+流水线: 读线程读取输入 -> 当前线程用Feed()解析并交给sink -> 写线程写出(sink设置了CFlvWriteQueue).
+读线程和解析线程之间用两个无锁队列传递固定数量的读缓冲区, 一个传递读到的数据, 一个归还用完的缓冲区,
+任何一个阶段较慢时前面的阶段等待(背压), 耗时接近三个阶段中最慢的一个, 而不是三者之和.
+ */
+static int64_t ProcessPipelined(istream &fin, CFlvParser &parser)
+{
+    const int nChunks = 8;
+    const int nChunkSize = 1024 * 1024;
+
+    struct Chunk
+    {
+        uint8_t *pData;
+        int nLen; // 为0表示输入结束
+    };
+
+    vector<uint8_t> vMem((size_t)nChunks * nChunkSize);
+    CFlvSpscQueue<Chunk> qFull(nChunks); // 读线程 -> 解析线程
+    CFlvSpscQueue<Chunk> qFree(nChunks); // 解析线程 -> 读线程
+    for (int i = 0; i < nChunks; i++)
+    {
+        Chunk chunk = {&vMem[(size_t)i * nChunkSize], 0};
+        qFree.Push(chunk);
+    }
+
+    atomic<bool> bStop(false); // sink要求停止时不再读取
+    int64_t nBytes = 0;        // 只由读线程修改, join之后读取
+    thread reader([&]() {
+        Chunk chunk;
+        do
+        {
+            qFree.Pop(chunk);
+            chunk.nLen = 0;
+            if (!bStop.load(memory_order_relaxed) && fin)
+            {
+                fin.read((char *)chunk.pData, nChunkSize);
+                chunk.nLen = (int)fin.gcount();
+                nBytes += chunk.nLen;
+            }
+            qFull.Push(chunk);
+        } while (chunk.nLen > 0);
+    });
+
+    // 停止之后仍然取完队列中的数据, 读线程才能结束
+    Chunk chunk;
+    while (1)
+    {
+        qFull.Pop(chunk);
+        if (chunk.nLen == 0)
+            break;
+        if (!bStop.load(memory_order_relaxed) && parser.Feed(chunk.pData, chunk.nLen))
+            bStop.store(true, memory_order_relaxed);
+        qFree.Push(chunk);
+    }
+    reader.join();
+
+    // 读取的字节数和次数由Feed()统计
+    return nBytes;
+}
+
+/*
+整个文件已经映射在内存中, 一次Parse()解析完, Tag直接引用映射的数据(零拷贝), 不再需要读缓冲区.
+返回解析到的位置: sink要求停止时后面的数据没有用到, 不计入输入的字节数
+ */
+static int64_t ProcessMapped(CFlvFileMap &map, CFlvParser &parser, int64_t nPos)
+{
+    parser.SetZeroCopy(true);
+
+    int64_t nUsedLen = 0;
+    parser.Parse(map.Data() + nPos, map.Size() - nPos, nUsedLen);
+    return nPos + nUsedLen;
+}
+
+#ifndef _WIN32
+/*
+实时输入: "-"为标准输入, 否则在该路径上创建Unix socket并等待一个连接(例如推流进程或者测试脚本).
+失败返回-1
+ */
+static int OpenLiveInput(const string &path)
+{
+    if (path == "-")
+        return 0;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        return -1;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+
+    int fdListen = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fdListen < 0)
+        return -1;
+
+    unlink(path.c_str());
+    if (bind(fdListen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fdListen, 1) != 0)
+    {
+        close(fdListen);
+        return -1;
+    }
+
+    int fd;
+    while ((fd = accept(fdListen, NULL, NULL)) < 0 && errno == EINTR)
+        ;
+    close(fdListen);
+    unlink(path.c_str());
+    return fd;
+}
+
+/*
+每次read()返回的数据(任意长度)立即交给Feed(), 完整的Tag在这次调用中就会输出.
+每次读取之后刷新输出, 输出文件的内容只比输入落后不完整的那个Tag
+ */
+static int64_t ProcessLive(int fd, CFlvParser &parser, CFlvDumpSink *pSink)
+{
+    uint8_t szBuf[64 * 1024];
+    int64_t nBytes = 0;
+
+    while (1)
+    {
+        ssize_t n = read(fd, szBuf, sizeof(szBuf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        nBytes += n;
+        if (parser.Feed(szBuf, (int)n))
+            break;
+        pSink->Flush();
+    }
+
+    return nBytes;
+}
+#endif
+
+static const char *PathOrNull(const string &path)
+{
+    return path.empty() ? NULL : path.c_str();
+}
+
+/*
+使用索引文件定位到nSeekTime之前最近的关键帧, 返回开始解析的位置.
+索引文件不存在或者与输入文件不匹配时返回0, 即从头开始解析.
+ */
+static int64_t Seek(const FlvJob &job, CFlvFileMap &map, CFlvParser &parser)
+{
+    CFlvIndex index;
+    string path = job.strIndexPath.empty() ? job.strInput + ".idx" : job.strIndexPath;
+    if (!index.Load(path.c_str(), map.Size()))
+    {
+        if (job.bVerbose)
+            cout << "no valid index " << path << ", parse from the beginning" << endl;
+        return 0;
+    }
+
+    int64_t nPos = parser.SeekTo(map.Data(), map.Size(), index, (uint32_t)job.nSeekTime);
+    if (nPos < 0)
+    {
+        parser.Reset();
+        return 0;
+    }
+
+    if (job.bVerbose)
+        cout << "seek to " << job.nSeekTime << "ms, start at offset " << nPos << endl;
+    return nPos;
+}
+
+/* 
+1. 普通文件直接映射到内存, 否则分块读取
+2. 默认边解析边输出(流式), bInMemory 则先解析完整个文件再输出
+3. 指定了nSeekTime时根据索引文件从关键帧开始解析(只支持可以映射的文件), 否则可以在解析过程中生成索引文件
+ */
+int ProcessFlvJob(const FlvJob &job, FlvJobResult &result)
+{
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    result = FlvJobResult();
+
+    // 映射和线程池必须在parser析构之后才能释放
+    CFlvFileMap map;
+    CFlvThreadPool pool(job.nDecodeThreads);
+    CFlvParser parser;
+    parser.SetArena(true);
+    parser.SetVerbose(job.bVerbose);
+    parser.SetThreadPool(&pool);
+    parser.SetMetrics(job.pMetrics);
+
+    // 所有输出都通过WriteH264()/WriteAAC(), 单线程时不需要_pMedia.
+    // 多线程时_pMedia在工作线程中并行生成, 输出时只需要复制
+    bool bNeedMedia = !job.strH264Path.empty() || !job.strAACPath.empty();
+    parser.SetLazyMedia(job.nDecodeThreads <= 1 || !bNeedMedia);
+    CFlvDumpSink *pSink = NULL;
+    CFlvWriteQueue *pWriteQueue = NULL; // 必须在pSink之后释放
+    bool bPipeline = job.bPipeline && !job.bInMemory && !job.bLive && job.nSeekTime < 0;
+    if (!job.bInMemory)
+    {
+        // 流式模式下Tag在Parse()返回前就已经释放, 可以直接引用读缓冲区
+        pSink = new CFlvDumpSink(PathOrNull(job.strH264Path), PathOrNull(job.strAACPath), PathOrNull(job.strFlvPath),
+                                 PathOrNull(job.strMp4Path));
+        parser.SetSink(pSink);
+        parser.SetZeroCopy(true);
+        if (bPipeline)
+        {
+            pWriteQueue = new CFlvWriteQueue();
+            pSink->SetWriteQueue(pWriteQueue);
+        }
+    }
+
+    int64_t nNeedBytes = 0; // Process()遇到超过读缓冲区上限的Tag
+    int64_t nFileSize = -1; // 索引文件记录的输入文件大小, 映射的文件可能没有解析到末尾, 不能用result.nBytes
+    CFlvIndex index;
+    bool bBuildIndex = (job.nSeekTime < 0 && !job.strIndexPath.empty());
+    if (bBuildIndex)
+        parser.SetIndex(&index);
+
+#ifndef _WIN32
+    if (job.bLive && pSink != NULL)
+    {
+        int fd = OpenLiveInput(job.strInput);
+        if (fd < 0)
+        {
+            delete pSink;
+            return 0;
+        }
+
+        result.nBytes = ProcessLive(fd, parser, pSink);
+        if (fd != 0)
+            close(fd);
+    }
+    else
+#endif
+    if (bPipeline)
+    {
+        // 由读线程顺序读取, 不使用内存映射
+        fstream fin;
+        if (job.strInput != "-")
+        {
+            fin.open(job.strInput.c_str(), ios_base::in | ios_base::binary);
+            if (!fin)
+            {
+                delete pSink;
+                delete pWriteQueue;
+                return 0;
+            }
+        }
+        result.nBytes = ProcessPipelined(job.strInput == "-" ? cin : fin, parser);
+    }
+    else if (map.Open(job.strInput.c_str()))
+    {
+        int64_t nPos = 0;
+        if (job.nSeekTime >= 0)
+            nPos = Seek(job, map, parser);
+        result.nBytes = ProcessMapped(map, parser, nPos);
+        nFileSize = map.Size();
+        if (job.pMetrics != NULL)
+            job.pMetrics->nBytesRead += result.nBytes; // 映射的文件没有读缓冲区, 不需要复制
+    }
+    else if (job.strInput == "-")
+    {
+        result.nBytes = Process(cin, parser, job.nMaxBufferSize, job.bVerbose, job.pMetrics, nNeedBytes);
+    }
+    else
+    {
+        fstream fin;
+        fin.open(job.strInput.c_str(), ios_base::in | ios_base::binary);
+        if (!fin)
+        {
+            delete pSink;
+            return 0;
+        }
+
+        result.nBytes = Process(fin, parser, job.nMaxBufferSize, job.bVerbose, job.pMetrics, nNeedBytes);
+
+        fin.close();
+    }
+
+    if (nNeedBytes > 0)
+        cout << job.strInput << ": tag at offset " << parser.StreamPos() << " needs " << nNeedBytes
+             << " bytes, more than the input buffer limit " << job.nMaxBufferSize << endl;
+    if (job.bVerbose)
+        parser.PrintInfo();
+    if (job.bInMemory)
+    {
+        if (!job.strH264Path.empty())
+            parser.DumpH264(job.strH264Path);
+        if (!job.strAACPath.empty())
+            parser.DumpAAC(job.strAACPath);
+        if (!job.strFlvPath.empty())
+            parser.DumpFlv(job.strFlvPath);
+        if (!job.strMp4Path.empty())
+            parser.DumpFmp4(job.strMp4Path);
+    }
+    else
+    {
+        int64_t nStartNs = job.pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
+        pSink->Finish();
+        if (job.pMetrics != NULL)
+        {
+            job.pMetrics->nBytesWritten += pSink->BytesWritten();
+            job.pMetrics->nStageNs[FLV_STAGE_DUMP] += CFlvMetrics::NowNs() - nStartNs;
+            job.pMetrics->nStageCalls[FLV_STAGE_DUMP]++;
+        }
+        delete pSink;
+        delete pWriteQueue;
+    }
+
+    if (bBuildIndex)
+    {
+        if (!index.Save(job.strIndexPath.c_str(), nFileSize >= 0 ? nFileSize : result.nBytes))
+            cout << "can not write index " << job.strIndexPath << endl;
+        else if (job.bVerbose)
+            cout << "index: " << index.KeyframeNum() << " keyframes, " << index.ConfigNum() << " configs" << endl;
+    }
+
+    result.nResult = nNeedBytes > 0 ? 2 : 1;
+    result.nVideoNum = parser.GetStat().nVideoNum;
+    result.nAudioNum = parser.GetStat().nAudioNum;
+    result.nMetaNum = parser.GetStat().nMetaNum;
+    result.dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+    return result.nResult;
+}
+
+static bool IsFlvFile(const string &name)
+{
+    if (name.size() < 4)
+        return false;
+    string ext = name.substr(name.size() - 4);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".flv";
+}
+
+int CollectFlvInputs(const char *path, vector<string> &vFiles)
+{
+#ifndef _WIN32
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        DIR *dir = opendir(path);
+        if (dir == NULL)
+            return 0;
+
+        vector<string> vNames;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            if (IsFlvFile(ent->d_name))
+                vNames.push_back(ent->d_name);
+        }
+        closedir(dir);
+
+        // 按文件名排序, 保证每次处理和汇总的顺序一致
+        sort(vNames.begin(), vNames.end());
+        for (size_t i = 0; i < vNames.size(); i++)
+            vFiles.push_back(string(path) + "/" + vNames[i]);
+        return 1;
+    }
+#endif
+
+    ifstream fin(path);
+    if (!fin)
+        return 0;
+
+    string line;
+    while (getline(fin, line))
+    {
+        // 去掉行尾的\r和空白
+        while (!line.empty() && isspace((unsigned char)line[line.size() - 1]))
+            line.erase(line.size() - 1);
+        if (!line.empty() && line[0] != '#')
+            vFiles.push_back(line);
+    }
+    return 1;
+}
+
+// 去掉目录和.flv扩展名
+static string BaseName(const string &path)
+{
+    size_t nSlash = path.find_last_of("/\\");
+    string name = (nSlash == string::npos) ? path : path.substr(nSlash + 1);
+    if (IsFlvFile(name))
+        name.erase(name.size() - 4);
+    return name;
+}
+
+int RunFlvBatch(const vector<string> &vFiles, const string &outDir, int nThreads, bool bInMemory, bool bRemuxOnly,
+                bool bMp4, CFlvMetrics *pMetrics)
+{
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+
+#ifndef _WIN32
+    // 输出目录不存在时创建
+    struct stat st;
+    if (stat(outDir.c_str(), &st) != 0 && mkdir(outDir.c_str(), 0755) != 0)
+    {
+        printf("can not create %s\n", outDir.c_str());
+        return 0;
+    }
+#endif
+
+    // 每个文件的输出名, 不同目录下的同名文件加上序号区分
+    vector<FlvJob> vJob(vFiles.size());
+    vector<CFlvMetrics> vMetrics(pMetrics != NULL ? vFiles.size() : 0); // 每个文件单独统计, 最后合并
+    map<string, int> mapName;
+    for (size_t i = 0; i < vFiles.size(); i++)
+    {
+        string name = BaseName(vFiles[i]);
+        int nSame = mapName[name]++;
+        if (nSame > 0)
+        {
+            char szSuffix[16];
+            snprintf(szSuffix, sizeof(szSuffix), "_%d", nSame);
+            name += szSuffix;
+        }
+
+        string base = outDir + "/" + name;
+        vJob[i].strInput = vFiles[i];
+        vJob[i].strFlvPath = base + ".flv";
+        if (!bRemuxOnly)
+        {
+            vJob[i].strH264Path = base + ".264";
+            vJob[i].strAACPath = base + ".aac";
+        }
+        if (bMp4)
+            vJob[i].strMp4Path = base + ".mp4";
+        vJob[i].bInMemory = bInMemory;
+        vJob[i].bVerbose = false;
+        if (pMetrics != NULL)
+            vJob[i].pMetrics = &vMetrics[i];
+    }
+
+    vector<FlvJobResult> vResult(vFiles.size());
+    CFlvThreadPool pool(nThreads);
+    pool.Run((int)vJob.size(), [&](int nTask, int nThread) {
+        ProcessFlvJob(vJob[nTask], vResult[nTask]);
+    });
+
+    double dSeconds = chrono::duration<double>(chrono::steady_clock::now() - tStart).count();
+    for (size_t i = 0; i < vMetrics.size(); i++)
+        pMetrics->Merge(vMetrics[i]);
+
+    // 汇总
+    int nOk = 0;
+    int64_t nBytes = 0, nTags = 0;
+    for (size_t i = 0; i < vResult.size(); i++)
+    {
+        const FlvJobResult &r = vResult[i];
+        if (r.nResult != 1)
+        {
+            printf("[failed] %s\n", vFiles[i].c_str());
+            continue;
+        }
+
+        nOk++;
+        nBytes += r.nBytes;
+        nTags += r.nVideoNum + r.nAudioNum + r.nMetaNum;
+        printf("[ok] %s -> %s, %lld bytes, vnum: %d, anum: %d, mnum: %d, %.3fs\n", vFiles[i].c_str(),
+               vJob[i].strFlvPath.c_str(), (long long)r.nBytes, r.nVideoNum, r.nAudioNum, r.nMetaNum, r.dSeconds);
+    }
+
+    printf("----- batch ------\n");
+    printf("files: %d, ok: %d, failed: %d, threads: %d\n", (int)vFiles.size(), nOk, (int)vFiles.size() - nOk, pool.Threads());
+    printf("bytes: %lld, tags: %lld, time: %.3fs, %.2f MB/s\n", (long long)nBytes, (long long)nTags, dSeconds,
+           dSeconds > 0 ? nBytes / 1048576.0 / dSeconds : 0.0);
+
+    return nOk == (int)vFiles.size() ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+﻿#ifndef FLVBATCH_H
+#define FLVBATCH_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CFlvMetrics;
+
+// 处理一个FLV文件的参数
+struct FlvJob
+{
+    std::string strInput;    // 输入文件, "-"表示标准输入
+    std::string strFlvPath;  // 输出的FLV文件, 为空则不输出
+    std::string strH264Path; // 输出的H.264文件, 为空则不输出
+    std::string strAACPath;  // 输出的AAC文件, 为空则不输出
+    std::string strMp4Path;  // 输出的分片MP4文件, 为空则不输出
+    bool bInMemory;          // true: 先解析完整个文件再输出; false: 流式输出
+    bool bVerbose;           // 是否打印解析信息(PrintInfo等)
+    std::string strIndexPath; // 关键帧索引文件. nSeekTime<0时解析过程中生成并保存, 否则从中加载
+    int64_t nSeekTime;        // 从该时间戳(ms)之前最近的关键帧开始解析, 小于0表示从头解析
+    int nDecodeThreads;       // 大于1时用多个线程并行处理Tag Body(两阶段解析)
+    bool bLive;               // 实时输入: strInput为"-"(标准输入)或者Unix socket路径(等待一个连接),
+                              // 每次读到数据立即用Feed()解析并输出, 不等待读满缓冲区
+    CFlvMetrics *pMetrics;    // 不为NULL时统计性能计数(累加)
+    bool bPipeline;           // 流水线: 读取/解析/写出分别在三个线程中进行(只用于流式输出, 不使用索引定位)
+    int64_t nMaxBufferSize;   // 读缓冲区(初始2MB)遇到更大的Tag时最多扩大到这么大, 不能映射的输入才使用
+
+    FlvJob()
+        : bInMemory(false), bVerbose(true), nSeekTime(-1), nDecodeThreads(1), bLive(false), pMetrics(NULL),
+          bPipeline(false), nMaxBufferSize(64 * 1024 * 1024)
+    {
+    }
+};
+
+// 处理结果
+struct FlvJobResult
+{
+    int nResult;    // 1: 成功, 0: 无法打开输入文件, 2: 有Tag超过读缓冲区的上限, 其后的数据没有解析
+    int64_t nBytes; // 输入的字节数
+    int nVideoNum, nAudioNum, nMetaNum;
+    double dSeconds; // 耗时
+
+    FlvJobResult() : nResult(0), nBytes(0), nVideoNum(0), nAudioNum(0), nMetaNum(0), dSeconds(0) {}
+};
+
+int ProcessFlvJob(const FlvJob &job, FlvJobResult &result);
+
+// path是目录时收集其中所有的.flv文件, 否则把path当作文件列表, 每行一个文件
+int CollectFlvInputs(const char *path, std::vector<std::string> &vFiles);
+
+// 用nThreads个线程处理所有文件, 输出到outDir/<文件名>.flv/.264/.aac, 最后打印汇总信息.
+// bRemuxOnly为true时只输出.flv, bMp4为true时再输出.mp4(分片MP4). pMetrics不为NULL时累加所有文件的性能计数. 全部成功返回1
+int RunFlvBatch(const std::vector<std::string> &vFiles, const std::string &outDir, int nThreads, bool bInMemory,
+                bool bRemuxOnly = false, bool bMp4 = false, CFlvMetrics *pMetrics = NULL);
+
+#endif // FLVBATCH_H
@@ -0,0 +1,496 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#include "FlvParser.h"
+#include "FlvReader.h"
+#include "FlvDumpSink.h"
+#include "FlvSynth.h"
+#include "FlvNalu.h"
+#include "FlvThreadPool.h"
+
+using namespace std;
+
+/*
+性能测试:
+1. 用 CFlvSynth 按参数生成确定性的FLV文件
+2. 分别测量 流式解析 / Parse / DumpH264 / DumpAAC / DumpFlv / metadata 解析的吞吐量(MB/s, tags/s)
+3. 每个阶段结束后报告进程的峰值内存(RSS)
+-stress N: 同一进程中同时解析N个不同配置的流, 检查每个Tag使用的都是自己所在流的编解码配置
+ */
+
+static double Now()
+{
+    return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 峰值RSS(MB)
+static double PeakRssMB()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss / 1024.0; // Linux下单位是KB
+#endif
+    return 0;
+}
+
+static void Report(const char *szStage, double dSeconds, int64_t nBytes, int64_t nTags)
+{
+    printf("%-10s %10.3f %12.2f %14.0f %12.1f\n", szStage, dSeconds,
+           dSeconds > 0 ? nBytes / 1048576.0 / dSeconds : 0.0,
+           dSeconds > 0 ? nTags / dSeconds : 0.0, PeakRssMB());
+}
+
+static int64_t TagNum(CFlvParser &parser)
+{
+    return parser.GetStat().nVideoNum + parser.GetStat().nAudioNum + parser.GetStat().nMetaNum;
+}
+
+// 与 FlvParser 的映射文件处理相同, 一次解析整个文件
+static void ParseMapped(CFlvParser &parser, CFlvFileMap &map)
+{
+    int64_t nUsedLen = 0;
+    parser.Parse(map.Data(), map.Size(), nUsedLen);
+}
+
+// -------------------------------------------------------------------------------------
+// ------------------------------------ 压力测试 ----------------------------------------
+// -------------------------------------------------------------------------------------
+
+static const int64_t nStressBytes = 128 * 1024; // 每个流中每种配置的大小
+
+// 第n种配置: 分辨率/帧率/NALU长度字段/slice数/采样率/声道数都不相同
+static FlvSynthConfig StressConfig(int n)
+{
+    static const int nRes[5][2] = {{640, 360}, {854, 480}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+    static const int nSampleRateIndex[5] = {3, 4, 6, 8, 11}; // 48000, 44100, 24000, 16000, 8000
+
+    FlvSynthConfig config;
+    config.nWidth = nRes[n % 5][0];
+    config.nHeight = nRes[n % 5][1];
+    config.nFps = 15 + n % 4 * 5;
+    config.nVideoKbps = 800;
+    config.nGop = 10 + n % 20;
+    config.nSlices = 1 + n % 3;
+    config.nNaluLengthSize = 1 + n % 4;
+    config.nSampleRateIndex = nSampleRateIndex[n / 5 % 5];
+    config.nChannels = 1 + n % 2;
+    config.nTargetBytes = nStressBytes;
+    config.nSeed = (uint32_t)n + 1;
+    return config;
+}
+
+// 检查每个Tag的编解码上下文以及生成的H.264/ADTS是否与该流当前的配置一致.
+// 每个流由两段不同配置的FLV拼接而成, 遇到sequence header时切换到下一段的配置.
+// nStopEvery大于0时每nStopEvery个视频Tag要求停止一次, 调用者继续Feed(), 检查停止之后能够从剩余的数据继续解析
+class CStressSink : public CFlvTagSink
+{
+public:
+    CStressSink(const FlvSynthConfig *pConfig, int nConfigs, int nStopEvery = 0)
+        : _pConfig(pConfig), _nConfigs(nConfigs), _nVideoSeg(-1), _nAudioSeg(-1), _nErrors(0),
+          _nStopEvery(nStopEvery), _nVideoTags(0)
+    {
+    }
+
+    virtual int OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag)
+    {
+        if (pTag->_pTagData[1] == 0)
+            _nVideoSeg++;
+        if (_nVideoSeg < 0 || _nVideoSeg >= _nConfigs)
+            return Error();
+
+        const FlvSynthConfig &config = _pConfig[_nVideoSeg];
+        const CFlvParser::VideoContext *pCtx = pTag->_pCtx;
+        if (pCtx->nNalUnitLength != config.nNaluLengthSize || !pCtx->bSps || pCtx->sps.nWidth != config.nWidth ||
+            pCtx->sps.nHeight != config.nHeight)
+            return Error();
+
+        // 每个NALU都应该转换成起始码, 长度字段读错时NALU的个数或者长度就会不一致
+        int nMediaLen = 0;
+        uint8_t *pMedia = pParser->GetMedia(pTag, nMediaLen);
+        int nNalus = 0, nLen = 0;
+        WalkAvccNalus(pTag->_pTagData + 5, pTag->_header.nDataSize - 5, pCtx->nNalUnitLength,
+                      [&](const uint8_t *pNalu, int nNaluLen) {
+                          nNalus++;
+                          nLen += 4 + nNaluLen;
+                          return true;
+                      });
+        if (pTag->_pTagData[1] == 1 && (pMedia == NULL || nNalus == 0 || nMediaLen != nLen || pMedia[3] != 1))
+            return Error();
+        return (_nStopEvery > 0 && ++_nVideoTags % _nStopEvery == 0) ? 0 : 1;
+    }
+
+    virtual int OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag)
+    {
+        if (pTag->_pTagData[1] == 0)
+        {
+            _nAudioSeg++;
+            return 1;
+        }
+        if (_nAudioSeg < 0 || _nAudioSeg >= _nConfigs)
+            return Error();
+
+        const FlvSynthConfig &config = _pConfig[_nAudioSeg];
+        int nMediaLen = 0;
+        uint8_t *p = pParser->GetMedia(pTag, nMediaLen);
+        if (p == NULL || nMediaLen != 7 + pTag->_header.nDataSize - 2)
+            return Error();
+
+        // ADTS头: profile(2bit) sampling_frequency_index(4bit) private_bit(1bit) channel_configuration(3bit)
+        int nSampleRateIndex = (p[2] >> 2) & 0x0f;
+        int nChannelConfig = ((p[2] & 0x01) << 2) | (p[3] >> 6);
+        int nFrameLen = ((p[3] & 0x03) << 11) | (p[4] << 3) | (p[5] >> 5);
+        if (p[0] != 0xff || (p[2] >> 6) != 1 || nSampleRateIndex != config.nSampleRateIndex ||
+            nChannelConfig != config.nChannels || nFrameLen != nMediaLen)
+            return Error();
+        return 1;
+    }
+
+    int Errors() { return _nErrors; }
+    int Segments() { return _nVideoSeg + 1 < _nAudioSeg + 1 ? _nVideoSeg + 1 : _nAudioSeg + 1; }
+
+private:
+    int Error()
+    {
+        _nErrors++;
+        return 1; // 继续解析, 统计所有出错的Tag
+    }
+
+    const FlvSynthConfig *_pConfig;
+    int _nConfigs;
+    int _nVideoSeg, _nAudioSeg; // 当前配置的序号
+    int _nErrors;
+    int _nStopEvery;
+    int _nVideoTags;
+};
+
+struct StressStream
+{
+    FlvSynthConfig config[2];
+    vector<uint8_t> vData;
+    FlvSynthResult synth[2];
+    size_t nPos;  // 已经交给Feed()的字节数
+    int nChunk;   // 每次Feed()的字节数
+    CFlvParser *pParser;
+    CStressSink *pSink;
+};
+
+// 生成流i: 两段不同配置的FLV, 第二段去掉FLV头和第一个PreviousTagSize直接接在后面
+static void StressGenerate(StressStream &s, int i)
+{
+    s.config[0] = StressConfig(i);
+    s.config[1] = StressConfig(i + 7);
+    CFlvSynth(s.config[0]).Generate(s.vData, &s.synth[0]);
+    vector<uint8_t> v;
+    CFlvSynth(s.config[1]).Generate(v, &s.synth[1]);
+    s.vData.insert(s.vData.end(), v.begin() + 13, v.end());
+
+    s.nPos = 0;
+    s.nChunk = 1000 + i * 997 % 7000; // 不同的分块, Tag在任意位置被截断
+    s.pParser = new CFlvParser();
+    s.pParser->SetVerbose(false);
+    s.pParser->SetArena(i % 3 == 0);
+    s.pParser->SetLazyMedia(i % 2 == 0);
+    s.pSink = new CStressSink(s.config, 2, i % 4 == 1 ? 3 + i % 5 : 0);
+    s.pParser->SetSink(s.pSink);
+}
+
+// 检查流的解析结果, 正确返回1. 解析器内部只应该剩下文件末尾的PreviousTagSize
+static int StressCheck(StressStream &s)
+{
+    const CFlvParser::FlvStat &stat = s.pParser->GetStat();
+    return s.pSink->Errors() == 0 && s.pSink->Segments() == 2 && s.pParser->FeedBuffered() == 4 &&
+           stat.nVideoNum == s.synth[0].nVideoTags + s.synth[1].nVideoTags &&
+           stat.nAudioNum == s.synth[0].nAudioTags + s.synth[1].nAudioTags;
+}
+
+/*
+nThreads个线程, 每个线程负责一部分流: 先创建这些流的解析器, 再轮流给每个解析器Feed()一块数据,
+所有解析器在整个测试期间同时存在并交替解析, 与一个进程承载多路直播流的情况相同
+ */
+static int Stress(int nStreams, int nThreads)
+{
+    vector<StressStream> vStream(nStreams);
+    vector<thread> vThread;
+    double t = Now();
+    for (int n = 0; n < nThreads; n++)
+    {
+        vThread.push_back(thread([&vStream, n, nThreads, nStreams]() {
+            for (int i = n; i < nStreams; i += nThreads)
+                StressGenerate(vStream[i], i);
+
+            bool bMore = true;
+            while (bMore)
+            {
+                bMore = false;
+                for (int i = n; i < nStreams; i += nThreads)
+                {
+                    StressStream &s = vStream[i];
+                    if (s.nPos >= s.vData.size())
+                        continue;
+                    int nLen = (int)(s.vData.size() - s.nPos < (size_t)s.nChunk ? s.vData.size() - s.nPos : s.nChunk);
+                    s.pParser->Feed(&s.vData[s.nPos], nLen);
+                    s.nPos += nLen;
+                    bMore = true;
+                }
+            }
+
+            // 最后一次Feed()停止时剩余的数据中可能还有完整的Tag, 不传入数据继续解析
+            for (int i = n; i < nStreams; i += nThreads)
+            {
+                while (vStream[i].pParser->Feed(NULL, 0))
+                    ;
+            }
+        }));
+    }
+    for (size_t i = 0; i < vThread.size(); i++)
+        vThread[i].join();
+    double dSeconds = Now() - t;
+
+    int64_t nBytes = 0, nTags = 0;
+    int nFailed = 0;
+    for (int i = 0; i < nStreams; i++)
+    {
+        StressStream &s = vStream[i];
+        nBytes += (int64_t)s.vData.size();
+        nTags += TagNum(*s.pParser);
+        if (!StressCheck(s))
+        {
+            nFailed++;
+            printf("stream %d failed: %dx%d nalu %d / %dx%d nalu %d, %d tag errors\n", i, s.config[0].nWidth,
+                   s.config[0].nHeight, s.config[0].nNaluLengthSize, s.config[1].nWidth, s.config[1].nHeight,
+                   s.config[1].nNaluLengthSize, s.pSink->Errors());
+        }
+        delete s.pParser;
+        delete s.pSink;
+    }
+
+    Report("stress", dSeconds, nBytes, nTags);
+    printf("\nstress: %d streams, %d threads, %d failed\n", nStreams, nThreads, nFailed);
+    return nFailed == 0 ? 0 : 1;
+}
+
+static void Usage()
+{
+    cout << "FlvBench [options]" << endl;
+    cout << "  -size MB      size of the generated file (default 64)" << endl;
+    cout << "  -res WxH      resolution (default 1280x720)" << endl;
+    cout << "  -fps N        frame rate (default 30)" << endl;
+    cout << "  -kbps N       video bitrate (default 4000)" << endl;
+    cout << "  -gop N        keyframe interval in frames (default 60)" << endl;
+    cout << "  -slices N     NALUs per frame (default 1)" << endl;
+    cout << "  -nalu N       NALU length size 1-4 (default 4)" << endl;
+    cout << "  -noaudio      no AAC track" << endl;
+    cout << "  -seed N       random seed (default 1)" << endl;
+    cout << "  -file path    generated file (default ./flvbench.flv, removed at exit unless -keep)" << endl;
+    cout << "  -keep         keep the generated file and the dump outputs" << endl;
+    cout << "  -out dir      directory for dump outputs bench.264/.aac/.flv (default: [file].264/.aac/.out.flv" << endl;
+    cout << "                next to the generated file, removed at exit unless -keep)" << endl;
+    cout << "  -meta N       number of onMetaData tags for the metadata test (default 100000)" << endl;
+    cout << "  -threads N    threads decoding tag bodies in the stream/parse stages (default 1)" << endl;
+    cout << "  -stress N     only run the stress test: N streams with different configs parsed at once" << endl;
+    cout << "                by -threads threads, exit code 1 if any stream is parsed incorrectly" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    FlvSynthConfig config;
+    string filePath = "flvbench.flv";
+    string outDir;
+    bool bKeep = false;
+    int nMetaTags = 100000;
+    int nThreads = 1;
+    int nStress = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool bHasValue = (i + 1 < argc);
+        if (arg == "-size" && bHasValue)
+            config.nTargetBytes = (int64_t)(atof(argv[++i]) * 1048576);
+        else if (arg == "-res" && bHasValue && sscanf(argv[i + 1], "%dx%d", &config.nWidth, &config.nHeight) == 2)
+            i++;
+        else if (arg == "-fps" && bHasValue)
+            config.nFps = atoi(argv[++i]);
+        else if (arg == "-kbps" && bHasValue)
+            config.nVideoKbps = atoi(argv[++i]);
+        else if (arg == "-gop" && bHasValue)
+            config.nGop = atoi(argv[++i]);
+        else if (arg == "-slices" && bHasValue)
+            config.nSlices = atoi(argv[++i]);
+        else if (arg == "-nalu" && bHasValue)
+            config.nNaluLengthSize = atoi(argv[++i]);
+        else if (arg == "-noaudio")
+            config.bAudio = false;
+        else if (arg == "-seed" && bHasValue)
+            config.nSeed = (uint32_t)atoi(argv[++i]);
+        else if (arg == "-file" && bHasValue)
+            filePath = argv[++i];
+        else if (arg == "-keep")
+            bKeep = true;
+        else if (arg == "-out" && bHasValue)
+            outDir = argv[++i];
+        else if (arg == "-meta" && bHasValue)
+            nMetaTags = atoi(argv[++i]);
+        else if (arg == "-threads" && bHasValue && atoi(argv[i + 1]) > 0)
+            nThreads = atoi(argv[++i]);
+        else if (arg == "-stress" && bHasValue && atoi(argv[i + 1]) > 0)
+            nStress = atoi(argv[++i]);
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (nStress > 0)
+    {
+        printf("%-10s %10s %12s %14s %12s\n", "stage", "seconds", "MB/s", "tags/s", "peakRSS(MB)");
+        return Stress(nStress, nThreads);
+    }
+
+    // 输出到真实的文件, 写到/dev/null时writev几乎没有开销, 测不出输出的速度
+    bool bRemoveOutputs = outDir.empty() && !bKeep;
+    string h264Path = outDir.empty() ? filePath + ".264" : outDir + "/bench.264";
+    string aacPath = outDir.empty() ? filePath + ".aac" : outDir + "/bench.aac";
+    string flvPath = outDir.empty() ? filePath + ".out.flv" : outDir + "/bench.flv";
+
+    printf("config: %dx%d, %dfps, %dkbps, gop %d, slices %d, nalu length %d, audio %s, seed %u\n",
+           config.nWidth, config.nHeight, config.nFps, config.nVideoKbps, config.nGop, config.nSlices,
+           config.nNaluLengthSize, config.bAudio ? "on" : "off", config.nSeed);
+    printf("start code scanner: %s, decode threads: %d\n\n", StartCodeScannerName(), nThreads);
+    printf("%-10s %10s %12s %14s %12s\n", "stage", "seconds", "MB/s", "tags/s", "peakRSS(MB)");
+
+    // 1. 生成
+    FlvSynthResult synth;
+    double t = Now();
+    CFlvSynth generator(config);
+    if (!generator.Generate(filePath.c_str(), &synth))
+    {
+        printf("can not write %s\n", filePath.c_str());
+        return 1;
+    }
+    Report("generate", Now() - t, synth.nBytes, synth.nVideoTags + synth.nAudioTags + synth.nMetaTags);
+
+    CFlvFileMap map;
+    if (!map.Open(filePath.c_str()))
+    {
+        printf("can not map %s\n", filePath.c_str());
+        return 1;
+    }
+    int64_t nBytes = map.Size();
+    CFlvThreadPool pool(nThreads);
+    int nResult = 0;
+
+    {
+        // 2. 流式: 解析的同时输出三个文件, 先于内存模式运行, 峰值内存只反映流式解析
+        CFlvParser parser;
+        parser.SetVerbose(false);
+        parser.SetZeroCopy(true);
+        parser.SetArena(true);
+        parser.SetThreadPool(&pool);
+        CFlvDumpSink sink(h264Path.c_str(), aacPath.c_str(), flvPath.c_str());
+        if (!sink.IsOpen())
+        {
+            printf("can not write %s, %s or %s\n", h264Path.c_str(), aacPath.c_str(), flvPath.c_str());
+            map.Close();
+            if (!bKeep)
+                remove(filePath.c_str());
+            return 1;
+        }
+        parser.SetSink(&sink);
+
+        t = Now();
+        ParseMapped(parser, map);
+        if (!sink.Finish())
+        {
+            printf("stream: can not write %s, %s or %s\n", h264Path.c_str(), aacPath.c_str(), flvPath.c_str());
+            nResult = 1;
+        }
+        Report("stream", Now() - t, nBytes, TagNum(parser));
+    }
+
+    {
+        // 3. 解析所有Tag并保存在内存中
+        CFlvParser parser;
+        parser.SetVerbose(false);
+        parser.SetZeroCopy(true);
+        parser.SetArena(true);
+        parser.SetThreadPool(&pool);
+
+        t = Now();
+        ParseMapped(parser, map);
+        int64_t nTags = TagNum(parser);
+        Report("parse", Now() - t, nBytes, nTags);
+
+        // 4. 输出
+        t = Now();
+        if (!parser.DumpH264(h264Path))
+        {
+            printf("can not write %s\n", h264Path.c_str());
+            nResult = 1;
+        }
+        Report("dumph264", Now() - t, nBytes, nTags);
+
+        t = Now();
+        if (!parser.DumpAAC(aacPath))
+        {
+            printf("can not write %s\n", aacPath.c_str());
+            nResult = 1;
+        }
+        Report("dumpaac", Now() - t, nBytes, nTags);
+
+        t = Now();
+        if (!parser.DumpFlv(flvPath))
+        {
+            printf("can not write %s\n", flvPath.c_str());
+            nResult = 1;
+        }
+        Report("dumpflv", Now() - t, nBytes, nTags);
+    }
+
+    {
+        // 5. metadata: 重复解析文件开头的onMetaData Tag
+        uint8_t *pData = map.Data();
+        int nMetaSize = 4 + 11 + (int)((pData[9 + 4 + 1] << 16) | (pData[9 + 4 + 2] << 8) | pData[9 + 4 + 3]);
+        vector<uint8_t> vMeta(pData, pData + 9);
+        for (int i = 0; i < nMetaTags; i++)
+            vMeta.insert(vMeta.end(), pData + 9, pData + 9 + nMetaSize);
+
+        CFlvParser parser;
+        parser.SetVerbose(false);
+        parser.SetZeroCopy(true);
+        parser.SetArena(true);
+        CFlvTagSink sink; // 只解析, 不输出
+        parser.SetSink(&sink);
+
+        t = Now();
+        int64_t nUsedLen = 0;
+        parser.Parse(&vMeta[0], (int64_t)vMeta.size(), nUsedLen);
+        Report("metadata", Now() - t, (int64_t)vMeta.size(), TagNum(parser));
+    }
+
+    map.Close();
+    if (!bKeep)
+        remove(filePath.c_str());
+    if (bRemoveOutputs)
+    {
+        remove(h264Path.c_str());
+        remove(aacPath.c_str());
+        remove(flvPath.c_str());
+    }
+
+    return nResult;
+}
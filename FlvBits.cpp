@@ -0,0 +1,387 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include "FlvBits.h"
+
+using namespace std;
+
+bool FlvRbspUnescape(const uint8_t *p, int nLen, vector<uint8_t> &vRbsp)
+{
+    for (int i = 2; i < nLen; i++)
+    {
+        if (p[i] != 0x03 || p[i - 1] != 0 || p[i - 2] != 0)
+            continue;
+
+        // 第一个防竞争字节之前的数据整块复制, 之后逐字节处理
+        vRbsp.assign(p, p + i);
+        for (int j = i + 1, nZero = 0; j < nLen; j++)
+        {
+            if (nZero >= 2 && p[j] == 0x03)
+            {
+                nZero = 0;
+                continue;
+            }
+            nZero = (p[j] == 0) ? nZero + 1 : 0;
+            vRbsp.push_back(p[j]);
+        }
+        return true;
+    }
+    return false;
+}
+
+void FlvRbspEscape(const uint8_t *p, int nLen, vector<uint8_t> &vOut)
+{
+    int nZero = 0;
+    for (int i = 0; i < nLen; i++)
+    {
+        if (nZero >= 2 && p[i] <= 3)
+        {
+            vOut.push_back(0x03);
+            nZero = 0;
+        }
+        vOut.push_back(p[i]);
+        nZero = (p[i] == 0) ? nZero + 1 : 0;
+    }
+}
+
+// -------------------------------------------------------------------------------------
+// ---------------------------------- AAC ----------------------------------------------
+// -------------------------------------------------------------------------------------
+
+static const int nAacSampleRates[16] = {96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+                                        16000, 12000, 11025, 8000, 7350, 0, 0, 0};
+
+int FlvAacSampleRate(int nSampleRateIndex)
+{
+    return nAacSampleRates[nSampleRateIndex & 0x0f];
+}
+
+// audioObjectType: 5bit, 31表示后面还有6bit
+static int ReadObjectType(CFlvBitReader &br)
+{
+    int nType = br.ReadBits(5);
+    if (nType == 31)
+        nType = 32 + br.ReadBits(6);
+    return nType;
+}
+
+// samplingFrequencyIndex: 4bit, 15表示后面是24bit的采样率
+static int ReadSampleRate(CFlvBitReader &br, int &nIndex)
+{
+    nIndex = br.ReadBits(4);
+    return nIndex == 15 ? (int)br.ReadBits(24) : FlvAacSampleRate(nIndex);
+}
+
+// channelConfiguration对应的声道数
+static int ChannelCount(int nChannelConfig)
+{
+    static const int nChannels[16] = {0, 1, 2, 3, 4, 5, 6, 8, 0, 0, 0, 7, 8, 24, 8, 0};
+    return nChannels[nChannelConfig & 0x0f];
+}
+
+/*
+1. audioObjectType, 采样率, channelConfiguration
+2. audioObjectType为5(SBR)或29(PS)时是显式分层信令: 后面是SBR的采样率和核心编码的audioObjectType
+3. GASpecificConfig: frameLengthFlag决定每帧960还是1024个采样
+4. 剩余至少16bit时检查向后兼容信令(syncExtensionType 0x2b7 / 0x548)
+channelConfiguration为0(PCE)时不解析PCE, 声道数为0
+ */
+int ParseAacConfig(const uint8_t *p, int nLen, FlvAacConfig &config)
+{
+    config = FlvAacConfig();
+    CFlvBitReader br(p, nLen);
+
+    int nExtType = 0;
+    config.nObjectType = ReadObjectType(br);
+    config.nSampleRate = ReadSampleRate(br, config.nSampleRateIndex);
+    config.nChannelConfig = br.ReadBits(4);
+    if (config.nObjectType == 5 || config.nObjectType == 29)
+    {
+        nExtType = 5;
+        config.bSbr = true;
+        config.bPs = (config.nObjectType == 29);
+        int nExtIndex;
+        config.nExtSampleRate = ReadSampleRate(br, nExtIndex);
+        config.nObjectType = ReadObjectType(br);
+        if (config.nObjectType == 22)
+            br.ReadBits(4); // extensionChannelConfiguration
+    }
+    if (br.Error())
+        return 0;
+
+    switch (config.nObjectType)
+    {
+    case 1: case 2: case 3: case 4: case 6: case 7:
+    case 17: case 19: case 20: case 21: case 22: case 23:
+    {
+        // GASpecificConfig
+        if (br.ReadBit())
+            config.nFrameLength = 960;
+        if (br.ReadBit()) // dependsOnCoreCoder
+            br.ReadBits(14);
+        int nExtensionFlag = br.ReadBit();
+        if (config.nChannelConfig == 0)
+            break; // program_config_element
+        if (config.nObjectType == 6 || config.nObjectType == 20)
+            br.ReadBits(3); // layerNr
+        if (nExtensionFlag)
+        {
+            if (config.nObjectType == 22)
+                br.ReadBits(16); // numOfSubFrame, layer_length
+            if (config.nObjectType == 17 || config.nObjectType == 19 || config.nObjectType == 20 ||
+                config.nObjectType == 23)
+                br.ReadBits(3); // aacSection/Scalefactor/SpectralDataResilienceFlag
+            br.ReadBit();       // extensionFlag3
+        }
+
+        // epConfig
+        if (config.nObjectType >= 17 && config.nObjectType <= 27)
+            br.ReadBits(2);
+
+        if (nExtType != 5 && !br.Error() && br.BitsLeft() >= 16 && br.ReadBits(11) == 0x2b7)
+        {
+            nExtType = ReadObjectType(br);
+            if (nExtType == 5 && br.ReadBit())
+            {
+                config.bSbr = true;
+                int nExtIndex;
+                config.nExtSampleRate = ReadSampleRate(br, nExtIndex);
+                if (br.BitsLeft() >= 12 && br.ReadBits(11) == 0x548)
+                    config.bPs = (br.ReadBit() != 0);
+            }
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    config.nChannels = ChannelCount(config.nChannelConfig);
+    if (config.bPs && config.nChannels == 1)
+        config.nChannels = 2; // PS从单声道核心还原出立体声
+    return 1;
+}
+
+/*
+syncword(12) ID(1) layer(2) protection_absent(1) profile(2) sampling_frequency_index(4)
+private_bit(1) channel_configuration(3) original_copy(1) home(1)
+copyright_identification_bit(1) copyright_identification_start(1) aac_frame_length(13)
+adts_buffer_fullness(11) number_of_raw_data_blocks_in_frame(2)
+ */
+void MakeAdtsTemplate(int nObjectType, int nSampleRateIndex, int nChannelConfig, uint8_t szHeader[7])
+{
+    vector<uint8_t> v;
+    v.reserve(7);
+    CFlvBitWriter bw(v);
+    bw.PutBits(0xFFF, 12);
+    bw.PutBits(0, 1);
+    bw.PutBits(0, 2);
+    bw.PutBits(1, 1);
+    bw.PutBits(nObjectType - 1, 2); // profile = audioObjectType - 1, 只能表示Main/LC/SSR/LTP
+    bw.PutBits(nSampleRateIndex, 4);
+    bw.PutBits(0, 1);
+    bw.PutBits(nChannelConfig, 3);
+    bw.PutBits(0, 4);
+    bw.PutBits(0, 13); // aac_frame_length, 每帧改写
+    bw.PutBits(0x7FF, 11);
+    bw.PutBits(0, 2);
+    memcpy(szHeader, &v[0], 7);
+}
+
+// -------------------------------------------------------------------------------------
+// ---------------------------------- H.264 SPS ----------------------------------------
+// -------------------------------------------------------------------------------------
+
+FlvSpsInfo::FlvSpsInfo()
+{
+    nProfile = nConstraint = nLevel = nSpsId = 0;
+    nChromaFormat = 1;
+    nBitDepth = 8;
+    nWidth = nHeight = 0;
+    bInterlaced = false;
+    nSarNum = nSarDen = 1;
+    nVideoFormat = 5;
+    bFullRange = false;
+    nColourPrimaries = nTransfer = nMatrix = 2;
+    bTiming = false;
+    nNumUnitsInTick = nTimeScale = 0;
+    bFixedFrameRate = false;
+    dFrameRate = 0;
+}
+
+static void SkipScalingList(CFlvBitReader &br, int nSize)
+{
+    int nLastScale = 8, nNextScale = 8;
+    for (int j = 0; j < nSize && !br.Error(); j++)
+    {
+        if (nNextScale != 0)
+            nNextScale = (nLastScale + br.ReadSE() + 256) % 256;
+        nLastScale = (nNextScale == 0) ? nLastScale : nNextScale;
+    }
+}
+
+// aspect_ratio_idc 1~16 对应的sar_width:sar_height
+static const int nSarTable[17][2] = {{0, 0}, {1, 1}, {12, 11}, {10, 11}, {16, 11}, {40, 33}, {24, 11}, {20, 11},
+                                     {32, 11}, {80, 33}, {18, 11}, {15, 11}, {64, 33}, {160, 99}, {4, 3}, {3, 2},
+                                     {2, 1}};
+
+// 只读取到timing_info, 后面的HRD和bitstream_restriction不需要
+static void ParseVui(CFlvBitReader &br, FlvSpsInfo &info)
+{
+    if (br.ReadBit()) // aspect_ratio_info_present_flag
+    {
+        int nIdc = br.ReadBits(8);
+        if (nIdc == 255) // Extended_SAR
+        {
+            info.nSarNum = br.ReadBits(16);
+            info.nSarDen = br.ReadBits(16);
+        }
+        else if (nIdc > 0 && nIdc <= 16)
+        {
+            info.nSarNum = nSarTable[nIdc][0];
+            info.nSarDen = nSarTable[nIdc][1];
+        }
+    }
+    if (br.ReadBit()) // overscan_info_present_flag
+        br.ReadBit();
+    if (br.ReadBit()) // video_signal_type_present_flag
+    {
+        info.nVideoFormat = br.ReadBits(3);
+        info.bFullRange = (br.ReadBit() != 0);
+        if (br.ReadBit()) // colour_description_present_flag
+        {
+            info.nColourPrimaries = br.ReadBits(8);
+            info.nTransfer = br.ReadBits(8);
+            info.nMatrix = br.ReadBits(8);
+        }
+    }
+    if (br.ReadBit()) // chroma_loc_info_present_flag
+    {
+        br.ReadUE();
+        br.ReadUE();
+    }
+    if (br.ReadBit()) // timing_info_present_flag
+    {
+        uint32_t nNumUnitsInTick = br.ReadBits(32);
+        uint32_t nTimeScale = br.ReadBits(32);
+        bool bFixed = (br.ReadBit() != 0);
+        if (!br.Error() && nNumUnitsInTick > 0 && nTimeScale > 0)
+        {
+            info.bTiming = true;
+            info.nNumUnitsInTick = nNumUnitsInTick;
+            info.nTimeScale = nTimeScale;
+            info.bFixedFrameRate = bFixed;
+            info.dFrameRate = (double)nTimeScale / (2.0 * nNumUnitsInTick);
+        }
+    }
+}
+
+/*
+1. 去掉防竞争字节
+2. High系列的profile带有chroma_format_idc/位深/缩放矩阵
+3. 分辨率 = 宏块数 * 16 - 裁剪, 场编码时高度按帧计算
+4. VUI中的像素宽高比, 色彩信息和帧率; VUI不完整时忽略VUI, 不影响分辨率
+ */
+int ParseH264Sps(const uint8_t *pNalu, int nLen, FlvSpsInfo &info)
+{
+    info = FlvSpsInfo();
+    if (nLen < 4 || (pNalu[0] & 0x1f) != 7)
+        return 0;
+
+    vector<uint8_t> vRbsp;
+    const uint8_t *p = pNalu + 1;
+    int nRbspLen = nLen - 1;
+    if (FlvRbspUnescape(p, nRbspLen, vRbsp))
+    {
+        p = &vRbsp[0];
+        nRbspLen = (int)vRbsp.size();
+    }
+
+    CFlvBitReader br(p, nRbspLen);
+    info.nProfile = br.ReadBits(8);
+    info.nConstraint = br.ReadBits(8);
+    info.nLevel = br.ReadBits(8);
+    info.nSpsId = br.ReadUE();
+
+    bool bSeparateColourPlane = false;
+    int nProfile = info.nProfile;
+    if (nProfile == 100 || nProfile == 110 || nProfile == 122 || nProfile == 244 || nProfile == 44 ||
+        nProfile == 83 || nProfile == 86 || nProfile == 118 || nProfile == 128 || nProfile == 138 ||
+        nProfile == 139 || nProfile == 134 || nProfile == 135)
+    {
+        info.nChromaFormat = br.ReadUE();
+        if (info.nChromaFormat == 3)
+            bSeparateColourPlane = (br.ReadBit() != 0);
+        info.nBitDepth = br.ReadUE() + 8; // bit_depth_luma_minus8
+        br.ReadUE();                       // bit_depth_chroma_minus8
+        br.ReadBit();                      // qpprime_y_zero_transform_bypass_flag
+        if (br.ReadBit())                  // seq_scaling_matrix_present_flag
+        {
+            int nLists = (info.nChromaFormat != 3) ? 8 : 12;
+            for (int i = 0; i < nLists; i++)
+            {
+                if (br.ReadBit())
+                    SkipScalingList(br, i < 6 ? 16 : 64);
+            }
+        }
+    }
+    if (br.Error() || info.nChromaFormat > 3)
+        return 0;
+
+    br.ReadUE(); // log2_max_frame_num_minus4
+    uint32_t nPocType = br.ReadUE();
+    if (nPocType == 0)
+        br.ReadUE(); // log2_max_pic_order_cnt_lsb_minus4
+    else if (nPocType == 1)
+    {
+        br.ReadBit(); // delta_pic_order_always_zero_flag
+        br.ReadSE();  // offset_for_non_ref_pic
+        br.ReadSE();  // offset_for_top_to_bottom_field
+        uint32_t nCycle = br.ReadUE();
+        if (nCycle > 255)
+            return 0;
+        for (uint32_t i = 0; i < nCycle; i++)
+            br.ReadSE();
+    }
+    br.ReadUE();  // max_num_ref_frames
+    br.ReadBit(); // gaps_in_frame_num_value_allowed_flag
+
+    uint32_t nMbWidth = br.ReadUE() + 1;
+    uint32_t nMapHeight = br.ReadUE() + 1;
+    int nFrameMbsOnly = br.ReadBit();
+    if (!nFrameMbsOnly)
+        br.ReadBit(); // mb_adaptive_frame_field_flag
+    br.ReadBit();     // direct_8x8_inference_flag
+
+    uint32_t nCropLeft = 0, nCropRight = 0, nCropTop = 0, nCropBottom = 0;
+    if (br.ReadBit()) // frame_cropping_flag
+    {
+        nCropLeft = br.ReadUE();
+        nCropRight = br.ReadUE();
+        nCropTop = br.ReadUE();
+        nCropBottom = br.ReadUE();
+    }
+    if (br.Error() || nMbWidth > 1024 || nMapHeight > 1024)
+        return 0;
+
+    // 裁剪的单位: 4:2:0时水平和垂直都是2个像素, 场编码时垂直方向再乘2
+    int nChromaArrayType = bSeparateColourPlane ? 0 : info.nChromaFormat;
+    int nCropUnitX = (nChromaArrayType == 1 || nChromaArrayType == 2) ? 2 : 1;
+    int nCropUnitY = ((nChromaArrayType == 1) ? 2 : 1) * (2 - nFrameMbsOnly);
+    int nWidth = (int)nMbWidth * 16 - nCropUnitX * (int)(nCropLeft + nCropRight);
+    int nHeight = (2 - nFrameMbsOnly) * (int)nMapHeight * 16 - nCropUnitY * (int)(nCropTop + nCropBottom);
+    if (nWidth <= 0 || nHeight <= 0)
+        return 0;
+    info.nWidth = nWidth;
+    info.nHeight = nHeight;
+    info.bInterlaced = (nFrameMbsOnly == 0);
+
+    if (br.ReadBit()) // vui_parameters_present_flag
+    {
+        FlvSpsInfo vui = info;
+        ParseVui(br, vui);
+        if (!br.Error())
+            info = vui;
+    }
+    return 1;
+}
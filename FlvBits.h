@@ -0,0 +1,241 @@
+﻿#ifndef FLVBITS_H
+#define FLVBITS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// 64位数的前导0个数, n不能为0
+inline int FlvClz64(uint64_t n)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long nIndex;
+    _BitScanReverse64(&nIndex, n);
+    return 63 - (int)nIndex;
+#elif defined(__GNUC__)
+    return __builtin_clzll(n);
+#else
+    int nZeros = 0;
+    while (!(n & 0x8000000000000000ULL))
+    {
+        n <<= 1;
+        nZeros++;
+    }
+    return nZeros;
+#endif
+}
+
+/*
+大端比特读取(H.264 RBSP, AudioSpecificConfig等).
+未读的比特左对齐保存在64位缓存中, 不够时按字节补充, 一次读取最多32bit.
+读过数据末尾时返回0并设置Error(), 调用者可以读完一组字段之后再统一检查
+ */
+class CFlvBitReader
+{
+public:
+    CFlvBitReader(const uint8_t *p, int nLen) : _p(p), _pEnd(p + (nLen > 0 ? nLen : 0)), _nCache(0), _nCacheBits(0),
+                                                _bError(false) {}
+
+    uint32_t ReadBits(int nBits)
+    {
+        if (nBits <= 0)
+            return 0;
+        if (_nCacheBits < nBits)
+        {
+            Refill();
+            if (_nCacheBits < nBits)
+            {
+                _bError = true;
+                _nCache = 0;
+                _nCacheBits = 0;
+                return 0;
+            }
+        }
+        uint32_t n = (uint32_t)(_nCache >> (64 - nBits));
+        _nCache <<= nBits;
+        _nCacheBits -= nBits;
+        return n;
+    }
+
+    uint32_t ReadBit() { return ReadBits(1); }
+
+    void SkipBits(int nBits)
+    {
+        for (; nBits > 32; nBits -= 32)
+            ReadBits(32);
+        ReadBits(nBits);
+    }
+
+    // ue(v): 前导0的个数用缓存的前导0一次得到
+    uint32_t ReadUE()
+    {
+        Refill();
+        if (_nCache == 0 || FlvClz64(_nCache) >= _nCacheBits || FlvClz64(_nCache) > 31)
+        {
+            _bError = true;
+            return 0;
+        }
+        int nZeros = FlvClz64(_nCache);
+        _nCache <<= nZeros;
+        _nCacheBits -= nZeros;
+        return ReadBits(nZeros + 1) - 1;
+    }
+
+    // se(v): 1, -1, 2, -2 ...
+    int32_t ReadSE()
+    {
+        uint32_t n = ReadUE();
+        return (n & 1) ? (int32_t)((n + 1) >> 1) : -(int32_t)(n >> 1);
+    }
+
+    int BitsLeft() { return (int)(_pEnd - _p) * 8 + _nCacheBits; }
+    bool Error() { return _bError; }
+
+private:
+    void Refill()
+    {
+        while (_nCacheBits <= 56 && _p < _pEnd)
+        {
+            _nCache |= (uint64_t)*_p++ << (56 - _nCacheBits);
+            _nCacheBits += 8;
+        }
+    }
+
+    const uint8_t *_p;
+    const uint8_t *_pEnd;
+    uint64_t _nCache; // 左对齐
+    int _nCacheBits;
+    bool _bError;
+};
+
+// 大端比特写入, 追加到vOut. 最后不满一个字节的比特在ByteAlign()/Trailing()时补0写出
+class CFlvBitWriter
+{
+public:
+    CFlvBitWriter(std::vector<uint8_t> &vOut) : _vOut(vOut), _nBits(0), _nCount(0) {}
+
+    // 写入nValue的低nBits位(0~32)
+    void PutBits(uint32_t nValue, int nBits)
+    {
+        if (nBits <= 0)
+            return;
+        _nBits = (_nBits << nBits) | (nValue & (0xFFFFFFFFULL >> (32 - nBits)));
+        _nCount += nBits;
+        while (_nCount >= 8)
+        {
+            _nCount -= 8;
+            _vOut.push_back((uint8_t)(_nBits >> _nCount));
+        }
+    }
+
+    void PutUE(uint32_t nValue)
+    {
+        uint64_t n = (uint64_t)nValue + 1;
+        int nLen = 63 - FlvClz64(n);
+        PutBits(0, nLen);
+        if (nLen + 1 > 32)
+        {
+            PutBits((uint32_t)(n >> 32), nLen + 1 - 32);
+            PutBits((uint32_t)n, 32);
+        }
+        else
+            PutBits((uint32_t)n, nLen + 1);
+    }
+
+    void PutSE(int32_t nValue)
+    {
+        PutUE(nValue > 0 ? (uint32_t)nValue * 2 - 1 : (uint32_t)(-(int64_t)nValue) * 2);
+    }
+
+    void ByteAlign()
+    {
+        if (_nCount != 0)
+            PutBits(0, 8 - _nCount);
+    }
+
+    // rbsp_trailing_bits: 1个1, 然后补0到字节边界
+    void Trailing()
+    {
+        PutBits(1, 1);
+        ByteAlign();
+    }
+
+private:
+    std::vector<uint8_t> &_vOut;
+    uint64_t _nBits;
+    int _nCount; // _nBits中还没有写出的比特数, 总是小于8
+};
+
+// 去掉防竞争字节(00 00 03 -> 00 00). 没有防竞争字节时返回false, vRbsp不变, 直接使用原数据即可
+bool FlvRbspUnescape(const uint8_t *p, int nLen, std::vector<uint8_t> &vRbsp);
+// 插入防竞争字节(00 00 0x -> 00 00 03 0x, x <= 3), 追加到vOut
+void FlvRbspEscape(const uint8_t *p, int nLen, std::vector<uint8_t> &vOut);
+
+// AAC采样率索引对应的采样率, 13~15返回0
+int FlvAacSampleRate(int nSampleRateIndex);
+
+// AudioSpecificConfig(ISO/IEC 14496-3 1.6.2.1), 包括SBR/PS的显式和向后兼容信令
+struct FlvAacConfig
+{
+    int nObjectType;      // audioObjectType; SBR/PS显式信令时为核心编码的类型(一般是2: AAC LC)
+    int nSampleRateIndex; // 核心编码的采样率索引, 15表示直接给出采样率
+    int nSampleRate;      // 核心编码的采样率(Hz)
+    int nChannelConfig;   // channelConfiguration, 0表示由PCE定义(不解析)
+    int nChannels;        // 声道数, 无法确定时为0
+    int nFrameLength;     // 每帧的采样数: 1024或960
+    bool bSbr;            // HE-AAC
+    bool bPs;             // HE-AACv2
+    int nExtSampleRate;   // SBR的输出采样率, 没有SBR时为0
+
+    FlvAacConfig() : nObjectType(0), nSampleRateIndex(0), nSampleRate(0), nChannelConfig(0), nChannels(0),
+                     nFrameLength(1024), bSbr(false), bPs(false), nExtSampleRate(0) {}
+};
+
+// 成功返回1
+int ParseAacConfig(const uint8_t *p, int nLen, FlvAacConfig &config);
+
+/*
+ADTS头模板: 7字节的ADTS头中只有13bit的aac_frame_length随帧变化,
+每个AudioSpecificConfig生成一次模板, 每帧复制后用PatchAdtsLength()改写其中3个字节
+ */
+void MakeAdtsTemplate(int nObjectType, int nSampleRateIndex, int nChannelConfig, uint8_t szHeader[7]);
+
+// nFrameLen: 包括7字节ADTS头的长度
+inline void PatchAdtsLength(uint8_t *pHeader, int nFrameLen)
+{
+    pHeader[3] = (uint8_t)((pHeader[3] & 0xfc) | ((nFrameLen >> 11) & 0x03));
+    pHeader[4] = (uint8_t)(nFrameLen >> 3);
+    pHeader[5] = (uint8_t)((pHeader[5] & 0x1f) | ((nFrameLen & 0x07) << 5));
+}
+
+// H.264 SPS中与流信息有关的字段(ITU-T H.264 7.3.2.1.1, E.1.1)
+struct FlvSpsInfo
+{
+    int nProfile;          // profile_idc
+    int nConstraint;       // constraint_set0~5_flag
+    int nLevel;            // level_idc
+    int nSpsId;
+    int nChromaFormat;     // chroma_format_idc, 1: 4:2:0
+    int nBitDepth;         // 亮度的位深
+    int nWidth, nHeight;   // 裁剪之后的分辨率
+    bool bInterlaced;      // frame_mbs_only_flag为0
+    int nSarNum, nSarDen;  // 像素宽高比, 没有时为1:1
+    int nVideoFormat;      // video_format, 5: 未指定
+    bool bFullRange;
+    int nColourPrimaries, nTransfer, nMatrix; // 2: 未指定
+    bool bTiming;          // 是否有timing_info
+    uint32_t nNumUnitsInTick, nTimeScale;
+    bool bFixedFrameRate;
+    double dFrameRate;     // time_scale / (2 * num_units_in_tick), 没有timing_info时为0
+
+    FlvSpsInfo();
+};
+
+// pNalu: 带NAL头的SPS NALU(可以包含防竞争字节). 成功返回1
+int ParseH264Sps(const uint8_t *pNalu, int nLen, FlvSpsInfo &info);
+
+#endif // FLVBITS_H
@@ -0,0 +1,324 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include "FlvParser.h"
+#include "FlvReader.h"
+#include "FlvClip.h"
+
+using namespace std;
+
+/*
+截取过程中的sink, 分两个阶段:
+1. 开头: 输出FLV头, onMetaData(同时保存keyframes)和编解码配置, 遇到第一个音视频帧时停止
+2. 片段: 从关键帧开始输出, 关键帧之前时间戳的音频丢弃, 遇到时间戳超过结束时间的音视频Tag时停止.
+   这一阶段中出现的编解码配置(配置变化)照常输出
+ */
+class CFlvClipSink : public CFlvTagSink
+{
+public:
+    CFlvClipSink(CFlvTagSink *pOut, uint32_t nEndMs, FlvClipResult &result)
+        : _pOut(pOut), _nEndMs(nEndMs), _result(result), _bHead(true), _bMeta(false), _bStarted(false),
+          _nHeadSize(9)
+    {
+    }
+
+    void StartClip() { _bHead = false; }
+
+    virtual int OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader)
+    {
+        _nHeadSize = pHeader->nHeadSize;
+        return _pOut->OnHeader(pParser, pHeader);
+    }
+
+    virtual int OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag)
+    {
+        if (pTag->_nCodecID == 7 && pTag->_header.nDataSize >= 2 && pTag->_pTagData[1] == 0)
+            return _pOut->OnVideoTag(pParser, pTag);
+        if (_bHead)
+            return 0;
+        if (pTag->_header.nTotalTS > _nEndMs)
+            return 0;
+
+        if (!_bStarted)
+        {
+            if (pTag->_nFrameType != 1)
+                return 1;
+            _bStarted = true;
+            _result.nStartTime = pTag->_header.nTotalTS;
+        }
+        _result.nVideoNum++;
+        return _pOut->OnVideoTag(pParser, pTag);
+    }
+
+    virtual int OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag)
+    {
+        if (pTag->_nSoundFormat == 10 && pTag->_header.nDataSize >= 2 && pTag->_pTagData[1] == 0)
+            return _pOut->OnAudioTag(pParser, pTag);
+        if (_bHead)
+            return 0;
+        if (pTag->_header.nTotalTS > _nEndMs)
+            return 0;
+        if (!_bStarted || pTag->_header.nTotalTS < _result.nStartTime)
+            return 1;
+
+        _result.nAudioNum++;
+        return _pOut->OnAudioTag(pParser, pTag);
+    }
+
+    virtual int OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag)
+    {
+        if (_bHead)
+        {
+            if (!_bMeta && pTag->m_amf2_type != 0) // 只有onMetaData才会解析AMF2包
+            {
+                _bMeta = true;
+                _vTimes = pTag->m_keyframe_times;
+                _vPositions = pTag->m_keyframe_filepositions;
+            }
+            return _pOut->OnScriptTag(pParser, pTag);
+        }
+
+        // 片段中的其他Script Tag(例如cue point)只输出范围之内的
+        if (_bStarted && pTag->_header.nTotalTS <= _nEndMs)
+            return _pOut->OnScriptTag(pParser, pTag);
+        return 1;
+    }
+
+    virtual int OnOtherTag(CFlvParser *pParser, CFlvParser::Tag *pTag)
+    {
+        if (!_bHead && _bStarted)
+            return _pOut->OnOtherTag(pParser, pTag);
+        return 1;
+    }
+
+    const vector<double> &KeyframeTimes() { return _vTimes; }
+    const vector<double> &KeyframePositions() { return _vPositions; }
+    int HeadSize() { return _nHeadSize; }
+
+private:
+    CFlvTagSink *_pOut;
+    uint32_t _nEndMs;
+    FlvClipResult &_result;
+    bool _bHead;    // 是否还在读取文件开头
+    bool _bMeta;    // 是否已经收到onMetaData
+    bool _bStarted; // 是否已经输出开始的关键帧
+    int _nHeadSize;
+    vector<double> _vTimes;
+    vector<double> _vPositions;
+};
+
+// 只打开普通文件, 失败返回-1
+static int OpenFile(const char *path, int64_t &nFileSize)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)))
+    {
+        close(fd);
+        fd = -1;
+    }
+#else
+    int fd = _open(path, _O_RDONLY | _O_BINARY);
+    struct _stati64 st;
+    if (fd >= 0 && _fstati64(fd, &st) != 0)
+    {
+        _close(fd);
+        fd = -1;
+    }
+#endif
+    if (fd >= 0)
+        nFileSize = st.st_size;
+    return fd;
+}
+
+static void CloseFile(int fd)
+{
+#ifndef _WIN32
+    close(fd);
+#else
+    _close(fd);
+#endif
+}
+
+static int ReadAt(int fd, int64_t nOffset, uint8_t *pBuf, int nLen)
+{
+#ifndef _WIN32
+    ssize_t n = pread(fd, pBuf, nLen, (off_t)nOffset);
+    return n < 0 ? 0 : (int)n;
+#else
+    if (_lseeki64(fd, nOffset, SEEK_SET) != nOffset)
+        return 0;
+    int n = _read(fd, pBuf, nLen);
+    return n < 0 ? 0 : n;
+#endif
+}
+
+// Tag头(11字节)加上Body的前两个字节: 判断是否是视频关键帧(不包括AVC sequence header)
+static const int nPeekLen = 13;
+
+static bool IsKeyframe(const uint8_t *p)
+{
+    uint32_t nDataSize = ((uint32_t)p[1] << 16) | (p[2] << 8) | p[3];
+    if ((p[0] & 0x1f) != 0x09 || nDataSize < 2 || (p[11] >> 4) != 1)
+        return false;
+    return (p[11] & 0x0f) != 7 || p[12] != 0;
+}
+
+/*
+读取nOffset处的Tag头, 是完整的视频关键帧时返回1, 时间戳保存在nTimeStamp中
+ */
+static int ReadKeyframeHeader(int fd, int64_t nOffset, int64_t nFileSize, uint32_t &nTimeStamp, int64_t &nBytesRead)
+{
+    uint8_t buf[nPeekLen];
+    if (nOffset < 13 || nOffset + nPeekLen > nFileSize || ReadAt(fd, nOffset, buf, nPeekLen) != nPeekLen)
+        return 0;
+    nBytesRead += nPeekLen;
+
+    uint32_t nDataSize = ((uint32_t)buf[1] << 16) | (buf[2] << 8) | buf[3];
+    nTimeStamp = ((uint32_t)buf[7] << 24) | ((uint32_t)buf[4] << 16) | (buf[5] << 8) | buf[6];
+    if (!IsKeyframe(buf) || nOffset + 11 + nDataSize > nFileSize)
+        return 0;
+    return 1;
+}
+
+/*
+在keyframes中找到时间不超过nStartMs的最后一个关键帧(都超过时用第一个), 验证filepositions指向的是视频关键帧.
+有的工具记录的是Tag之前的PreviousTagSize的位置, 所以也尝试向后4字节. 失败返回-1
+ */
+static int64_t FindByTable(int fd, int64_t nFileSize, const vector<double> &vTimes, const vector<double> &vPositions,
+                           uint32_t nStartMs, int64_t &nBytesRead)
+{
+    if (vTimes.empty())
+        return -1;
+
+    size_t nIndex = 0;
+    for (size_t i = 0; i < vTimes.size(); i++)
+    {
+        if (vTimes[i] >= 0 && vTimes[i] * 1000 <= nStartMs + 0.5)
+            nIndex = i;
+        else if (vTimes[i] * 1000 > nStartMs)
+            break;
+    }
+
+    if (vPositions[nIndex] < 0 || vPositions[nIndex] >= (double)nFileSize)
+        return -1;
+    int64_t nPos = (int64_t)vPositions[nIndex];
+    for (int i = 0; i < 2; i++, nPos += 4)
+    {
+        uint32_t nTimeStamp = 0;
+        // keyframes.times通常只精确到毫秒或者更粗, 时间戳相差1秒以上说明表与文件不符
+        if (ReadKeyframeHeader(fd, nPos, nFileSize, nTimeStamp, nBytesRead) &&
+            llabs((int64_t)nTimeStamp - (int64_t)(vTimes[nIndex] * 1000 + 0.5)) <= 1000)
+            return nPos;
+    }
+    return -1;
+}
+
+/*
+从第一个Tag开始逐个读取Tag头(不读取Body), 找到时间戳不超过nStartMs的最后一个视频关键帧.
+遇到时间戳超过nStartMs的Tag并且已经找到关键帧时停止. 没有关键帧返回-1
+ */
+static int64_t FindByScan(int fd, int64_t nFileSize, int nHeadSize, uint32_t nStartMs, int64_t &nBytesRead)
+{
+    int64_t nFound = -1;
+    int64_t nPos = nHeadSize + 4;
+    uint8_t buf[nPeekLen];
+    while (nPos + nPeekLen <= nFileSize && ReadAt(fd, nPos, buf, nPeekLen) == nPeekLen)
+    {
+        nBytesRead += nPeekLen;
+        int nType = buf[0] & 0x1f;
+        uint32_t nDataSize = ((uint32_t)buf[1] << 16) | (buf[2] << 8) | buf[3];
+        uint32_t nTimeStamp = ((uint32_t)buf[7] << 24) | ((uint32_t)buf[4] << 16) | (buf[5] << 8) | buf[6];
+        if ((nType == 0x08 || nType == 0x09) && nTimeStamp > nStartMs && nFound >= 0)
+            break;
+        if (IsKeyframe(buf))
+            nFound = nPos;
+
+        nPos += 11 + nDataSize + 4;
+    }
+    return nFound;
+}
+
+/*
+从nOffset开始分块读取并解析, 直到sink要求停止或者文件结束. Tag放不下时按parser.NeedBytes()扩大缓冲区
+ */
+static void ParseAt(int fd, int64_t nOffset, CFlvParser &parser, CFlvInputBuffer &buf)
+{
+    while (1)
+    {
+        if (parser.NeedBytes() > buf.Capacity() && !buf.Grow(parser.NeedBytes(), FLV_MAX_TAG_BYTES))
+            break;
+        int64_t nReadNum = buf.FillAt(fd, nOffset);
+        if (nReadNum <= 0)
+            break;
+        nOffset += nReadNum;
+
+        int64_t nUsedLen = 0;
+        int nStop = parser.Parse(buf.Data(), buf.Size(), nUsedLen);
+        buf.Consume(nUsedLen);
+        if (nStop)
+            break;
+    }
+}
+
+int ExtractFlvClip(const char *path, uint32_t nStartMs, uint32_t nEndMs, CFlvTagSink *pOut, FlvClipResult &result)
+{
+    result = FlvClipResult();
+
+    int64_t nFileSize = 0;
+    int fd = OpenFile(path, nFileSize);
+    if (fd < 0)
+        return 0;
+
+    CFlvParser parser;
+    parser.SetVerbose(false);
+    parser.SetZeroCopy(true);
+    parser.SetLazyMedia(true);
+    CFlvClipSink sink(pOut, nEndMs, result);
+    parser.SetSink(&sink);
+
+    // 1. 文件开头, onMetaData很大(keyframes很长)时缓冲区会扩大
+    uint8_t szSignature[3];
+    if (ReadAt(fd, 0, szSignature, 3) != 3 || memcmp(szSignature, "FLV", 3) != 0)
+    {
+        CloseFile(fd);
+        return 0;
+    }
+    CFlvInputBuffer buf(64 * 1024);
+    ParseAt(fd, 0, parser, buf);
+    result.nBytesRead = buf.BytesRead();
+
+    // 2. 定位开始的关键帧
+    int64_t nPos = FindByTable(fd, nFileSize, sink.KeyframeTimes(), sink.KeyframePositions(), nStartMs,
+                               result.nBytesRead);
+    result.bKeyframeTable = (nPos >= 0);
+    if (nPos < 0)
+        nPos = FindByScan(fd, nFileSize, sink.HeadSize(), nStartMs, result.nBytesRead);
+    result.nStartPos = nPos;
+
+    // 3. 从关键帧前面的PreviousTagSize开始读取片段
+    if (nPos >= 0)
+    {
+        sink.StartClip();
+        int64_t nHeadBytes = buf.BytesRead();
+        buf.Consume(buf.Size());
+        buf.Reserve(256 * 1024); // 读过结束时间的数据最多是一个缓冲区
+        ParseAt(fd, nPos - 4, parser, buf);
+        result.nBytesRead += buf.BytesRead() - nHeadBytes;
+    }
+
+    CloseFile(fd);
+    result.nResult = 1;
+    return 1;
+}
@@ -0,0 +1,32 @@
+﻿#ifndef FLVCLIP_H
+#define FLVCLIP_H
+
+#include <stdint.h>
+
+class CFlvTagSink;
+
+// 截取结果
+struct FlvClipResult
+{
+    int nResult;           // 1: 成功, 0: 无法打开输入文件或者没有FLV头
+    bool bKeyframeTable;   // true: 用onMetaData的keyframes定位; false: 没有keyframes或者与文件不符, 扫描Tag头定位
+    int64_t nStartPos;     // 开始的关键帧Tag在文件中的位置, 没有找到关键帧时为-1
+    uint32_t nStartTime;   // 开始的关键帧的时间戳(ms)
+    int64_t nBytesRead;    // 从输入读取的总字节数(包括开头和扫描读取的Tag头)
+    int nVideoNum, nAudioNum; // 输出的音视频Tag数(不包括编解码配置)
+
+    FlvClipResult() : nResult(0), bKeyframeTable(false), nStartPos(-1), nStartTime(0), nBytesRead(0),
+                      nVideoNum(0), nAudioNum(0) {}
+};
+
+/*
+截取[nStartMs, nEndMs]之间的片段, 交给pOut(例如CFlvDumpSink输出FLV/H.264/AAC):
+1. 只读取文件开头的FLV头, onMetaData和编解码配置, 遇到第一个音视频帧就停止
+2. 用onMetaData中keyframes的times/filepositions直接找到nStartMs之前最近的关键帧,
+   读取该位置的Tag头验证确实是视频关键帧; 没有keyframes或者验证失败时逐个读取Tag头扫描
+3. 从该关键帧开始用pread读取, 遇到时间戳超过nEndMs的音视频Tag就停止, 不读取文件的其余部分
+输出的时间戳保持原样. 只支持普通文件(需要随机读取)
+ */
+int ExtractFlvClip(const char *path, uint32_t nStartMs, uint32_t nEndMs, CFlvTagSink *pOut, FlvClipResult &result);
+
+#endif // FLVCLIP_H
@@ -0,0 +1,163 @@
+﻿#include <string.h>
+
+#include "FlvDedup.h"
+#include "FlvNalu.h"
+#include "FlvBits.h"
+
+using namespace std;
+
+// FNV-1a, 再混入长度. 0留给"没有记录"
+static uint64_t HashNalu(const uint8_t *p, int nLen)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < nLen; i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= (uint64_t)nLen;
+    return h != 0 ? h : 1;
+}
+
+// SPS: NAL头 + profile_idc/constraint/level_idc之后是ue(v)的seq_parameter_set_id; PPS: NAL头之后就是id. 出错返回-1
+static int ParamSetId(const uint8_t *p, int nLen, int nSkip, int nMaxId)
+{
+    CFlvBitReader bits(p + nSkip, nLen - nSkip);
+    uint32_t nId = bits.ReadUE();
+    return (bits.Error() || nId > (uint32_t)nMaxId) ? -1 : (int)nId;
+}
+
+CFlvNaluDedup::CFlvNaluDedup()
+{
+    _pCtx = NULL;
+    _nDataSize = 0;
+    _nDropped = 0;
+    _bChanged = false;
+    Activate(NULL);
+}
+
+void CFlvNaluDedup::Activate(const CFlvParser::VideoContext *pCtx)
+{
+    _pCtx = pCtx;
+    memset(_nSpsHash, 0, sizeof(_nSpsHash));
+    memset(_nPpsHash, 0, sizeof(_nPpsHash));
+    memset(_nSeiHash, 0, sizeof(_nSeiHash));
+    if (pCtx == NULL)
+        return;
+
+    int nId;
+    if (pCtx->vSps.size() > 4 && (nId = ParamSetId(&pCtx->vSps[0], (int)pCtx->vSps.size(), 4, 31)) >= 0)
+        _nSpsHash[nId] = HashNalu(&pCtx->vSps[0], (int)pCtx->vSps.size());
+    if (pCtx->vPps.size() > 1 && (nId = ParamSetId(&pCtx->vPps[0], (int)pCtx->vPps.size(), 1, 255)) >= 0)
+        _nPpsHash[nId] = HashNalu(&pCtx->vPps[0], (int)pCtx->vPps.size());
+}
+
+bool CFlvNaluDedup::Keep(const uint8_t *p, int nLen)
+{
+    uint64_t *pSlot = NULL;
+    int nId;
+    switch (p[0] & 0x1f)
+    {
+    case 7:
+        if (nLen > 4 && (nId = ParamSetId(p, nLen, 4, 31)) >= 0)
+            pSlot = &_nSpsHash[nId];
+        break;
+    case 8:
+        if (nLen > 1 && (nId = ParamSetId(p, nLen, 1, 255)) >= 0)
+            pSlot = &_nPpsHash[nId];
+        break;
+    case 6:
+        // 只去掉user_data(4: registered, 5: unregistered). buffering_period/pic_timing/recovery_point等
+        // 与所在的访问单元有关, 内容相同也要保留
+        if (nLen > 1 && (p[1] == 4 || p[1] == 5))
+            pSlot = &_nSeiHash[p[1]];
+        break;
+    default:
+        break;
+    }
+    if (pSlot == NULL)
+        return true;
+
+    uint64_t h = HashNalu(p, nLen);
+    if (*pSlot == h)
+        return false;
+    // SPS变化之后解码器会丢弃引用它的PPS, 之后与原来相同的PPS也要重新输出
+    if ((p[0] & 0x1f) == 7 && *pSlot != 0)
+        memset(_nPpsHash, 0, sizeof(_nPpsHash));
+    *pSlot = h;
+    return true;
+}
+
+void CFlvNaluDedup::AddUnit(const uint8_t *p, int nLen)
+{
+    // 4字节起始码前面多余的0(trailing_zero_8bits)不属于NALU
+    while (nLen > 0 && p[nLen - 1] == 0)
+    {
+        nLen--;
+        _bChanged = true;
+    }
+    if (nLen == 0)
+        return;
+
+    if (!Keep(p, nLen))
+    {
+        _nDropped++;
+        _bChanged = true;
+        return;
+    }
+
+    Unit unit = {p, nLen};
+    _vUnits.push_back(unit);
+    _nDataSize += (_pCtx != NULL ? _pCtx->nNalUnitLength : 4) + nLen;
+}
+
+int CFlvNaluDedup::Filter(CFlvParser::CVideoTag *pTag)
+{
+    _vUnits.clear();
+    _nDataSize = 5;
+    _nDropped = 0;
+    _bChanged = false;
+
+    uint8_t *pd = pTag->_pTagData;
+    int nSize = pTag->_header.nDataSize;
+    if (pTag->_nCodecID != 7 || nSize < 5)
+        return 0;
+    if (pTag->_pCtx != _pCtx)
+        Activate(pTag->_pCtx);
+    if (pd[1] != 1)
+        return 0;
+
+    int nLengthSize = _pCtx->nNalUnitLength;
+    int nWalked = 0;
+    WalkAvccNalus(pd + 5, nSize - 5, nLengthSize, [&](const uint8_t *pNalu, int nNaluLen) {
+        nWalked += nLengthSize + nNaluLen;
+        int nType = nNaluLen > 0 ? (pNalu[0] & 0x1f) : 0;
+        if (nNaluLen == 0 || (pNalu[0] != 0 && nType != 6 && nType != 7 && nType != 8 && nType != 9))
+        {
+            // slice等不会夹带其他NALU, 原样保留
+            Unit unit = {pNalu, nNaluLen};
+            _vUnits.push_back(unit);
+            _nDataSize += nLengthSize + nNaluLen;
+            return true;
+        }
+
+        // 按起始码拆分, 第一个起始码之前的数据(例如没有起始码的SEI)也是一个NALU
+        const uint8_t *pUnit = pNalu;
+        int nPos = 0;
+        FlvStartCode sc;
+        while (nPos < nNaluLen && FindStartCode(pNalu + nPos, nNaluLen - nPos, sc))
+        {
+            AddUnit(pUnit, (int)(pNalu + nPos + sc.nPos - pUnit));
+            nPos += sc.nPos + sc.nLen;
+            pUnit = pNalu + nPos;
+            _bChanged = true;
+        }
+        AddUnit(pUnit, (int)(pNalu + nNaluLen - pUnit));
+        return true;
+    });
+
+    // 长度字段与数据不符时不改写
+    if (nWalked != nSize - 5)
+        return 0;
+    return _bChanged ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+﻿#ifndef FLVDEDUP_H
+#define FLVDEDUP_H
+
+#include <stdint.h>
+#include <vector>
+#include "FlvParser.h"
+
+/*
+输出FLV时去掉AVC NALU Tag中夹带的重复参数集和SEI:
+1. AVCC的NALU中如果用起始码(Annex-B)夹带了多个NALU, 先拆分成单独的NALU
+2. SPS/PPS按id记录当前生效的内容的hash, 初始为sequence header中的SPS/PPS.
+   与当前内容相同的SPS/PPS去掉, 不同的保留并成为新的当前内容. SPS变化时清空PPS的记录, 之后的PPS都保留
+3. user_data SEI(payloadType 4/5)按payloadType记录上一次输出的内容, 相同时去掉. 其他SEI都保留
+只检查SPS/PPS/SEI/AUD以及以0开头(起始码)的NALU, slice不扫描.
+一个输出文件对应一个实例, 遇到新的sequence header时重新开始
+ */
+class CFlvNaluDedup
+{
+public:
+    CFlvNaluDedup();
+
+    struct Unit
+    {
+        const uint8_t *p; // 不带长度字段和起始码的NALU, 指向Tag Body
+        int nLen;
+    };
+
+    // 分析一个视频Tag, 需要改写时返回1, 改写后的NALU由Units()给出; 不是AVC NALU或者不需要改写时返回0(原样写出)
+    int Filter(CFlvParser::CVideoTag *pTag);
+
+    const std::vector<Unit> &Units() { return _vUnits; }
+    int DataSize() { return _nDataSize; } // 改写后的Tag Body大小
+    int Dropped() { return _nDropped; }   // 最近一次Filter()去掉的NALU个数
+
+private:
+    void Activate(const CFlvParser::VideoContext *pCtx);
+    void AddUnit(const uint8_t *p, int nLen);
+    bool Keep(const uint8_t *p, int nLen); // 更新记录的内容, 返回是否需要输出
+
+    const CFlvParser::VideoContext *_pCtx; // 当前的sequence header
+    uint64_t _nSpsHash[32];                // 按seq_parameter_set_id, 0表示没有
+    uint64_t _nPpsHash[256];               // 按pic_parameter_set_id
+    uint64_t _nSeiHash[256];               // 按payloadType, 只使用4和5
+
+    std::vector<Unit> _vUnits;
+    int _nDataSize;
+    int _nDropped;
+    bool _bChanged; // 有NALU被拆分/去掉/去掉末尾的0
+};
+
+#endif // FLVDEDUP_H
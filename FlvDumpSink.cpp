@@ -0,0 +1,143 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include "FlvDumpSink.h"
+#include "FlvMp4.h"
+
+CFlvDumpSink::CFlvDumpSink(const char *h264Path, const char *aacPath, const char *flvPath, const char *mp4Path)
+{
+    _bFlvHeader = false;
+    _nLastTagSize = 0;
+
+    // Tag在回调返回后就会释放, 不能只记录Tag数据的指针
+    _fH264.SetAllowRef(false);
+    _fAAC.SetAllowRef(false);
+    _fFlv.SetAllowRef(false);
+
+    _bOpen = true;
+    if (h264Path != NULL && !_fH264.Open(h264Path))
+        _bOpen = false;
+    if (aacPath != NULL && !_fAAC.Open(aacPath))
+        _bOpen = false;
+    if (flvPath != NULL && !_fFlv.Open(flvPath))
+        _bOpen = false;
+    _pMp4 = (mp4Path != NULL) ? new CFlvMp4Sink(mp4Path) : NULL;
+    if (_pMp4 != NULL && !_pMp4->IsOpen())
+        _bOpen = false;
+}
+
+CFlvDumpSink::~CFlvDumpSink()
+{
+    Finish();
+    delete _pMp4;
+}
+
+int CFlvDumpSink::Finish()
+{
+    int nResult = 1;
+    if (_fFlv.IsOpen())
+    {
+        // 与DumpFlv()一样, 文件末尾还有最后一个Tag的PreviousTagSize
+        if (_bFlvHeader)
+        {
+            uint8_t szSize[4];
+            szSize[0] = (uint8_t)(_nLastTagSize >> 24);
+            szSize[1] = (uint8_t)(_nLastTagSize >> 16);
+            szSize[2] = (uint8_t)(_nLastTagSize >> 8);
+            szSize[3] = (uint8_t)(_nLastTagSize);
+            _fFlv.Write(szSize, 4);
+        }
+        if (!_fFlv.Close())
+            nResult = 0;
+    }
+    if (!_fH264.Close())
+        nResult = 0;
+    if (!_fAAC.Close())
+        nResult = 0;
+    if (_pMp4 != NULL && _pMp4->IsOpen() && !_pMp4->Finish())
+        nResult = 0;
+
+    return nResult;
+}
+
+int64_t CFlvDumpSink::BytesWritten()
+{
+    int64_t nBytes = _fH264.BytesWritten() + _fAAC.BytesWritten() + _fFlv.BytesWritten();
+    if (_pMp4 != NULL)
+        nBytes += _pMp4->BytesWritten();
+    return nBytes;
+}
+
+void CFlvDumpSink::SetWriteQueue(CFlvWriteQueue *pQueue)
+{
+    if (_fH264.IsOpen())
+        _fH264.SetQueue(pQueue);
+    if (_fAAC.IsOpen())
+        _fAAC.SetQueue(pQueue);
+    if (_fFlv.IsOpen())
+        _fFlv.SetQueue(pQueue);
+    if (_pMp4 != NULL && _pMp4->IsOpen())
+        _pMp4->SetWriteQueue(pQueue);
+}
+
+int CFlvDumpSink::Flush()
+{
+    int nResult = 1;
+    if (_fH264.IsOpen() && !_fH264.Flush())
+        nResult = 0;
+    if (_fAAC.IsOpen() && !_fAAC.Flush())
+        nResult = 0;
+    if (_fFlv.IsOpen() && !_fFlv.Flush())
+        nResult = 0;
+    if (_pMp4 != NULL && !_pMp4->Flush())
+        nResult = 0;
+    return nResult;
+}
+
+int CFlvDumpSink::OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader)
+{
+    if (_pMp4 != NULL)
+        _pMp4->OnHeader(pParser, pHeader);
+    if (!_fFlv.IsOpen())
+        return 1;
+
+    pParser->WriteFlvHeader(_fFlv);
+    _bFlvHeader = true;
+    return 1;
+}
+
+int CFlvDumpSink::OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag)
+{
+    if (_fH264.IsOpen())
+        pParser->WriteH264(_fH264, pTag);
+    if (_pMp4 != NULL)
+        _pMp4->OnVideoTag(pParser, pTag);
+
+    return OnOtherTag(pParser, pTag);
+}
+
+int CFlvDumpSink::OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag)
+{
+    if (_fAAC.IsOpen())
+        pParser->WriteAAC(_fAAC, pTag);
+    if (_pMp4 != NULL)
+        _pMp4->OnAudioTag(pParser, pTag);
+
+    return OnOtherTag(pParser, pTag);
+}
+
+int CFlvDumpSink::OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag)
+{
+    if (_pMp4 != NULL)
+        _pMp4->OnScriptTag(pParser, pTag);
+    return OnOtherTag(pParser, pTag);
+}
+
+// 所有类型的Tag都写入FLV文件, 只去掉视频Tag中重复的SPS/PPS/SEI
+int CFlvDumpSink::OnOtherTag(CFlvParser *pParser, CFlvParser::Tag *pTag)
+{
+    if (_fFlv.IsOpen() && _bFlvHeader)
+        pParser->WriteFlvTag(_fFlv, pTag, _nLastTagSize, &_dedup);
+
+    return 1;
+}
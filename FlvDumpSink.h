@@ -0,0 +1,46 @@
+﻿#ifndef FLVDUMPSINK_H
+#define FLVDUMPSINK_H
+
+#include "FlvParser.h"
+#include "FlvWriter.h"
+#include "FlvDedup.h"
+
+class CFlvMp4Sink;
+
+// 流式输出: 边解析边写出 H.264/AAC/FLV/分片MP4 文件, 与 DumpH264()/DumpAAC()/DumpFlv()/DumpFmp4() 的输出相同.
+// 路径为NULL的输出不写.
+class CFlvDumpSink : public CFlvTagSink
+{
+public:
+    CFlvDumpSink(const char *h264Path, const char *aacPath, const char *flvPath, const char *mp4Path = NULL);
+    virtual ~CFlvDumpSink();
+
+    // 所有指定了路径的输出是否都已经打开
+    bool IsOpen() { return _bOpen; }
+    // 写入最后一个PreviousTagSize并关闭文件, 析构时也会自动调用. 所有输出都写入成功返回1
+    int Finish();
+    // 所有输出文件写出的字节数
+    int64_t BytesWritten();
+    // 把已经输出的Tag写到文件中(实时输入时每次读取之后调用)
+    int Flush();
+    // 由pQueue的写线程写出文件(流水线模式), pQueue必须在sink之后释放
+    void SetWriteQueue(CFlvWriteQueue *pQueue);
+
+    virtual int OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader);
+    virtual int OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag);
+    virtual int OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag);
+    virtual int OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag);
+    virtual int OnOtherTag(CFlvParser *pParser, CFlvParser::Tag *pTag);
+
+private:
+    CFlvWriter _fH264;
+    CFlvWriter _fAAC;
+    CFlvWriter _fFlv;
+    CFlvMp4Sink *_pMp4;
+    bool _bOpen;            // 所有指定的输出都已经打开
+    bool _bFlvHeader;       // 是否已经写入FLV头
+    uint32_t _nLastTagSize; // 上一个Tag的大小
+    CFlvNaluDedup _dedup;   // FLV输出中重复的SPS/PPS/SEI
+};
+
+#endif // FLVDUMPSINK_H
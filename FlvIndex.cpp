@@ -0,0 +1,203 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "FlvIndex.h"
+
+using namespace std;
+
+/*
+索引文件格式(小端):
+    "FLVI"                  4字节
+    version                 4字节, 目前为1
+    fileSize                8字节, 对应FLV文件的大小
+    keyframeNum             4字节
+    configNum               4字节
+    entry * (keyframeNum + configNum), 每个20字节:
+        offset      8字节
+        timeStamp   4字节
+        tagSize     4字节
+        type        1字节
+        reserved    3字节
+ */
+static const uint32_t nIndexVersion = 1;
+static const int nEntrySize = 20;
+
+static void PutLE(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t GetLE(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static bool LessTime(const FlvIndexEntry &a, const FlvIndexEntry &b) { return a.nTimeStamp < b.nTimeStamp; }
+static bool LessOffset(const FlvIndexEntry &a, const FlvIndexEntry &b) { return a.nOffset < b.nOffset; }
+
+CFlvIndex::CFlvIndex()
+{
+    _bSorted = true;
+}
+
+CFlvIndex::~CFlvIndex()
+{
+}
+
+void CFlvIndex::Clear()
+{
+    _vKeyframe.clear();
+    _vConfig.clear();
+    _bSorted = true;
+}
+
+void CFlvIndex::Add(int nType, int64_t nOffset, uint32_t nTimeStamp, uint32_t nTagSize)
+{
+    FlvIndexEntry entry;
+    entry.nOffset = nOffset;
+    entry.nTimeStamp = nTimeStamp;
+    entry.nTagSize = nTagSize;
+    entry.nType = nType;
+
+    vector<FlvIndexEntry> &v = (nType == FLV_INDEX_KEYFRAME) ? _vKeyframe : _vConfig;
+    // 正常情况下按顺序追加, 已经是有序的; 时间戳回退时在查找之前重新排序
+    if (!v.empty() && (nType == FLV_INDEX_KEYFRAME ? LessTime(entry, v.back()) : LessOffset(entry, v.back())))
+        _bSorted = false;
+    v.push_back(entry);
+}
+
+void CFlvIndex::Sort()
+{
+    if (_bSorted)
+        return;
+    stable_sort(_vKeyframe.begin(), _vKeyframe.end(), LessTime);
+    stable_sort(_vConfig.begin(), _vConfig.end(), LessOffset);
+    _bSorted = true;
+}
+
+const FlvIndexEntry *CFlvIndex::FindKeyframe(uint32_t nTimeStamp)
+{
+    Sort();
+    if (_vKeyframe.empty())
+        return NULL;
+
+    FlvIndexEntry key;
+    key.nTimeStamp = nTimeStamp;
+    vector<FlvIndexEntry>::iterator it = upper_bound(_vKeyframe.begin(), _vKeyframe.end(), key, LessTime);
+    if (it == _vKeyframe.begin())
+        return &_vKeyframe[0];
+    return &*(it - 1);
+}
+
+const FlvIndexEntry *CFlvIndex::FindConfig(int nType, int64_t nOffset)
+{
+    Sort();
+
+    FlvIndexEntry key;
+    key.nOffset = nOffset;
+    vector<FlvIndexEntry>::iterator it = lower_bound(_vConfig.begin(), _vConfig.end(), key, LessOffset);
+    while (it != _vConfig.begin())
+    {
+        --it;
+        if (it->nType == nType)
+            return &*it;
+    }
+    return NULL;
+}
+
+int CFlvIndex::Save(const char *path, int64_t nFileSize)
+{
+    Sort();
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return 0;
+
+    uint8_t szHeader[24];
+    memcpy(szHeader, "FLVI", 4);
+    PutLE(szHeader + 4, nIndexVersion, 4);
+    PutLE(szHeader + 8, (uint64_t)nFileSize, 8);
+    PutLE(szHeader + 16, _vKeyframe.size(), 4);
+    PutLE(szHeader + 20, _vConfig.size(), 4);
+    fwrite(szHeader, 1, sizeof(szHeader), fp);
+
+    vector<uint8_t> vBuf((_vKeyframe.size() + _vConfig.size()) * nEntrySize, 0);
+    uint8_t *p = vBuf.empty() ? NULL : &vBuf[0];
+    for (int k = 0; k < 2; k++)
+    {
+        vector<FlvIndexEntry> &v = (k == 0) ? _vKeyframe : _vConfig;
+        for (size_t i = 0; i < v.size(); i++, p += nEntrySize)
+        {
+            PutLE(p, (uint64_t)v[i].nOffset, 8);
+            PutLE(p + 8, v[i].nTimeStamp, 4);
+            PutLE(p + 12, v[i].nTagSize, 4);
+            p[16] = (uint8_t)v[i].nType;
+        }
+    }
+
+    int nResult = 1;
+    if (!vBuf.empty() && fwrite(&vBuf[0], 1, vBuf.size(), fp) != vBuf.size())
+        nResult = 0;
+    if (fclose(fp) != 0)
+        nResult = 0;
+    return nResult;
+}
+
+int CFlvIndex::Load(const char *path, int64_t nFileSize)
+{
+    Clear();
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return 0;
+
+    uint8_t szHeader[24];
+    if (fread(szHeader, 1, sizeof(szHeader), fp) != sizeof(szHeader) || memcmp(szHeader, "FLVI", 4) != 0 ||
+        GetLE(szHeader + 4, 4) != nIndexVersion || (int64_t)GetLE(szHeader + 8, 8) != nFileSize)
+    {
+        fclose(fp);
+        return 0;
+    }
+
+    // 条目数来自文件内容, 分配之前先与索引文件的实际大小比较, 损坏或者不完整的索引直接放弃
+    uint64_t nKeyframeNum = GetLE(szHeader + 16, 4);
+    uint64_t nConfigNum = GetLE(szHeader + 20, 4);
+    long nIndexSize = -1;
+    if (fseek(fp, 0, SEEK_END) == 0)
+        nIndexSize = ftell(fp);
+    if (nIndexSize < 0 || (uint64_t)nIndexSize != (nKeyframeNum + nConfigNum) * nEntrySize + sizeof(szHeader) ||
+        fseek(fp, sizeof(szHeader), SEEK_SET) != 0)
+    {
+        fclose(fp);
+        return 0;
+    }
+
+    vector<uint8_t> vBuf((size_t)(nKeyframeNum + nConfigNum) * nEntrySize);
+    if (!vBuf.empty() && fread(&vBuf[0], 1, vBuf.size(), fp) != vBuf.size())
+    {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+
+    const uint8_t *p = vBuf.empty() ? NULL : &vBuf[0];
+    for (size_t i = 0; i < nKeyframeNum + nConfigNum; i++, p += nEntrySize)
+    {
+        int nType = p[16];
+        if ((i < nKeyframeNum) != (nType == FLV_INDEX_KEYFRAME))
+        {
+            Clear();
+            return 0;
+        }
+        Add(nType, (int64_t)GetLE(p, 8), (uint32_t)GetLE(p + 8, 4), (uint32_t)GetLE(p + 12, 4));
+    }
+
+    return 1;
+}
@@ -0,0 +1,53 @@
+﻿#ifndef FLVINDEX_H
+#define FLVINDEX_H
+
+#include <stdint.h>
+#include <vector>
+
+// 索引项类型
+enum
+{
+    FLV_INDEX_KEYFRAME = 1,   // 视频关键帧
+    FLV_INDEX_AVC_CONFIG = 2, // AVC sequence header(AVCDecoderConfigurationRecord)
+    FLV_INDEX_AAC_CONFIG = 3, // AAC sequence header(AudioSpecificConfig)
+};
+
+struct FlvIndexEntry
+{
+    int64_t nOffset;     // Tag Header在文件中的位置(不包括前面的PreviousTagSize)
+    uint32_t nTimeStamp; // 完整的时间戳(ms)
+    uint32_t nTagSize;   // 11 + Tag Body的大小
+    int nType;           // FLV_INDEX_XXX
+};
+
+// 关键帧和编解码配置的索引, 可以保存为二进制的索引文件(sidecar), 用于快速定位
+class CFlvIndex
+{
+public:
+    CFlvIndex();
+    virtual ~CFlvIndex();
+
+    void Clear();
+    void Add(int nType, int64_t nOffset, uint32_t nTimeStamp, uint32_t nTagSize);
+
+    // 时间戳不大于nTimeStamp的最后一个关键帧(二分查找), nTimeStamp在第一个关键帧之前时返回第一个关键帧, 没有关键帧返回NULL
+    const FlvIndexEntry *FindKeyframe(uint32_t nTimeStamp);
+    // 位于nOffset之前的最后一个nType类型的配置, 没有返回NULL
+    const FlvIndexEntry *FindConfig(int nType, int64_t nOffset);
+
+    // nFileSize用于在加载时校验索引文件是否对应同一个FLV文件. 成功返回1
+    int Save(const char *path, int64_t nFileSize);
+    int Load(const char *path, int64_t nFileSize);
+
+    size_t KeyframeNum() { return _vKeyframe.size(); }
+    size_t ConfigNum() { return _vConfig.size(); }
+
+private:
+    void Sort();
+
+    std::vector<FlvIndexEntry> _vKeyframe; // 按时间戳排序
+    std::vector<FlvIndexEntry> _vConfig;   // 按位置排序
+    bool _bSorted;
+};
+
+#endif // FLVINDEX_H
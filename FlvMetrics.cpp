@@ -0,0 +1,222 @@
+﻿#include <stdio.h>
+#include <string.h>
+
+#include "FlvMetrics.h"
+
+using namespace std;
+
+static const char *s_szStage[FLV_STAGE_NUM] = {"header", "video", "audio", "script", "decode", "sink", "dump"};
+static const char *s_szTag[FLV_TAG_NUM] = {"video", "audio", "script", "other"};
+
+void CFlvMetrics::Reset()
+{
+    nBytesParsed = nBytesRead = nBytesCopied = nBytesWritten = nRefills = 0;
+    nAllocs = nAllocBytes = 0;
+    memset(nTags, 0, sizeof(nTags));
+    memset(nTagBytes, 0, sizeof(nTagBytes));
+    memset(nSizeHist, 0, sizeof(nSizeHist));
+    memset(nNaluTypes, 0, sizeof(nNaluTypes));
+    nDedupNalus = nDedupBytes = 0;
+    memset(nStageNs, 0, sizeof(nStageNs));
+    memset(nStageCalls, 0, sizeof(nStageCalls));
+}
+
+void CFlvMetrics::Merge(const CFlvMetrics &other)
+{
+    nBytesParsed += other.nBytesParsed;
+    nBytesRead += other.nBytesRead;
+    nBytesCopied += other.nBytesCopied;
+    nBytesWritten += other.nBytesWritten;
+    nRefills += other.nRefills;
+    nAllocs += other.nAllocs;
+    nAllocBytes += other.nAllocBytes;
+    for (int i = 0; i < FLV_TAG_NUM; i++)
+    {
+        nTags[i] += other.nTags[i];
+        nTagBytes[i] += other.nTagBytes[i];
+    }
+    for (int i = 0; i < SIZE_BUCKETS; i++)
+        nSizeHist[i] += other.nSizeHist[i];
+    for (int i = 0; i < NALU_TYPES; i++)
+        nNaluTypes[i] += other.nNaluTypes[i];
+    nDedupNalus += other.nDedupNalus;
+    nDedupBytes += other.nDedupBytes;
+    for (int i = 0; i < FLV_STAGE_NUM; i++)
+    {
+        nStageNs[i] += other.nStageNs[i];
+        nStageCalls[i] += other.nStageCalls[i];
+    }
+}
+
+int CFlvMetrics::SizeBucket(int nTagSize)
+{
+    int nBucket = 0;
+    while (nBucket < SIZE_BUCKETS - 1 && (uint64_t)nTagSize > BucketBound(nBucket))
+        nBucket++;
+    return nBucket;
+}
+
+uint64_t CFlvMetrics::BucketBound(int nBucket)
+{
+    return nBucket < SIZE_BUCKETS - 1 ? (uint64_t)64 << nBucket : 0;
+}
+
+void CFlvMetrics::AddTag(int nTagType, int nTagSize)
+{
+    nTags[nTagType]++;
+    nTagBytes[nTagType] += nTagSize;
+    nSizeHist[SizeBucket(nTagSize)]++;
+}
+
+// ---------------------------------- 导出 -------------------------------------
+
+static void Append(string &s, const char *szFormat, long long n)
+{
+    char sz[128];
+    snprintf(sz, sizeof(sz), szFormat, n);
+    s += sz;
+}
+
+string CFlvMetrics::ToJson() const
+{
+    string s = "{";
+    Append(s, "\"bytes\":{\"parsed\":%lld", nBytesParsed);
+    Append(s, ",\"read\":%lld", nBytesRead);
+    Append(s, ",\"copied\":%lld", nBytesCopied);
+    Append(s, ",\"written\":%lld}", nBytesWritten);
+    Append(s, ",\"refills\":%lld", nRefills);
+    Append(s, ",\"allocations\":{\"count\":%lld", nAllocs);
+    Append(s, ",\"bytes\":%lld}", nAllocBytes);
+
+    s += ",\"tags\":{";
+    for (int i = 0; i < FLV_TAG_NUM; i++)
+    {
+        s += (i > 0 ? ",\"" : "\"");
+        s += s_szTag[i];
+        Append(s, "\":{\"count\":%lld", nTags[i]);
+        Append(s, ",\"bytes\":%lld}", nTagBytes[i]);
+    }
+    s += "}";
+
+    s += ",\"tag_size_histogram\":[";
+    for (int i = 0; i < SIZE_BUCKETS; i++)
+    {
+        if (i > 0)
+            s += ",";
+        if (BucketBound(i) != 0)
+            Append(s, "{\"le\":%lld", (long long)BucketBound(i));
+        else
+            s += "{\"le\":null";
+        Append(s, ",\"count\":%lld}", nSizeHist[i]);
+    }
+    s += "]";
+
+    // 只输出出现过的NALU类型
+    s += ",\"nalu_types\":{";
+    bool bFirst = true;
+    for (int i = 0; i < NALU_TYPES; i++)
+    {
+        if (nNaluTypes[i] == 0)
+            continue;
+        Append(s, bFirst ? "\"%lld\":" : ",\"%lld\":", i);
+        Append(s, "%lld", nNaluTypes[i]);
+        bFirst = false;
+    }
+    s += "}";
+    Append(s, ",\"dedup\":{\"nalus\":%lld", nDedupNalus);
+    Append(s, ",\"bytes\":%lld}", nDedupBytes);
+
+    s += ",\"stages\":{";
+    for (int i = 0; i < FLV_STAGE_NUM; i++)
+    {
+        s += (i > 0 ? ",\"" : "\"");
+        s += s_szStage[i];
+        Append(s, "\":{\"ns\":%lld", nStageNs[i]);
+        Append(s, ",\"calls\":%lld}", nStageCalls[i]);
+    }
+    s += "}}";
+    return s;
+}
+
+/*
+Prometheus文本格式, 计数器都是counter, Tag大小是histogram(桶是累计的)
+ */
+string CFlvMetrics::ToPrometheus(const char *szPrefix) const
+{
+    string s;
+    string prefix = szPrefix;
+    char sz[256];
+
+    struct
+    {
+        const char *szName;
+        const char *szHelp;
+        int64_t nValue;
+    } counters[] = {
+        {"bytes_parsed_total", "Bytes consumed by Parse()", nBytesParsed},
+        {"bytes_read_total", "Bytes read from the input", nBytesRead},
+        {"bytes_copied_total", "Bytes copied by input compaction, tag copies and media building", nBytesCopied},
+        {"bytes_written_total", "Bytes written to the output files", nBytesWritten},
+        {"refills_total", "Input reads or Feed() calls", nRefills},
+        {"allocations_total", "Tag and buffer allocations", nAllocs},
+        {"allocation_bytes_total", "Bytes allocated for tags and buffers", nAllocBytes},
+        {"dedup_nalus_total", "Repeated in-band SPS/PPS/SEI NALUs dropped from FLV output", nDedupNalus},
+        {"dedup_bytes_total", "Bytes saved by dropping repeated in-band NALUs", nDedupBytes},
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++)
+    {
+        snprintf(sz, sizeof(sz), "# HELP %s%s %s\n# TYPE %s%s counter\n%s%s %lld\n", szPrefix, counters[i].szName,
+                 counters[i].szHelp, szPrefix, counters[i].szName, szPrefix, counters[i].szName,
+                 (long long)counters[i].nValue);
+        s += sz;
+    }
+
+    s += "# HELP " + prefix + "tags_total Parsed tags by type\n# TYPE " + prefix + "tags_total counter\n";
+    for (int i = 0; i < FLV_TAG_NUM; i++)
+    {
+        snprintf(sz, sizeof(sz), "%stags_total{type=\"%s\"} %lld\n", szPrefix, s_szTag[i], (long long)nTags[i]);
+        s += sz;
+    }
+
+    s += "# HELP " + prefix + "tag_size_bytes Tag size including the 11-byte header\n# TYPE " + prefix + "tag_size_bytes histogram\n";
+    int64_t nCount = 0, nSum = 0;
+    for (int i = 0; i < SIZE_BUCKETS; i++)
+    {
+        nCount += nSizeHist[i];
+        if (BucketBound(i) != 0)
+            snprintf(sz, sizeof(sz), "%stag_size_bytes_bucket{le=\"%llu\"} %lld\n", szPrefix,
+                     (unsigned long long)BucketBound(i), (long long)nCount);
+        else
+            snprintf(sz, sizeof(sz), "%stag_size_bytes_bucket{le=\"+Inf\"} %lld\n", szPrefix, (long long)nCount);
+        s += sz;
+    }
+    for (int i = 0; i < FLV_TAG_NUM; i++)
+        nSum += nTagBytes[i];
+    snprintf(sz, sizeof(sz), "%stag_size_bytes_sum %lld\n%stag_size_bytes_count %lld\n", szPrefix, (long long)nSum,
+             szPrefix, (long long)nCount);
+    s += sz;
+
+    s += "# HELP " + prefix + "nalus_total AVC NAL units by nal_unit_type\n# TYPE " + prefix + "nalus_total counter\n";
+    for (int i = 0; i < NALU_TYPES; i++)
+    {
+        if (nNaluTypes[i] == 0)
+            continue;
+        snprintf(sz, sizeof(sz), "%snalus_total{type=\"%d\"} %lld\n", szPrefix, i, (long long)nNaluTypes[i]);
+        s += sz;
+    }
+
+    s += "# HELP " + prefix + "stage_seconds_total Time spent per parse stage\n# TYPE " + prefix + "stage_seconds_total counter\n";
+    for (int i = 0; i < FLV_STAGE_NUM; i++)
+    {
+        snprintf(sz, sizeof(sz), "%sstage_seconds_total{stage=\"%s\"} %.9f\n", szPrefix, s_szStage[i], nStageNs[i] / 1e9);
+        s += sz;
+    }
+    s += "# HELP " + prefix + "stage_calls_total Timed calls per parse stage\n# TYPE " + prefix + "stage_calls_total counter\n";
+    for (int i = 0; i < FLV_STAGE_NUM; i++)
+    {
+        snprintf(sz, sizeof(sz), "%sstage_calls_total{stage=\"%s\"} %lld\n", szPrefix, s_szStage[i], (long long)nStageCalls[i]);
+        s += sz;
+    }
+
+    return s;
+}
@@ -0,0 +1,81 @@
+﻿#ifndef FLVMETRICS_H
+#define FLVMETRICS_H
+
+#include <stdint.h>
+#include <string>
+#include <chrono>
+
+// 计时的阶段
+enum
+{
+    FLV_STAGE_HEADER = 0, // FLV头
+    FLV_STAGE_VIDEO,      // 视频Tag(第一阶段)
+    FLV_STAGE_AUDIO,      // 音频Tag(第一阶段)
+    FLV_STAGE_SCRIPT,     // Script Tag
+    FLV_STAGE_DECODE,     // 两阶段解析的第二阶段(并行处理Tag Body)
+    FLV_STAGE_SINK,       // 流式模式下sink的回调
+    FLV_STAGE_DUMP,       // DumpH264()/DumpAAC()/DumpFlv(); 流式模式下只有最后的CFlvDumpSink::Finish(), 其余写出计入SINK
+    FLV_STAGE_NUM
+};
+
+// Tag类型
+enum
+{
+    FLV_TAG_VIDEO = 0,
+    FLV_TAG_AUDIO,
+    FLV_TAG_SCRIPT,
+    FLV_TAG_OTHER,
+    FLV_TAG_NUM
+};
+
+/*
+解析器的性能计数. 通过CFlvParser::SetMetrics()启用, 为NULL时解析器只多一次指针判断.
+所有计数都是累加的, 多个解析器(例如批量模式)可以用Merge()汇总.
+ */
+class CFlvMetrics
+{
+public:
+    enum
+    {
+        SIZE_BUCKETS = 20, // Tag大小的直方图: <=64, <=128, ... <=16M(2^24), 以及更大
+        NALU_TYPES = 32
+    };
+
+    CFlvMetrics() { Reset(); }
+
+    void Reset();
+    void Merge(const CFlvMetrics &other);
+
+    void AddTag(int nTagType, int nTagSize); // nTagSize: 11 + Tag Body
+    static int SizeBucket(int nTagSize);
+    static uint64_t BucketBound(int nBucket); // 第nBucket个桶的上界, 最后一个桶返回0(无上界)
+
+    static int64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::string ToJson() const;
+    std::string ToPrometheus(const char *szPrefix = "flv_") const;
+
+    int64_t nBytesParsed;  // Parse()解析完的字节数
+    int64_t nBytesRead;    // 从输入读取的字节数
+    int64_t nBytesCopied;  // 复制的字节数: 输入缓冲区整理/扩容, Tag数据, _pMedia
+    int64_t nBytesWritten; // DumpXXX()或者流式输出(CFlvDumpSink)写出的字节数
+    int64_t nRefills;      // 读取(或Feed)次数
+
+    int64_t nAllocs;     // 申请内存的次数(Tag对象和缓冲区, 包括从内存池分配)
+    int64_t nAllocBytes; // 申请内存的字节数
+
+    int64_t nTags[FLV_TAG_NUM];
+    int64_t nTagBytes[FLV_TAG_NUM];
+    int64_t nSizeHist[SIZE_BUCKETS];
+    int64_t nNaluTypes[NALU_TYPES]; // AVC NALU(不包括sequence header中的SPS/PPS)按nal_unit_type计数
+    int64_t nDedupNalus;            // 输出FLV时去掉的重复SPS/PPS/SEI个数
+    int64_t nDedupBytes;            // 因此少写出的字节数
+
+    int64_t nStageNs[FLV_STAGE_NUM];
+    int64_t nStageCalls[FLV_STAGE_NUM];
+};
+
+#endif // FLVMETRICS_H
@@ -0,0 +1,560 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include "FlvMp4.h"
+
+using namespace std;
+
+static const int nVideoTrackID = 1;
+static const int nAudioTrackID = 2;
+
+// 样本的sample_flags
+static const uint32_t nSyncSampleFlags = 0x02000000;    // sample_depends_on = 2(不依赖其他样本)
+static const uint32_t nNonSyncSampleFlags = 0x01010000; // sample_depends_on = 1, sample_is_non_sync_sample = 1
+
+static const uint32_t s_nMatrix[9] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+
+// 在内存中拼装box, Begin()/End()成对调用, End()时回填box的大小
+class CMp4Box
+{
+public:
+    void U8(uint32_t v) { _v.push_back((uint8_t)v); }
+    void U16(uint32_t v)
+    {
+        U8(v >> 8);
+        U8(v);
+    }
+    void U24(uint32_t v)
+    {
+        U8(v >> 16);
+        U16(v);
+    }
+    void U32(uint32_t v)
+    {
+        U16(v >> 16);
+        U16(v);
+    }
+    void U64(uint64_t v)
+    {
+        U32((uint32_t)(v >> 32));
+        U32((uint32_t)v);
+    }
+    void Zero(size_t n) { _v.insert(_v.end(), n, 0); }
+    void Bytes(const void *p, size_t n) { _v.insert(_v.end(), (const uint8_t *)p, (const uint8_t *)p + n); }
+    void Matrix()
+    {
+        for (int i = 0; i < 9; i++)
+            U32(s_nMatrix[i]);
+    }
+
+    void Begin(const char *szType)
+    {
+        _vStack.push_back(_v.size());
+        U32(0);
+        Bytes(szType, 4);
+    }
+    void BeginFull(const char *szType, int nVersion, uint32_t nFlags)
+    {
+        Begin(szType);
+        U8(nVersion);
+        U24(nFlags);
+    }
+    void End()
+    {
+        size_t nPos = _vStack.back();
+        _vStack.pop_back();
+        Patch32(nPos, (uint32_t)(_v.size() - nPos));
+    }
+
+    // MPEG-4描述符: tag + 长度(固定4字节的可变长编码) + 内容
+    void BeginDesc(int nTag)
+    {
+        U8(nTag);
+        _vStack.push_back(_v.size());
+        U32(0);
+    }
+    void EndDesc()
+    {
+        size_t nPos = _vStack.back();
+        _vStack.pop_back();
+        uint32_t nLen = (uint32_t)(_v.size() - nPos - 4);
+        _v[nPos] = (uint8_t)(0x80 | ((nLen >> 21) & 0x7f));
+        _v[nPos + 1] = (uint8_t)(0x80 | ((nLen >> 14) & 0x7f));
+        _v[nPos + 2] = (uint8_t)(0x80 | ((nLen >> 7) & 0x7f));
+        _v[nPos + 3] = (uint8_t)(nLen & 0x7f);
+    }
+
+    void Patch32(size_t nPos, uint32_t v)
+    {
+        _v[nPos] = (uint8_t)(v >> 24);
+        _v[nPos + 1] = (uint8_t)(v >> 16);
+        _v[nPos + 2] = (uint8_t)(v >> 8);
+        _v[nPos + 3] = (uint8_t)v;
+    }
+
+    size_t Size() { return _v.size(); }
+    const uint8_t *Data() { return _v.empty() ? NULL : &_v[0]; }
+
+private:
+    vector<uint8_t> _v;
+    vector<size_t> _vStack;
+};
+
+CFlvMp4Sink::CFlvMp4Sink(const char *path)
+{
+    _video.nTrackID = nVideoTrackID;
+    _video.nTimeScale = 1000;
+    _audio.nTrackID = nAudioTrackID;
+    _bHeaderVideo = false;
+    _bMoov = false;
+    _bKeyframe = false;
+    _nSequence = 0;
+    _nWidth = _nHeight = 0;
+    _nChannels = 2;
+    _nFrameSamples = 1024;
+    _bSps = false;
+    _bFinished = false;
+
+    // 分片在写出之前已经完整地保存在Track中, 但写出后立即被复用, 不能只记录指针
+    _f.SetAllowRef(false);
+    if (path != NULL)
+        _f.Open(path);
+}
+
+CFlvMp4Sink::~CFlvMp4Sink()
+{
+    Finish();
+}
+
+int CFlvMp4Sink::Finish()
+{
+    if (_bFinished || !_f.IsOpen())
+        return _f.IsOpen() ? 1 : 0;
+    _bFinished = true;
+
+    int nResult = 1;
+    if (!_video.vSample.empty() || !_audio.vSample.empty())
+        nResult = WriteFragment(0, true);
+    else if (!_bMoov && (_video.bConfig || _audio.bConfig))
+        nResult = WriteMoov();
+    if (!_f.Close())
+        nResult = 0;
+    return nResult;
+}
+
+int CFlvMp4Sink::OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader)
+{
+    _bHeaderVideo = pHeader->bHaveVideo != 0;
+    return 1;
+}
+
+// SPS中没有得到分辨率时使用onMetaData中的分辨率
+int CFlvMp4Sink::OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag)
+{
+    if (pTag->m_amf2_type != 0 && !_bSps && _nWidth == 0)
+    {
+        _nWidth = (int)pTag->m_width;
+        _nHeight = (int)pTag->m_height;
+    }
+    return 1;
+}
+
+/*
+1. AVC sequence header: 保存AVCDecoderConfigurationRecord(第一个), 分辨率取自其中第一个SPS
+2. AVC NALU: 关键帧之前先写出当前分片, 然后把整个NALU部分(带长度字段)作为一个样本
+ */
+int CFlvMp4Sink::OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag)
+{
+    if (!_f.IsOpen() || pTag->_nCodecID != 7 || pTag->_header.nDataSize < 5)
+        return 1;
+
+    uint8_t *pd = pTag->_pTagData;
+    if (pd[1] == 0)
+    {
+        if (!_video.bConfig && pTag->_header.nDataSize > 5 + 6)
+        {
+            _video.vConfig.assign(pd + 5, pd + pTag->_header.nDataSize);
+            _video.bConfig = true;
+
+            // 5: AVCDecoderConfigurationRecord中numOfSequenceParameterSets的位置, 后面是2字节长度和SPS
+            const uint8_t *pRecord = &_video.vConfig[0];
+            int nRecordLen = (int)_video.vConfig.size();
+            FlvSpsInfo sps;
+            if ((pRecord[5] & 0x1f) > 0 && nRecordLen >= 8 && 8 + ((pRecord[6] << 8) | pRecord[7]) <= nRecordLen &&
+                ParseH264Sps(pRecord + 8, (pRecord[6] << 8) | pRecord[7], sps))
+            {
+                _nWidth = sps.nWidth;
+                _nHeight = sps.nHeight;
+                _bSps = true;
+            }
+        }
+        return 1;
+    }
+    if (pd[1] != 1 || !_video.bConfig || (_bMoov && !_video.bInMoov))
+        return 1;
+
+    bool bKeyframe = (pTag->_nFrameType == 1);
+    if (!_bKeyframe && !bKeyframe)
+        return 1;
+    uint32_t nDts = pTag->_header.nTotalTS;
+    if (bKeyframe && !_video.vSample.empty() && !WriteFragment(nDts, false))
+        return 1;
+    _bKeyframe = true;
+
+    // CompositionTime: SI24
+    int32_t nCts = (int32_t)((pd[2] << 16) | (pd[3] << 8) | pd[4]);
+    if (nCts & 0x800000)
+        nCts -= 0x1000000;
+
+    if (!_video.vSample.empty())
+    {
+        // 上一个样本的时长
+        Sample &last = _video.vSample.back();
+        last.nDuration = nDts > _video.nLastDts ? nDts - _video.nLastDts : 0;
+        _video.nLastDuration = last.nDuration;
+    }
+    else
+        _video.nBaseTime = nDts;
+
+    Sample sample;
+    sample.nDuration = 0;
+    sample.nSize = pTag->_header.nDataSize - 5;
+    sample.nFlags = bKeyframe ? nSyncSampleFlags : nNonSyncSampleFlags;
+    sample.nCts = nCts;
+    _video.vSample.push_back(sample);
+    _video.vData.insert(_video.vData.end(), pd + 5, pd + pTag->_header.nDataSize);
+    _video.nLastDts = nDts;
+    return 1;
+}
+
+// 有视频时音频从第一个视频关键帧开始
+bool CFlvMp4Sink::AcceptAudio()
+{
+    if (!_audio.bConfig || (_bMoov && !_audio.bInMoov))
+        return false;
+    if (_video.bConfig || _bHeaderVideo)
+        return _bKeyframe;
+    return true;
+}
+
+int CFlvMp4Sink::OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag)
+{
+    if (!_f.IsOpen() || pTag->_nSoundFormat != 10 || pTag->_header.nDataSize < 2)
+        return 1;
+
+    uint8_t *pd = pTag->_pTagData;
+    if (pd[1] == 0)
+    {
+        // 时间单位用核心编码的采样率(SBR时每帧仍然是1024个核心采样), 支持直接给出的采样率和960采样的帧
+        FlvAacConfig config;
+        if (!_audio.bConfig && pTag->_header.nDataSize >= 4 &&
+            ParseAacConfig(pd + 2, pTag->_header.nDataSize - 2, config) && config.nSampleRate > 0)
+        {
+            _audio.vConfig.assign(pd + 2, pd + pTag->_header.nDataSize);
+            _audio.nTimeScale = config.nSampleRate;
+            _nChannels = config.nChannels > 0 ? config.nChannels : 2;
+            _nFrameSamples = config.nFrameLength;
+            _audio.bConfig = true;
+        }
+        return 1;
+    }
+    if (pd[1] != 1 || !AcceptAudio())
+        return 1;
+
+    // 解码时间按帧数累加, 与Tag的时间戳相差超过100ms时(例如时间戳跳变)重新对齐
+    uint64_t nTime = (uint64_t)pTag->_header.nTotalTS * _audio.nTimeScale / 1000;
+    uint64_t nDiff = nTime > _audio.nNextTime ? nTime - _audio.nNextTime : _audio.nNextTime - nTime;
+    if (!_audio.bStarted || nDiff > _audio.nTimeScale / 10)
+        _audio.nNextTime = nTime;
+    _audio.bStarted = true;
+
+    // 只有音频时每2秒一个分片
+    if (!_video.bInMoov && !_video.bConfig && !_audio.vSample.empty() &&
+        _audio.nNextTime >= _audio.nBaseTime + 2 * (uint64_t)_audio.nTimeScale && !WriteFragment(0, false))
+        return 1;
+
+    if (_audio.vSample.empty())
+        _audio.nBaseTime = _audio.nNextTime;
+
+    Sample sample;
+    sample.nDuration = _nFrameSamples;
+    sample.nSize = pTag->_header.nDataSize - 2;
+    sample.nFlags = nSyncSampleFlags;
+    sample.nCts = 0;
+    _audio.vSample.push_back(sample);
+    _audio.vData.insert(_audio.vData.end(), pd + 2, pd + pTag->_header.nDataSize);
+    _audio.nNextTime += _nFrameSamples;
+    return 1;
+}
+
+// ftyp + moov, 只包含已经收到配置的轨道
+int CFlvMp4Sink::WriteMoov()
+{
+    _video.bInMoov = _video.bConfig;
+    _audio.bInMoov = _audio.bConfig;
+    _bMoov = true;
+
+    CMp4Box box;
+    box.Begin("ftyp");
+    box.Bytes("iso6", 4);
+    box.U32(0);
+    box.Bytes("iso6isommp41", 12); // 音视频在同一个文件中, 不符合CMAF一个文件一个轨道的要求, 不声明cmfc
+    box.End();
+
+    box.Begin("moov");
+    box.BeginFull("mvhd", 0, 0);
+    box.U32(0);       // creation_time
+    box.U32(0);       // modification_time
+    box.U32(1000);    // timescale
+    box.U32(0);       // duration, 分片MP4中为0
+    box.U32(0x00010000); // rate
+    box.U16(0x0100);  // volume
+    box.Zero(2 + 8);
+    box.Matrix();
+    box.Zero(6 * 4);
+    box.U32(nAudioTrackID + 1); // next_track_ID
+    box.End();
+
+    Track *vpTrack[2] = {&_video, &_audio};
+    for (int i = 0; i < 2; i++)
+    {
+        Track &t = *vpTrack[i];
+        if (!t.bInMoov)
+            continue;
+        bool bVideo = (&t == &_video);
+
+        box.Begin("trak");
+        box.BeginFull("tkhd", 0, 3); // track_enabled | track_in_movie
+        box.U32(0);
+        box.U32(0);
+        box.U32(t.nTrackID);
+        box.U32(0);
+        box.U32(0); // duration
+        box.Zero(8);
+        box.U16(0); // layer
+        box.U16(0); // alternate_group
+        box.U16(bVideo ? 0 : 0x0100);
+        box.U16(0);
+        box.Matrix();
+        box.U32(bVideo ? (uint32_t)_nWidth << 16 : 0);
+        box.U32(bVideo ? (uint32_t)_nHeight << 16 : 0);
+        box.End();
+
+        box.Begin("mdia");
+        box.BeginFull("mdhd", 0, 0);
+        box.U32(0);
+        box.U32(0);
+        box.U32(t.nTimeScale);
+        box.U32(0);
+        box.U16(0x55c4); // "und"
+        box.U16(0);
+        box.End();
+
+        box.BeginFull("hdlr", 0, 0);
+        box.U32(0);
+        box.Bytes(bVideo ? "vide" : "soun", 4);
+        box.Zero(12);
+        const char *szName = bVideo ? "VideoHandler" : "SoundHandler";
+        box.Bytes(szName, strlen(szName) + 1);
+        box.End();
+
+        box.Begin("minf");
+        if (bVideo)
+        {
+            box.BeginFull("vmhd", 0, 1);
+            box.Zero(8); // graphicsmode, opcolor
+        }
+        else
+        {
+            box.BeginFull("smhd", 0, 0);
+            box.Zero(4); // balance, reserved
+        }
+        box.End();
+
+        box.Begin("dinf");
+        box.BeginFull("dref", 0, 0);
+        box.U32(1);
+        box.BeginFull("url ", 0, 1); // 数据在同一个文件中
+        box.End();
+        box.End();
+        box.End();
+
+        box.Begin("stbl");
+        box.BeginFull("stsd", 0, 0);
+        box.U32(1);
+        if (bVideo)
+        {
+            box.Begin("avc1");
+            box.Zero(6);
+            box.U16(1); // data_reference_index
+            box.Zero(2 + 2 + 12);
+            box.U16(_nWidth);
+            box.U16(_nHeight);
+            box.U32(0x00480000); // 72dpi
+            box.U32(0x00480000);
+            box.U32(0);
+            box.U16(1);   // frame_count
+            box.Zero(32); // compressorname
+            box.U16(0x0018);
+            box.U16(0xffff);
+            box.Begin("avcC");
+            box.Bytes(&t.vConfig[0], t.vConfig.size());
+            box.End();
+            box.End();
+        }
+        else
+        {
+            box.Begin("mp4a");
+            box.Zero(6);
+            box.U16(1);
+            box.Zero(8);
+            box.U16(_nChannels);
+            box.U16(16); // samplesize
+            box.Zero(4);
+            box.U32(t.nTimeScale <= 0xffff ? t.nTimeScale << 16 : 0);
+
+            box.BeginFull("esds", 0, 0);
+            box.BeginDesc(0x03); // ES_Descriptor
+            box.U16(t.nTrackID);
+            box.U8(0);
+            box.BeginDesc(0x04); // DecoderConfigDescriptor
+            box.U8(0x40);        // MPEG-4 Audio
+            box.U8(0x15);        // AudioStream
+            box.U24(0);          // bufferSizeDB
+            box.U32(0);          // maxBitrate
+            box.U32(0);          // avgBitrate
+            box.BeginDesc(0x05); // DecoderSpecificInfo
+            box.Bytes(&t.vConfig[0], t.vConfig.size());
+            box.EndDesc();
+            box.EndDesc();
+            box.BeginDesc(0x06); // SLConfigDescriptor
+            box.U8(0x02);
+            box.EndDesc();
+            box.EndDesc();
+            box.End();
+            box.End();
+        }
+        box.End(); // stsd
+
+        // 样本都在分片中, 这里的表都是空的
+        const char *szEmpty[] = {"stts", "stsc", "stco"};
+        for (int k = 0; k < 3; k++)
+        {
+            box.BeginFull(szEmpty[k], 0, 0);
+            box.U32(0);
+            box.End();
+        }
+        box.BeginFull("stsz", 0, 0);
+        box.U32(0);
+        box.U32(0);
+        box.End();
+        box.End(); // stbl
+        box.End(); // minf
+        box.End(); // mdia
+        box.End(); // trak
+    }
+
+    box.Begin("mvex");
+    for (int i = 0; i < 2; i++)
+    {
+        if (!vpTrack[i]->bInMoov)
+            continue;
+        box.BeginFull("trex", 0, 0);
+        box.U32(vpTrack[i]->nTrackID);
+        box.U32(1); // default_sample_description_index
+        box.U32(0);
+        box.U32(0);
+        box.U32(0);
+        box.End();
+    }
+    box.End();
+    box.End(); // moov
+
+    return _f.Write(box.Data(), box.Size());
+}
+
+/*
+moof + mdat: mdat中先是视频数据, 再是音频数据.
+nNextVideoDts是下一个关键帧的时间戳, 用于计算当前分片最后一个视频样本的时长; bEnd时沿用上一个样本的时长
+ */
+int CFlvMp4Sink::WriteFragment(uint32_t nNextVideoDts, bool bEnd)
+{
+    if (!_bMoov && !WriteMoov())
+        return 0;
+
+    if (!_video.vSample.empty())
+    {
+        Sample &last = _video.vSample.back();
+        if (!bEnd && nNextVideoDts > _video.nLastDts)
+            last.nDuration = nNextVideoDts - _video.nLastDts;
+        else
+            last.nDuration = _video.nLastDuration;
+    }
+
+    Track *vpTrack[2] = {&_video, &_audio};
+    size_t vDataOffsetPos[2] = {0, 0};
+
+    CMp4Box box;
+    box.Begin("moof");
+    box.BeginFull("mfhd", 0, 0);
+    box.U32(++_nSequence);
+    box.End();
+    for (int i = 0; i < 2; i++)
+    {
+        Track &t = *vpTrack[i];
+        if (t.vSample.empty())
+            continue;
+
+        box.Begin("traf");
+        box.BeginFull("tfhd", 0, 0x020000); // default-base-is-moof
+        box.U32(t.nTrackID);
+        box.End();
+
+        box.BeginFull("tfdt", 1, 0);
+        box.U64(t.nBaseTime);
+        box.End();
+
+        // data-offset | sample-duration | sample-size | sample-flags | sample-composition-time-offset
+        box.BeginFull("trun", 1, 0x000001 | 0x000100 | 0x000200 | 0x000400 | 0x000800);
+        box.U32((uint32_t)t.vSample.size());
+        vDataOffsetPos[i] = box.Size();
+        box.U32(0);
+        for (size_t k = 0; k < t.vSample.size(); k++)
+        {
+            const Sample &s = t.vSample[k];
+            box.U32(s.nDuration);
+            box.U32(s.nSize);
+            box.U32(s.nFlags);
+            box.U32((uint32_t)s.nCts);
+        }
+        box.End();
+        box.End(); // traf
+    }
+    box.End(); // moof
+
+    // data_offset相对于moof的开始
+    uint32_t nOffset = (uint32_t)box.Size() + 8;
+    for (int i = 0; i < 2; i++)
+    {
+        if (vpTrack[i]->vSample.empty())
+            continue;
+        box.Patch32(vDataOffsetPos[i], nOffset);
+        nOffset += (uint32_t)vpTrack[i]->vData.size();
+    }
+
+    box.Begin("mdat");
+    size_t nMdatPos = box.Size() - 8;
+    box.End();
+    box.Patch32(nMdatPos, 8 + (uint32_t)(_video.vData.size() + _audio.vData.size()));
+
+    int nResult = _f.Write(box.Data(), box.Size());
+    for (int i = 0; i < 2; i++)
+    {
+        Track &t = *vpTrack[i];
+        if (!t.vData.empty() && !_f.Write(&t.vData[0], t.vData.size()))
+            nResult = 0;
+        t.vSample.clear();
+        t.vData.clear();
+    }
+    return nResult;
+}
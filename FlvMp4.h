@@ -0,0 +1,87 @@
+﻿#ifndef FLVMP4_H
+#define FLVMP4_H
+
+#include <stdint.h>
+#include <vector>
+#include "FlvParser.h"
+#include "FlvWriter.h"
+
+/*
+流式输出分片MP4(结构与CMAF相同, 但音视频在同一个文件中): 用AVCDecoderConfigurationRecord和AudioSpecificConfig生成moov,
+之后在每个视频关键帧之前输出一个moof+mdat分片(只有音频时约每2秒一个分片).
+H.264直接使用Tag Body中带长度字段的NALU(AVCC), AAC使用去掉2字节头的原始数据, 不转换为Annex-B/ADTS.
+
+- moov在第一个分片之前写出, 只包含此时已经收到配置的轨道, 之后出现的配置以及配置的变化会被忽略
+- 视频第一个关键帧之前的视频和音频都丢弃, 保证第一个分片从关键帧开始
+- 视频的时间单位是毫秒, 音频的时间单位是采样率, 每个AAC帧1024(或960)个采样
+- 分辨率从SPS中解析, SPS无法解析时才使用onMetaData
+ */
+class CFlvMp4Sink : public CFlvTagSink
+{
+public:
+    CFlvMp4Sink(const char *path);
+    virtual ~CFlvMp4Sink();
+
+    bool IsOpen() { return _f.IsOpen(); }
+    // 写出最后一个分片并关闭文件, 析构时也会自动调用. 成功返回1
+    int Finish();
+    // 把已经完成的分片写到文件中(实时输入时), 当前分片要等到下一个视频关键帧才完成
+    int Flush() { return _f.IsOpen() ? _f.Flush() : 1; }
+    // 由pQueue的写线程写出文件(流水线模式)
+    void SetWriteQueue(CFlvWriteQueue *pQueue) { _f.SetQueue(pQueue); }
+    int64_t BytesWritten() { return _f.BytesWritten(); }
+
+    virtual int OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader);
+    virtual int OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag);
+    virtual int OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag);
+    virtual int OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag);
+
+private:
+    struct Sample
+    {
+        uint32_t nDuration;
+        uint32_t nSize;
+        uint32_t nFlags;
+        int32_t nCts; // 显示时间与解码时间的差
+    };
+
+    struct Track
+    {
+        int nTrackID;
+        bool bConfig;                 // 是否已经收到配置
+        bool bInMoov;                 // 是否已经写入moov
+        uint32_t nTimeScale;
+        std::vector<uint8_t> vConfig; // avcC或者AudioSpecificConfig
+
+        // 当前分片
+        std::vector<Sample> vSample;
+        std::vector<uint8_t> vData;
+        uint64_t nBaseTime;           // 第一个样本的解码时间
+        uint32_t nLastDts;            // 最后一个样本的时间戳(ms), 用于计算视频样本的时长
+        uint32_t nLastDuration;
+        uint64_t nNextTime;           // 音频: 下一个样本的解码时间
+        bool bStarted;
+
+        Track() : nTrackID(0), bConfig(false), bInMoov(false), nTimeScale(1000), nBaseTime(0), nLastDts(0),
+                  nLastDuration(0), nNextTime(0), bStarted(false) {}
+    };
+
+    int WriteMoov();
+    int WriteFragment(uint32_t nNextVideoDts, bool bEnd);
+    bool AcceptAudio();
+
+    CFlvWriter _f;
+    Track _video;
+    Track _audio;
+    bool _bHeaderVideo;   // FLV头声明了视频
+    bool _bMoov;
+    bool _bKeyframe;      // 是否已经收到第一个视频关键帧
+    uint32_t _nSequence;  // moof的序号
+    int _nWidth, _nHeight;
+    bool _bSps;           // 分辨率是否来自SPS
+    int _nChannels;
+    int _nFrameSamples;   // 每个AAC帧的采样数
+    bool _bFinished;
+};
+
+#endif // FLVMP4_H
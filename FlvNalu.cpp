@@ -0,0 +1,132 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include "FlvNalu.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FLV_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// 返回第一个满足 p[k] == 0 && p[k+1] == 0 && p[k+2] == 1 的k, 没有返回-1
+typedef int (*FindStartCode3Fn)(const uint8_t *p, int nLen);
+
+static int FindStartCode3Scalar(const uint8_t *p, int nLen)
+{
+    for (int k = 0; k + 3 <= nLen; k++)
+    {
+        // 大部分位置p[k+2]都不是0或1, 先检查它可以一次跳过3个字节
+        if (p[k + 2] > 1)
+        {
+            k += 2;
+            continue;
+        }
+        if (p[k + 2] == 1 && p[k] == 0 && p[k + 1] == 0)
+            return k;
+    }
+    return -1;
+}
+
+#ifdef FLV_X86_SIMD
+// 每次比较16个位置: p[k..k+15]==0, p[k+1..k+16]==0, p[k+2..k+17]==1
+__attribute__((target("sse2"))) static int FindStartCode3SSE2(const uint8_t *p, int nLen)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    int k = 0;
+    for (; k + 18 <= nLen; k += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)(p + k + 2));
+        int nMask = _mm_movemask_epi8(_mm_cmpeq_epi8(c, one));
+        if (nMask == 0)
+            continue;
+
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + k));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + k + 1));
+        nMask &= _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)));
+        if (nMask != 0)
+            return k + __builtin_ctz(nMask);
+    }
+
+    int nTail = FindStartCode3Scalar(p + k, nLen - k);
+    return nTail < 0 ? -1 : k + nTail;
+}
+
+__attribute__((target("avx2"))) static int FindStartCode3AVX2(const uint8_t *p, int nLen)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    int k = 0;
+    for (; k + 34 <= nLen; k += 32)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(p + k + 2));
+        unsigned nMask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, one));
+        if (nMask == 0)
+            continue;
+
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + k));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + k + 1));
+        nMask &= (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, zero), _mm256_cmpeq_epi8(b, zero)));
+        if (nMask != 0)
+            return k + __builtin_ctz(nMask);
+    }
+
+    int nTail = FindStartCode3SSE2(p + k, nLen - k);
+    return nTail < 0 ? -1 : k + nTail;
+}
+#endif
+
+struct StartCodeImpl
+{
+    FindStartCode3Fn pFn;
+    const char *szName;
+};
+
+// 第一次调用时检测CPU, 局部静态变量的初始化是线程安全的
+static const StartCodeImpl &GetStartCodeImpl()
+{
+    static const StartCodeImpl impl = []() {
+        StartCodeImpl i = {FindStartCode3Scalar, "scalar"};
+#ifdef FLV_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            i.pFn = FindStartCode3AVX2;
+            i.szName = "avx2";
+        }
+        else if (__builtin_cpu_supports("sse2"))
+        {
+            i.pFn = FindStartCode3SSE2;
+            i.szName = "sse2";
+        }
+#endif
+        return i;
+    }();
+    return impl;
+}
+
+int FindStartCode(const uint8_t *p, int nLen, FlvStartCode &sc)
+{
+    int k = GetStartCodeImpl().pFn(p, nLen);
+    if (k < 0)
+        return 0;
+
+    // 前面还有一个0, 是4字节的起始码
+    if (k > 0 && p[k - 1] == 0)
+    {
+        sc.nPos = k - 1;
+        sc.nLen = 4;
+    }
+    else
+    {
+        sc.nPos = k;
+        sc.nLen = 3;
+    }
+    sc.nNalType = (k + 3 < nLen) ? (p[k + 3] & 0x1f) : -1;
+    return 1;
+}
+
+const char *StartCodeScannerName()
+{
+    return GetStartCodeImpl().szName;
+}
@@ -0,0 +1,129 @@
+﻿#ifndef FLVNALU_H
+#define FLVNALU_H
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#define FLV_BSWAP32(x) _byteswap_ulong(x)
+#define FLV_BSWAP16(x) _byteswap_ushort(x)
+#else
+#define FLV_BSWAP32(x) __builtin_bswap32(x)
+#define FLV_BSWAP16(x) __builtin_bswap16(x)
+#endif
+
+// 找到的H.264起始码
+struct FlvStartCode
+{
+    int nPos;     // 起始码的第一个字节相对于查找起点的位置
+    int nLen;     // 3: 00 00 01, 4: 00 00 00 01
+    int nNalType; // 起始码后面的NAL类型(nal_unit_type, 低5bit), 起始码后面没有数据时为-1
+};
+
+// 在[p, p + nLen)中查找第一个起始码, 找到返回1.
+// 根据CPU在运行时选择AVX2/SSE2/标量实现, 结果完全相同.
+// 查找起点之前的字节不会被检查, 所以紧挨着查找起点的 00 00 01 总是报告为3字节的起始码.
+int FindStartCode(const uint8_t *p, int nLen, FlvStartCode &sc);
+
+// 当前使用的实现: "avx2", "sse2" 或 "scalar"
+const char *StartCodeScannerName();
+
+/*
+AVCC格式(AVCDecoderConfigurationRecord之后的AVC NALU, 以及MP4样本): 每个NALU前面是N字节大端长度, N由
+lengthSizeMinusOne + 1给出(1/2/3/4). 长度字段的读取按N特化: 4和2字节是一次不对齐加载加上字节交换,
+遍历时不再对每个NALU判断N. 调用者根据配置里的N调用一次WalkAvccNalus(), 之后整个Tag都在特化的循环中处理.
+ */
+template <int N>
+inline uint32_t ReadNaluLength(const uint8_t *p);
+
+template <>
+inline uint32_t ReadNaluLength<4>(const uint8_t *p)
+{
+    uint32_t n;
+    memcpy(&n, p, 4);
+    return FLV_BSWAP32(n);
+}
+
+template <>
+inline uint32_t ReadNaluLength<3>(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+template <>
+inline uint32_t ReadNaluLength<2>(const uint8_t *p)
+{
+    uint16_t n;
+    memcpy(&n, p, 2);
+    return FLV_BSWAP16(n);
+}
+
+template <>
+inline uint32_t ReadNaluLength<1>(const uint8_t *p)
+{
+    return p[0];
+}
+
+// 不在循环中使用的地方(例如只读第一个NALU的长度)
+inline uint32_t ReadNaluLength(const uint8_t *p, int nLengthSize)
+{
+    switch (nLengthSize)
+    {
+    case 4:
+        return ReadNaluLength<4>(p);
+    case 3:
+        return ReadNaluLength<3>(p);
+    case 2:
+        return ReadNaluLength<2>(p);
+    default:
+        return ReadNaluLength<1>(p);
+    }
+}
+
+// 把nLen写成nLengthSize字节的大端长度字段
+inline void WriteNaluLength(uint8_t *p, uint32_t nLen, int nLengthSize)
+{
+    for (int i = nLengthSize - 1; i >= 0; i--, nLen >>= 8)
+        p[i] = (uint8_t)nLen;
+}
+
+// fn(const uint8_t *pNalu, int nNaluLen)返回false时停止. 长度超出数据范围时也停止, 返回已经交给fn的NALU个数
+template <int N, typename Fn>
+inline int WalkAvccNalus(const uint8_t *p, int nLen, Fn &fn)
+{
+    int nCount = 0;
+    int nOffset = 0;
+    while (nLen - nOffset >= N)
+    {
+        uint32_t nNaluLen = ReadNaluLength<N>(p + nOffset);
+        nOffset += N;
+        if (nNaluLen > (uint32_t)(nLen - nOffset))
+            break;
+
+        nCount++;
+        if (!fn(p + nOffset, (int)nNaluLen))
+            break;
+        nOffset += (int)nNaluLen;
+    }
+    return nCount;
+}
+
+// 根据长度字段的字节数选择特化的版本, 只判断一次
+template <typename Fn>
+inline int WalkAvccNalus(const uint8_t *p, int nLen, int nLengthSize, Fn fn)
+{
+    switch (nLengthSize)
+    {
+    case 4:
+        return WalkAvccNalus<4>(p, nLen, fn);
+    case 3:
+        return WalkAvccNalus<3>(p, nLen, fn);
+    case 2:
+        return WalkAvccNalus<2>(p, nLen, fn);
+    default:
+        return WalkAvccNalus<1>(p, nLen, fn);
+    }
+}
+
+#endif // FLVNALU_H
@@ -3,9 +3,15 @@
 #include <assert.h>
 
 #include <iostream>
-#include <fstream>
+#include <new>
 
 #include "FlvParser.h"
+#include "FlvNalu.h"
+#include "FlvWriter.h"
+#include "FlvThreadPool.h"
+#include "FlvAmf.h"
+#include "FlvMp4.h"
+#include "FlvDedup.h"
 
 using namespace std;
 
@@ -15,20 +21,38 @@ using namespace std;
         if ((nBufSize - nOffset) < (x)) \
         {                               \
             nUsedLen = nOffset;         \
+            _nStreamPos += nOffset;     \
+            _nNeedBytes = (x);          \
             return 0;                   \
         }                               \
     }
 
-int CFlvParser::CAudioTag::_aacProfile;
-int CFlvParser::CAudioTag::_sampleRateIndex;
-int CFlvParser::CAudioTag::_channelConfig;
-
 static const uint32_t nH264StartCode = 0x01000000;
 
+// 两阶段解析时每一批最多的Tag数和字节数, 批量越大并行度越高, 但流式模式下内存占用也越大
+static const int nMaxPendingTags = 1024;
+static const int nMaxPendingBytes = 16 * 1024 * 1024;
+
 CFlvParser::CFlvParser()
 {
     _pFlvHeader = nullptr;
     _vjj = new CVideojj();
+    _bZeroCopy = false;
+    _pArena = NULL;
+    _pSink = NULL;
+    _bStop = false;
+    _pFeedBuf = NULL;
+    _bKeepTags = false;
+    _pIndex = NULL;
+    _pPool = NULL;
+    _bParallel = false;
+    _nPendingBytes = 0;
+    _nStreamPos = 0;
+    _nNeedBytes = 0;
+    _bVerbose = true;
+    _bLazyMedia = false;
+    _pMetrics = NULL;
+    ResetContexts();
 }
 
 CFlvParser::~CFlvParser()
@@ -36,35 +60,138 @@ CFlvParser::~CFlvParser()
     for (int i = 0; i < _vpTag.size(); i++)
     {
         DestroyTag(_vpTag[i]);
-        delete _vpTag[i];
+    }
+
+    if (_pFlvHeader != NULL)
+    {
+        DestroyFlvHeader(_pFlvHeader);
+        delete _pFlvHeader;
     }
 
     if (_vjj != NULL)
     {
         delete _vjj;
     }
+
+    for (size_t i = 0; i < _vpTaskVjj.size(); i++)
+        delete _vpTaskVjj[i];
+
+    if (_pFeedBuf != NULL)
+        delete _pFeedBuf;
+
+    for (size_t i = 0; i < _vpWorkerArena.size(); i++)
+        delete _vpWorkerArena[i];
+
+    if (_pArena != NULL)
+    {
+        delete _pArena;
+    }
+
+    for (size_t i = 0; i < _vpVideoCtx.size(); i++)
+        delete _vpVideoCtx[i];
+    for (size_t i = 0; i < _vpAudioCtx.size(); i++)
+        delete _vpAudioCtx[i];
+}
+
+void CFlvParser::SetArena(bool bUseArena)
+{
+    if (bUseArena && _pArena == NULL)
+        _pArena = new CFlvArena();
+    else if (!bUseArena && _pArena != NULL && _vpTag.empty())
+    {
+        delete _pArena;
+        _pArena = NULL;
+
+        for (size_t i = 0; i < _vpWorkerArena.size(); i++)
+            delete _vpWorkerArena[i];
+        _vpWorkerArena.clear();
+    }
+}
+
+void CFlvParser::SetThreadPool(CFlvThreadPool *pPool)
+{
+    _pPool = pPool;
+    _bParallel = (pPool != NULL && pPool->Threads() > 1);
+}
+
+/*
+1. 释放所有Tag, 使用内存池时只需要调用析构函数, 内存在最后一次性作废
+2. 释放FLV头和统计信息, 下一次Parse()从FLV头开始解析
+ */
+void CFlvParser::Reset()
+{
+    for (size_t i = 0; i < _vpTag.size(); i++)
+    {
+        DestroyTag(_vpTag[i]);
+    }
+    _vpTag.clear();
+
+    if (_pArena != NULL)
+        _pArena->Reset();
+    for (size_t i = 0; i < _vpWorkerArena.size(); i++)
+        _vpWorkerArena[i]->Reset();
+
+    if (_pFlvHeader != NULL)
+    {
+        DestroyFlvHeader(_pFlvHeader);
+        delete _pFlvHeader;
+        _pFlvHeader = nullptr;
+    }
+
+    _sStat = FlvStat();
+    _nStreamPos = 0;
+    _nNeedBytes = 0;
+    if (_pFeedBuf != NULL)
+    {
+        delete _pFeedBuf;
+        _pFeedBuf = NULL;
+    }
+    ResetContexts();
+    _vjj->Clear();
+}
+
+// 释放所有编解码上下文(Tag已经释放), 各保留一个默认的上下文
+void CFlvParser::ResetContexts()
+{
+    for (size_t i = 0; i < _vpVideoCtx.size(); i++)
+        delete _vpVideoCtx[i];
+    for (size_t i = 0; i < _vpAudioCtx.size(); i++)
+        delete _vpAudioCtx[i];
+    _vpVideoCtx.assign(1, new VideoContext());
+    _vpAudioCtx.assign(1, new AudioContext());
 }
 
 /* 
 1. 解析 FLV Header
 2. 解析 FLV 的 Tag
  */
-int CFlvParser::Parse(uint8_t *pBuf, int nBufSize, int &nUsedLen)
+int CFlvParser::Parse(uint8_t *pBuf, int64_t nBufSize, int64_t &nUsedLen)
 {
-    int nOffset = 0;
+    int64_t nOffset = 0;
+    _bStop = false;
 
     // 解析 FLV Header
     if (_pFlvHeader == nullptr)
     {
         CheckBuffer(9); // FLV Header9字节
+        int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
         _pFlvHeader = CreateFlvHeader(pBuf + nOffset);
         nOffset += _pFlvHeader->nHeadSize; // 跳过FLV Header
+
+        if (_pSink != NULL)
+            _pSink->OnHeader(this, _pFlvHeader);
+        if (_pMetrics != NULL)
+        {
+            _pMetrics->nStageNs[FLV_STAGE_HEADER] += CFlvMetrics::NowNs() - nStartNs;
+            _pMetrics->nStageCalls[FLV_STAGE_HEADER]++;
+        }
     }
 
     // 解析 FLV 的 Tag
     while (1)
     {
-        CheckBuffer(15); // Previous Tag Size(4字节) + Tag header(11字节)
+        if ((nBufSize - nOffset) < 15) // Previous Tag Size(4字节) + Tag header(11字节)
+            break;
         int nPrevSize = ShowU32(pBuf + nOffset);
         nOffset += 4; // 跳过Previous Tag Size
 
@@ -74,235 +201,543 @@ int CFlvParser::Parse(uint8_t *pBuf, int nBufSize, int &nUsedLen)
             nOffset -= 4;
             break;
         }
+        if (_pIndex != NULL)
+            IndexTag(pTag, _nStreamPos + nOffset);
         nOffset += (11 + pTag->_header.nDataSize);
 
-        _vpTag.push_back(pTag);
+        StatTag(pTag);
+
+        // 两阶段解析: Tag Body在这一批结束时并行处理, 处理完之前Tag可能还引用着pBuf
+        if (_bParallel)
+        {
+            _vpPending.push_back(pTag);
+            _nPendingBytes += 11 + pTag->_header.nDataSize;
+            if ((int)_vpPending.size() >= nMaxPendingTags || _nPendingBytes >= nMaxPendingBytes)
+                DecodePending();
+            if (_bStop)
+                break;
+            continue;
+        }
+
+        FinishTag(pTag);
+        if (_bStop)
+            break;
     }
+    DecodePending();
 
+    // 剩余的数据不完整时记录还需要多少字节, Tag再大也不会超过PreviousTagSize + 11 + 0xffffff
+    _nNeedBytes = FeedNeed(pBuf + nOffset, nBufSize - nOffset);
     nUsedLen = nOffset;
-    return 0;
+    _nStreamPos += nOffset;
+    if (_pMetrics != NULL)
+        _pMetrics->nBytesParsed += nOffset;
+    return _bStop ? 1 : 0;
 }
 
-int CFlvParser::PrintInfo()
+/*
+1. 内部缓冲区中有不完整的数据时, 只复制补全下一个FLV头或Tag所需的字节, 解析之后缓冲区变空.
+   sink要求停止之后剩下的数据可能已经包含完整的Tag, 这时先直接解析, 不复制
+2. 剩余的数据直接解析, 不需要复制, 最后不完整的部分保存到内部缓冲区
+ */
+int CFlvParser::Feed(const uint8_t *pData, int64_t nLen)
 {
-    Stat();
+    int64_t nUsedLen = 0;
+    int nStop = 0;
+    if (_pMetrics != NULL)
+    {
+        _pMetrics->nBytesRead += nLen;
+        _pMetrics->nRefills++;
+    }
 
-    cout << "vnum: " << _sStat.nVideoNum << " , anum: " << _sStat.nAudioNum << " , mnum: " << _sStat.nMetaNum << endl;
-    cout << "maxTimeStamp: " << _sStat.nMaxTimeStamp << " ,nLengthSize: " << _sStat.nLengthSize << endl;
-    cout << "Vjj SEI num: " << _vjj->_vVjjSEI.size() << endl;
-    for (int i = 0; i < _vjj->_vVjjSEI.size(); i++)
-        cout << "SEI time : " << _vjj->_vVjjSEI[i].nTimeStamp << endl;
+    while (_pFeedBuf != NULL && _pFeedBuf->Size() > 0 && !nStop)
+    {
+        int64_t nNeed = FeedNeed(_pFeedBuf->Data(), _pFeedBuf->Size()) - _pFeedBuf->Size();
+        if (nNeed > 0)
+        {
+            if (nLen <= 0)
+                break;
+            int64_t nCopy = nNeed < nLen ? nNeed : nLen;
+            _pFeedBuf->Append(pData, nCopy);
+            if (_pMetrics != NULL)
+                _pMetrics->nBytesCopied += nCopy;
+            pData += nCopy;
+            nLen -= nCopy;
+            if (nCopy < nNeed)
+                return 0; // 还不完整
+        }
+
+        nStop = FeedParse(_pFeedBuf->Data(), _pFeedBuf->Size(), nUsedLen);
+        _pFeedBuf->Consume(nUsedLen);
+    }
+
+    if (nLen > 0 && !nStop)
+    {
+        nStop = FeedParse((uint8_t *)pData, nLen, nUsedLen);
+        pData += nUsedLen;
+        nLen -= nUsedLen;
+    }
+
+    if (nLen > 0)
+    {
+        if (_pFeedBuf == NULL)
+            _pFeedBuf = new CFlvInputBuffer(64 * 1024);
+        _pFeedBuf->Append(pData, nLen);
+        if (_pMetrics != NULL)
+            _pMetrics->nBytesCopied += nLen;
+    }
+    return nStop;
+}
+
+int64_t CFlvParser::FeedBuffered()
+{
+    return _pFeedBuf != NULL ? _pFeedBuf->Size() : 0;
+}
+
+// 从pBuf开始的下一个FLV头或者(PreviousTagSize + Tag)完整时的总长度, 只知道长度字段时先返回长度字段所需的字节数
+int64_t CFlvParser::FeedNeed(const uint8_t *pBuf, int64_t nLen)
+{
+    if (_pFlvHeader == nullptr)
+    {
+        if (nLen < 9)
+            return 9;
+        int64_t nHeadSize = ShowU32((uint8_t *)pBuf + 5);
+        return nHeadSize > 9 ? nHeadSize : 9;
+    }
+
+    if (nLen < 15)
+        return 15;
+    return 15 + (int64_t)ShowU24((uint8_t *)pBuf + 5);
+}
+
+// pBuf只在Feed()期间有效, Tag需要保留时(没有sink或者bKeepTags)不能零拷贝
+int CFlvParser::FeedParse(uint8_t *pBuf, int64_t nLen, int64_t &nUsedLen)
+{
+    bool bZeroCopy = _bZeroCopy;
+    if (_pSink == NULL || _bKeepTags)
+        _bZeroCopy = false;
+
+    int nStop = Parse(pBuf, nLen, nUsedLen);
+
+    _bZeroCopy = bZeroCopy;
+    return nStop;
+}
+
+// Tag处理完成: 流式模式下交给sink之后立即释放, 否则保存下来
+int CFlvParser::FinishTag(Tag *pTag)
+{
+    if (_pSink != NULL)
+    {
+        int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
+        if (DispatchTag(_pSink, pTag) == 0)
+            _bStop = true;
+        if (_pMetrics != NULL)
+        {
+            _pMetrics->nStageNs[FLV_STAGE_SINK] += CFlvMetrics::NowNs() - nStartNs;
+            _pMetrics->nStageCalls[FLV_STAGE_SINK]++;
+        }
+        if (!_bKeepTags)
+        {
+            DestroyTag(pTag);
+            RecycleArena();
+            return 1;
+        }
+    }
+
+    _vpTag.push_back(pTag);
     return 1;
 }
 
-int CFlvParser::DumpH264(const std::string &path)
+// 没有保留任何Tag时, 内存池可以整体复用, 内存占用只与最大的Tag(或者一批Tag)有关
+void CFlvParser::RecycleArena()
 {
-    fstream f;
-    f.open(path.c_str(), ios_base::out | ios_base::binary);
+    if (_pArena == NULL || !_vpTag.empty() || !_vpPending.empty())
+        return;
 
-    vector<Tag *>::iterator it_tag;
-    for (it_tag = _vpTag.begin(); it_tag != _vpTag.end(); it_tag++)
+    _pArena->Reset();
+    for (size_t i = 0; i < _vpWorkerArena.size(); i++)
+        _vpWorkerArena[i]->Reset();
+}
+
+/*
+第二阶段: 把这一批Tag按顺序分成若干个连续的任务, 由线程池并行处理Tag Body.
+每个任务的SEI单独记录, 全部完成后按任务顺序合并, 再按Tag的顺序完成回调/保存, 结果与单线程解析相同.
+ */
+void CFlvParser::DecodePending()
+{
+    int nTags = (int)_vpPending.size();
+    if (nTags == 0)
+        return;
+
+    int nThreads = _pPool->Threads();
+    if (_pArena != NULL)
     {
-        if ((*it_tag)->_header.nType != 0x09)
-            continue;
+        while ((int)_vpWorkerArena.size() < nThreads)
+            _vpWorkerArena.push_back(new CFlvArena());
+    }
+
+    int nTasks = nThreads * 4 < nTags ? nThreads * 4 : nTags;
+    while ((int)_vpTaskVjj.size() < nTasks)
+        _vpTaskVjj.push_back(new CVideojj());
+    for (int i = 0; i < nTasks; i++)
+        _vpTaskVjj[i]->CopyUuids(*_vjj);
+
+    int64_t nStartNs = 0;
+    if (_pMetrics != NULL)
+    {
+        _vWorkerMetrics.resize(nThreads);
+        nStartNs = CFlvMetrics::NowNs();
+    }
+
+    _pPool->Run(nTasks, [&](int nTask, int nThread) {
+        int nBegin = (int)((int64_t)nTags * nTask / nTasks);
+        int nEnd = (int)((int64_t)nTags * (nTask + 1) / nTasks);
+        for (int i = nBegin; i < nEnd; i++)
+            DecodeTag(_vpPending[i], _vpTaskVjj[nTask], nThread);
+    });
+
+    for (int i = 0; i < nTasks; i++)
+        _vjj->Append(*_vpTaskVjj[i]);
+
+    if (_pMetrics != NULL)
+    {
+        _pMetrics->nStageNs[FLV_STAGE_DECODE] += CFlvMetrics::NowNs() - nStartNs;
+        _pMetrics->nStageCalls[FLV_STAGE_DECODE]++;
+        for (size_t i = 0; i < _vWorkerMetrics.size(); i++)
+        {
+            _pMetrics->Merge(_vWorkerMetrics[i]);
+            _vWorkerMetrics[i].Reset();
+        }
+    }
+
+    for (int i = 0; i < nTags; i++)
+        FinishTag(_vpPending[i]);
+    _vpPending.clear();
+    _nPendingBytes = 0;
+    RecycleArena();
+}
 
-        f.write((char *)(*it_tag)->_pMedia, (*it_tag)->_nMediaLen);
+/*
+处理一个Tag的Body, 两阶段解析时由多个线程同时调用:
+只能修改该Tag本身, 内存从nWorker自己的内存池分配, SEI记录到pVjj
+ */
+int CFlvParser::DecodeTag(Tag *pTag, CVideojj *pVjj, int nWorker)
+{
+    // 第一阶段只引用了输入缓冲区, 在这里复制
+    if (!_bZeroCopy && !pTag->_bOwnData)
+    {
+        uint8_t *pData = AllocBuffer(11 + pTag->_header.nDataSize, nWorker);
+        memcpy(pData, pTag->_pTagHeader, 11 + pTag->_header.nDataSize);
+        if (_pMetrics != NULL)
+            Metrics(nWorker)->nBytesCopied += 11 + pTag->_header.nDataSize;
+        pTag->_pTagHeader = pData;
+        pTag->_pTagData = pData + 11;
+        pTag->_bOwnData = true;
+    }
+
+    if (pTag->_header.nDataSize < 2)
+        return 1;
+
+    if (pTag->_header.nType == 0x09)
+    {
+        CVideoTag *pVideoTag = (CVideoTag *)pTag;
+        if (pVideoTag->_nCodecID == 7 && pTag->_pTagData[1] == 1)
+            pVideoTag->DecodeNalu(this, pVjj, nWorker);
+    }
+    else if (pTag->_header.nType == 0x08)
+    {
+        if (!_bLazyMedia)
+            ((CAudioTag *)pTag)->BuildMedia(this, nWorker);
     }
-    f.close();
 
     return 1;
 }
 
-int CFlvParser::DumpAAC(const std::string &path)
+/*
+1. 从文件开头解析FLV头(输入只给9字节, 不会解析任何Tag)
+2. 在索引中找到目标关键帧, 以及它之前最近的AVC/AAC配置Tag, 依次单独解析这些配置Tag
+3. 返回关键帧前面的PreviousTagSize的位置
+ */
+int64_t CFlvParser::SeekTo(uint8_t *pFile, int64_t nFileSize, CFlvIndex &index, uint32_t nTimeStamp)
 {
-    fstream f;
-    f.open(path.c_str(), ios_base::out | ios_base::binary);
+    int64_t nUsedLen = 0;
+    if (_pFlvHeader == nullptr)
+    {
+        if (nFileSize < 9)
+            return -1;
+        Parse(pFile, 9, nUsedLen);
+    }
 
-    vector<Tag *>::iterator it_tag;
-    for (it_tag = _vpTag.begin(); it_tag != _vpTag.end(); it_tag++)
+    const FlvIndexEntry *pKeyframe = index.FindKeyframe(nTimeStamp);
+    if (pKeyframe == NULL || pKeyframe->nOffset < 4 || pKeyframe->nOffset + pKeyframe->nTagSize > nFileSize)
+        return -1;
+
+    const int nConfigType[2] = {FLV_INDEX_AVC_CONFIG, FLV_INDEX_AAC_CONFIG};
+    for (int i = 0; i < 2; i++)
     {
-        if ((*it_tag)->_header.nType != 0x08)
+        const FlvIndexEntry *pConfig = index.FindConfig(nConfigType[i], pKeyframe->nOffset);
+        if (pConfig == NULL || pConfig->nOffset + pConfig->nTagSize > nFileSize)
             continue;
 
-        CAudioTag *pAudioTag = (CAudioTag *)(*it_tag);
-        if (pAudioTag->_nSoundFormat != 10)
-            continue;
+        // 只给出这一个Tag(以及前面的PreviousTagSize)
+        _nStreamPos = pConfig->nOffset - 4;
+        Parse(pFile + _nStreamPos, 4 + pConfig->nTagSize, nUsedLen);
+    }
+
+    _nStreamPos = pKeyframe->nOffset - 4;
+    return _nStreamPos;
+}
+
+int CFlvParser::IndexTag(Tag *pTag, int64_t nOffset)
+{
+    uint8_t *pd = pTag->_pTagData;
+    uint32_t nTagSize = 11 + pTag->_header.nDataSize;
+    if (pTag->_header.nDataSize < 2)
+        return 0;
+
+    if (pTag->_header.nType == 0x09)
+    {
+        int nFrameType = (pd[0] & 0xf0) >> 4;
+        int nCodecID = pd[0] & 0x0f;
+        if (nCodecID == 7 && pd[1] == 0) // AVC sequence header
+            _pIndex->Add(FLV_INDEX_AVC_CONFIG, nOffset, pTag->_header.nTotalTS, nTagSize);
+        else if (nFrameType == 1 && (nCodecID != 7 || pd[1] == 1)) // 关键帧
+            _pIndex->Add(FLV_INDEX_KEYFRAME, nOffset, pTag->_header.nTotalTS, nTagSize);
+    }
+    else if (pTag->_header.nType == 0x08)
+    {
+        int nSoundFormat = (pd[0] & 0xf0) >> 4;
+        if (nSoundFormat == 10 && pd[1] == 0) // AAC sequence header
+            _pIndex->Add(FLV_INDEX_AAC_CONFIG, nOffset, pTag->_header.nTotalTS, nTagSize);
+    }
+
+    return 1;
+}
 
-        if (pAudioTag->_nMediaLen != 0)
-            f.write((char *)(*it_tag)->_pMedia, (*it_tag)->_nMediaLen);
+int CFlvParser::DispatchTag(CFlvTagSink *pSink, Tag *pTag)
+{
+    switch (pTag->_header.nType)
+    {
+    case 0x09:
+        return pSink->OnVideoTag(this, (CVideoTag *)pTag);
+    case 0x08:
+        return pSink->OnAudioTag(this, (CAudioTag *)pTag);
+    case 0x12:
+        return pSink->OnScriptTag(this, (CMetaDataTag *)pTag);
+    default:
+        return pSink->OnOtherTag(this, pTag);
     }
-    f.close();
+}
 
+int CFlvParser::PrintInfo()
+{
+    cout << "vnum: " << _sStat.nVideoNum << " , anum: " << _sStat.nAudioNum << " , mnum: " << _sStat.nMetaNum << endl;
+    cout << "maxTimeStamp: " << _sStat.nMaxTimeStamp << " ,nLengthSize: " << _sStat.nLengthSize << endl;
+    const FlvSpsInfo &sps = VideoCtx()->sps;
+    if (VideoCtx()->bSps)
+        cout << "video: " << sps.nWidth << "x" << sps.nHeight << ", profile " << sps.nProfile << ", level "
+             << sps.nLevel << ", fps " << sps.dFrameRate << (sps.bInterlaced ? ", interlaced" : "") << endl;
+    const FlvAacConfig &aac = AudioCtx()->aac;
+    if (AudioCtx()->bAac)
+        cout << "audio: AAC object type " << aac.nObjectType << ", " << aac.nSampleRate << "Hz, " << aac.nChannels
+             << " channels" << (aac.bSbr ? ", SBR" : "") << (aac.bPs ? ", PS" : "") << endl;
+    cout << "Vjj SEI num: " << _vjj->Count() << endl;
+    for (size_t i = 0; i < _vjj->Count(); i++)
+        cout << "SEI time : " << _vjj->At(i).nTimeStamp << endl;
     return 1;
 }
 
+int CFlvParser::DumpH264(const std::string &path)
+{
+    CFlvWriter f;
+    if (!f.Open(path.c_str()))
+        return 0;
+
+    int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
+    vector<Tag *>::iterator it_tag;
+    for (it_tag = _vpTag.begin(); it_tag != _vpTag.end(); it_tag++)
+        WriteH264(f, *it_tag);
+
+    int nResult = f.Close();
+    MetricsDump(f.BytesWritten(), nStartNs);
+    return nResult;
+}
+
+int CFlvParser::DumpAAC(const std::string &path)
+{
+    CFlvWriter f;
+    if (!f.Open(path.c_str()))
+        return 0;
+
+    int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
+    vector<Tag *>::iterator it_tag;
+    for (it_tag = _vpTag.begin(); it_tag != _vpTag.end(); it_tag++)
+        WriteAAC(f, *it_tag);
+
+    int nResult = f.Close();
+    MetricsDump(f.BytesWritten(), nStartNs);
+    return nResult;
+}
+
 int CFlvParser::DumpFlv(const std::string &path)
 {
-    fstream f;
-    f.open(path.c_str(), ios_base::out | ios_base::binary);
+    CFlvWriter f;
+    if (!f.Open(path.c_str()))
+        return 0;
 
+    int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
     // write flv-header
-    f.write((char *)_pFlvHeader->pFlvHeader, _pFlvHeader->nHeadSize);
+    WriteFlvHeader(f);
     uint32_t nLastTagSize = 0;
+    CFlvNaluDedup dedup;
 
     // write flv-tag
     vector<Tag *>::iterator it_tag;
     for (it_tag = _vpTag.begin(); it_tag < _vpTag.end(); it_tag++)
+        WriteFlvTag(f, *it_tag, nLastTagSize, &dedup);
+    uint32_t nn = WriteU32(nLastTagSize);
+    f.Write(&nn, 4);
+
+    int nResult = f.Close();
+    MetricsDump(f.BytesWritten(), nStartNs);
+    return nResult;
+}
+
+// 与流式输出相同, 把保存的Tag依次交给CFlvMp4Sink
+int CFlvParser::DumpFmp4(const std::string &path)
+{
+    CFlvMp4Sink sink(path.c_str());
+    if (!sink.IsOpen())
+        return 0;
+
+    int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
+    if (_pFlvHeader != NULL)
+        sink.OnHeader(this, _pFlvHeader);
+    for (size_t i = 0; i < _vpTag.size(); i++)
+        DispatchTag(&sink, _vpTag[i]);
+
+    int nResult = sink.Finish();
+    MetricsDump(sink.BytesWritten(), nStartNs);
+    return nResult;
+}
+
+int CFlvParser::WriteH264(CFlvWriter &f, Tag *pTag)
+{
+    if (pTag->_header.nType != 0x09)
+        return 0;
+
+    if (pTag->_pMedia == NULL)
+        return ((CVideoTag *)pTag)->WriteMedia(f);
+
+    f.WriteRef(pTag->_pMedia, pTag->_nMediaLen);
+    return 1;
+}
+
+int CFlvParser::WriteAAC(CFlvWriter &f, Tag *pTag)
+{
+    if (pTag->_header.nType != 0x08)
+        return 0;
+
+    CAudioTag *pAudioTag = (CAudioTag *)pTag;
+    if (pAudioTag->_nSoundFormat != 10)
+        return 0;
+
+    if (pTag->_pMedia == NULL)
+        return pAudioTag->WriteMedia(f);
+
+    if (pAudioTag->_nMediaLen != 0)
+        f.WriteRef(pTag->_pMedia, pTag->_nMediaLen);
+    return 1;
+}
+
+uint8_t *CFlvParser::GetMedia(Tag *pTag, int &nMediaLen)
+{
+    if (pTag->_pMedia == NULL)
     {
-        uint32_t nn = WriteU32(nLastTagSize);
-        f.write((char *)&nn, 4);
+        if (pTag->_header.nType == 0x09)
+            ((CVideoTag *)pTag)->BuildMedia(this);
+        else if (pTag->_header.nType == 0x08)
+            ((CAudioTag *)pTag)->BuildMedia(this);
+    }
+
+    nMediaLen = pTag->_nMediaLen;
+    return pTag->_pMedia;
+}
+
+int CFlvParser::WriteFlvHeader(CFlvWriter &f)
+{
+    if (_pFlvHeader == NULL)
+        return 0;
+
+    f.Write(_pFlvHeader->pFlvHeader, _pFlvHeader->nHeadSize);
+    return 1;
+}
+
+// nLastTagSize: 传入上一个Tag的大小, 返回本Tag的大小
+int CFlvParser::WriteFlvTag(CFlvWriter &f, Tag *pTag, uint32_t &nLastTagSize, CFlvNaluDedup *pDedup)
+{
+    uint32_t nn = WriteU32(nLastTagSize);
+    f.Write(&nn, 4);
 
-        //check duplicate start code
-        if ((*it_tag)->_header.nType == 0x09 && *((*it_tag)->_pTagData + 1) == 0x01)
+    if (pDedup != NULL && pTag->_header.nType == 0x09 && pDedup->Filter((CVideoTag *)pTag))
+    {
+        // 在局部副本上修改 Tag Header 和 NALU 长度, 不改写Tag本身(零拷贝时Tag指向的是只读的输入数据)
+        int nNalUnitLength = ((CVideoTag *)pTag)->_pCtx->nNalUnitLength;
+        int nDataSize = pDedup->DataSize();
+        uint8_t szTagHeader[11];
+        memcpy(szTagHeader, pTag->_pTagHeader, 11);
+        szTagHeader[1] = (uint8_t)(nDataSize >> 16);
+        szTagHeader[2] = (uint8_t)(nDataSize >> 8);
+        szTagHeader[3] = (uint8_t)(nDataSize);
+        f.Write(szTagHeader, 11);
+        f.WriteRef(pTag->_pTagData, 5);
+
+        const vector<CFlvNaluDedup::Unit> &vUnits = pDedup->Units();
+        for (size_t i = 0; i < vUnits.size(); i++)
         {
-            bool duplicate = false;
-            uint8_t *pStartCode = (*it_tag)->_pTagData + 5 + _nNalUnitLength;
-            //printf("tagsize=%d\n",(*it_tag)->_header.nDataSize);
-            unsigned nalu_len = 0;
-            uint8_t *p_nalu_len = (uint8_t *)&nalu_len;
-            switch (_nNalUnitLength)
-            {
-            case 4:
-                nalu_len = ShowU32((*it_tag)->_pTagData + 5);
-                break;
-            case 3:
-                nalu_len = ShowU24((*it_tag)->_pTagData + 5);
-                break;
-            case 2:
-                nalu_len = ShowU16((*it_tag)->_pTagData + 5);
-                break;
-            default:
-                nalu_len = ShowU8((*it_tag)->_pTagData + 5);
-                break;
-            }
-            /*
-            printf("nalu_len=%u\n",nalu_len);
-            printf("%x,%x,%x,%x,%x,%x,%x,%x,%x\n",(*it_tag)->_pTagData[5],(*it_tag)->_pTagData[6],
-                    (*it_tag)->_pTagData[7],(*it_tag)->_pTagData[8],(*it_tag)->_pTagData[9],
-                    (*it_tag)->_pTagData[10],(*it_tag)->_pTagData[11],(*it_tag)->_pTagData[12],
-                    (*it_tag)->_pTagData[13]);
-            */
-
-            uint8_t *pStartCodeRecord = pStartCode;
-            int i;
-            for (i = 0; i < (*it_tag)->_header.nDataSize - 5 - _nNalUnitLength - 4; ++i)
-            {
-                if (pStartCode[i] == 0x00 && pStartCode[i + 1] == 0x00 && pStartCode[i + 2] == 0x00 &&
-                    pStartCode[i + 3] == 0x01)
-                {
-                    if (pStartCode[i + 4] == 0x67)
-                    {
-                        //printf("duplicate sps found!\n");
-                        i += 4;
-                        continue;
-                    }
-                    else if (pStartCode[i + 4] == 0x68)
-                    {
-                        //printf("duplicate pps found!\n");
-                        i += 4;
-                        continue;
-                    }
-                    else if (pStartCode[i + 4] == 0x06)
-                    {
-                        //printf("duplicate sei found!\n");
-                        i += 4;
-                        continue;
-                    }
-                    else
-                    {
-                        i += 4;
-                        //printf("offset=%d\n",i);
-                        duplicate = true;
-                        break;
-                    }
-                }
-            }
-
-            if (duplicate)
-            {
-                nalu_len -= i;
-                (*it_tag)->_header.nDataSize -= i;
-                uint8_t *p = (uint8_t *)&((*it_tag)->_header.nDataSize);
-                (*it_tag)->_pTagHeader[1] = p[2];
-                (*it_tag)->_pTagHeader[2] = p[1];
-                (*it_tag)->_pTagHeader[3] = p[0];
-                //printf("after,tagsize=%d\n",(int)ShowU24((*it_tag)->_pTagHeader + 1));
-                //printf("%x,%x,%x\n",(*it_tag)->_pTagHeader[1],(*it_tag)->_pTagHeader[2],(*it_tag)->_pTagHeader[3]);
-
-                f.write((char *)(*it_tag)->_pTagHeader, 11);
-                switch (_nNalUnitLength)
-                {
-                case 4:
-                    *((*it_tag)->_pTagData + 5) = p_nalu_len[3];
-                    *((*it_tag)->_pTagData + 6) = p_nalu_len[2];
-                    *((*it_tag)->_pTagData + 7) = p_nalu_len[1];
-                    *((*it_tag)->_pTagData + 8) = p_nalu_len[0];
-                    break;
-                case 3:
-                    *((*it_tag)->_pTagData + 5) = p_nalu_len[2];
-                    *((*it_tag)->_pTagData + 6) = p_nalu_len[1];
-                    *((*it_tag)->_pTagData + 7) = p_nalu_len[0];
-                    break;
-                case 2:
-                    *((*it_tag)->_pTagData + 5) = p_nalu_len[1];
-                    *((*it_tag)->_pTagData + 6) = p_nalu_len[0];
-                    break;
-                default:
-                    *((*it_tag)->_pTagData + 5) = p_nalu_len[0];
-                    break;
-                }
-                //printf("after,nalu_len=%d\n",(int)ShowU32((*it_tag)->_pTagData + 5));
-                f.write((char *)(*it_tag)->_pTagData, pStartCode - (*it_tag)->_pTagData);
-                /*
-                printf("%x,%x,%x,%x,%x,%x,%x,%x,%x\n",(*it_tag)->_pTagData[0],(*it_tag)->_pTagData[1],(*it_tag)->_pTagData[2],
-                        (*it_tag)->_pTagData[3],(*it_tag)->_pTagData[4],(*it_tag)->_pTagData[5],(*it_tag)->_pTagData[6],
-                        (*it_tag)->_pTagData[7],(*it_tag)->_pTagData[8]);
-                */
-                f.write((char *)pStartCode + i, (*it_tag)->_header.nDataSize - (pStartCode - (*it_tag)->_pTagData));
-                /*
-                printf("write size:%d\n", (pStartCode - (*it_tag)->_pTagData) +
-                        ((*it_tag)->_header.nDataSize - (pStartCode - (*it_tag)->_pTagData)));
-                */
-            }
-            else
-            {
-                f.write((char *)(*it_tag)->_pTagHeader, 11);
-                f.write((char *)(*it_tag)->_pTagData, (*it_tag)->_header.nDataSize);
-            }
+            uint8_t szNaluLen[4];
+            WriteNaluLength(szNaluLen, vUnits[i].nLen, nNalUnitLength);
+            f.Write(szNaluLen, nNalUnitLength);
+            f.WriteRef(vUnits[i].p, vUnits[i].nLen);
         }
-        else
+
+        if (_pMetrics != NULL)
         {
-            f.write((char *)(*it_tag)->_pTagHeader, 11);
-            f.write((char *)(*it_tag)->_pTagData, (*it_tag)->_header.nDataSize);
+            _pMetrics->nDedupNalus += pDedup->Dropped();
+            _pMetrics->nDedupBytes += pTag->_header.nDataSize - nDataSize;
         }
-
-        nLastTagSize = 11 + (*it_tag)->_header.nDataSize;
+        nLastTagSize = 11 + nDataSize;
+        return 1;
     }
-    uint32_t nn = WriteU32(nLastTagSize);
-    f.write((char *)&nn, 4);
 
-    f.close();
+    if (pTag->_pTagData == pTag->_pTagHeader + 11)
+    {
+        // Tag Header和Tag Data是连续的, 一次写出
+        f.WriteRef(pTag->_pTagHeader, 11 + pTag->_header.nDataSize);
+    }
+    else
+    {
+        f.WriteRef(pTag->_pTagHeader, 11);
+        f.WriteRef(pTag->_pTagData, pTag->_header.nDataSize);
+    }
 
+    nLastTagSize = 11 + pTag->_header.nDataSize;
     return 1;
 }
 
-int CFlvParser::Stat()
+int CFlvParser::StatTag(Tag *pTag)
 {
-    for (int i = 0; i < _vpTag.size(); i++)
+    switch (pTag->_header.nType)
     {
-        switch (_vpTag[i]->_header.nType)
-        {
-        case 0x08:
-            _sStat.nAudioNum++;
-            break;
-        case 0x09:
-            StatVideo(_vpTag[i]);
-            break;
-        case 0x12:
-            _sStat.nMetaNum++;
-            break;
-        default:;
-        }
+    case 0x08:
+        _sStat.nAudioNum++;
+        break;
+    case 0x09:
+        StatVideo(pTag);
+        break;
+    case 0x12:
+        _sStat.nMetaNum++;
+        break;
+    default:;
     }
 
     return 1;
@@ -342,30 +777,42 @@ int CFlvParser::DestroyFlvHeader(FlvHeader *pHeader)
     if (pHeader == NULL)
         return 0;
 
-    delete pHeader->pFlvHeader;
+    delete[] pHeader->pFlvHeader;
     return 1;
 }
 
 // 初始化: _header, _pTagHeader, _pTagData
-void CFlvParser::Tag::Init(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen)
+// 零拷贝模式下只引用pBuf, 不申请内存也不复制数据
+void CFlvParser::Tag::Init(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen, CFlvParser *pParser)
 {
     // 解析后的 Tag Header
-    memcpy(&_header, pHeader, sizeof(TagHeader));
+    _header = *pHeader;
+
+    _bArena = (pParser->_pArena != NULL);
+    _bOwnData = !pParser->_bZeroCopy;
 
-    // Tag Header的二进制数据
-    _pTagHeader = new uint8_t[11];
-    memcpy(_pTagHeader, pBuf, 11);
+    // 零拷贝, 或者两阶段解析时推迟到DecodeTag()中复制
+    if (!_bOwnData || pParser->_bParallel)
+    {
+        _bOwnData = false;
+        _pTagHeader = pBuf;
+        _pTagData = pBuf + 11;
+        return;
+    }
 
-    // Tag Body的二进制数据
-    _pTagData = new uint8_t[_header.nDataSize];
-    memcpy(_pTagData, pBuf + 11, _header.nDataSize);
+    // Tag Header 和 Tag Body 放在同一块内存中, 只需要申请一次
+    _pTagHeader = pParser->AllocBuffer(11 + _header.nDataSize);
+    memcpy(_pTagHeader, pBuf, 11 + _header.nDataSize);
+    _pTagData = _pTagHeader + 11;
+    if (pParser->_pMetrics != NULL)
+        pParser->_pMetrics->nBytesCopied += 11 + _header.nDataSize;
 }
 
 /* 
 1. 解析 Tag Header
 2. 解析 Tag Data
  */
-CFlvParser::Tag *CFlvParser::CreateTag(uint8_t *pBuf, int nLeftLen)
+CFlvParser::Tag *CFlvParser::CreateTag(uint8_t *pBuf, int64_t nLeftLen)
 {
     // 解析 Tag Header
     TagHeader header;
@@ -381,51 +828,138 @@ CFlvParser::Tag *CFlvParser::CreateTag(uint8_t *pBuf, int nLeftLen)
     {
         return nullptr;
     }
+    int nTagLen = 11 + header.nDataSize; // Tag只需要知道自己的长度, 剩余数据可能超过2GB
 
     // 此时的 pBuf 包括Tag Header的11个字节.
+    int64_t nStartNs = _pMetrics != NULL ? CFlvMetrics::NowNs() : 0;
     Tag *pTag;
     switch (header.nType)
     {
     case 0x09: // 视频Tag
-        pTag = new CVideoTag(&header, pBuf, nLeftLen, this);
+        pTag = new (AllocTag(sizeof(CVideoTag))) CVideoTag(&header, pBuf, nTagLen, this);
         break;
     case 0x08: // 音频Tag
-        pTag = new CAudioTag(&header, pBuf, nLeftLen, this);
+        pTag = new (AllocTag(sizeof(CAudioTag))) CAudioTag(&header, pBuf, nTagLen, this);
         break;
     case 0x12: // script Tag
-        pTag = new CMetaDataTag(&header, pBuf, nLeftLen, this);
+        pTag = new (AllocTag(sizeof(CMetaDataTag))) CMetaDataTag(&header, pBuf, nTagLen, this);
         break;
     default: // script类型的Tag
-        pTag = new Tag();
-        pTag->Init(&header, pBuf, nLeftLen);
+        pTag = new (AllocTag(sizeof(Tag))) Tag();
+        pTag->Init(&header, pBuf, nTagLen, this);
     }
 
+    if (_pMetrics != NULL)
+        MetricsTag(pTag, nStartNs);
     return pTag;
 }
 
 int CFlvParser::DestroyTag(Tag *pTag)
 {
-    if (pTag->_pMedia != NULL)
-        delete[] pTag->_pMedia;
-    if (pTag->_pTagData != NULL)
-        delete[] pTag->_pTagData;
-    if (pTag->_pTagHeader != NULL)
-        delete[] pTag->_pTagHeader;
+    // 内存池中的内存在Reset()或析构时统一释放, 这里只调用析构函数
+    bool bArena = pTag->_bArena;
+    if (!bArena)
+    {
+        if (pTag->_pMedia != NULL)
+            delete[] pTag->_pMedia;
+
+        // 零拷贝的Tag只是引用了输入缓冲区, _pTagData和_pTagHeader在同一块内存中
+        if (pTag->_bOwnData && pTag->_pTagHeader != NULL)
+            delete[] pTag->_pTagHeader;
+    }
+
+    pTag->~Tag();
+    if (!bArena)
+        ::operator delete(pTag);
 
     return 1;
 }
 
+void *CFlvParser::AllocTag(size_t nSize)
+{
+    if (_pMetrics != NULL)
+    {
+        _pMetrics->nAllocs++;
+        _pMetrics->nAllocBytes += nSize;
+    }
+    if (_pArena != NULL)
+        return _pArena->Alloc(nSize);
+    return ::operator new(nSize);
+}
+
+uint8_t *CFlvParser::AllocBuffer(int nLen, int nWorker)
+{
+    if (_pMetrics != NULL)
+    {
+        CFlvMetrics *pMetrics = Metrics(nWorker);
+        pMetrics->nAllocs++;
+        pMetrics->nAllocBytes += nLen;
+    }
+    if (_pArena == NULL)
+        return new uint8_t[nLen];
+    if (nWorker >= 0)
+        return (uint8_t *)_vpWorkerArena[nWorker]->Alloc(nLen);
+    return (uint8_t *)_pArena->Alloc(nLen);
+}
+
+CFlvMetrics *CFlvParser::Metrics(int nWorker)
+{
+    if (_pMetrics == NULL)
+        return NULL;
+    if (nWorker >= 0)
+        return &_vWorkerMetrics[nWorker];
+    return _pMetrics;
+}
+
+// 第一阶段: Tag的数量/大小以及创建Tag(两阶段解析时不包括Tag Body的处理)的耗时
+void CFlvParser::MetricsTag(Tag *pTag, int64_t nStartNs)
+{
+    int nTagType, nStage;
+    switch (pTag->_header.nType)
+    {
+    case 0x09:
+        nTagType = FLV_TAG_VIDEO;
+        nStage = FLV_STAGE_VIDEO;
+        break;
+    case 0x08:
+        nTagType = FLV_TAG_AUDIO;
+        nStage = FLV_STAGE_AUDIO;
+        break;
+    case 0x12:
+        nTagType = FLV_TAG_SCRIPT;
+        nStage = FLV_STAGE_SCRIPT;
+        break;
+    default:
+        nTagType = FLV_TAG_OTHER;
+        nStage = FLV_STAGE_SCRIPT;
+    }
+
+    _pMetrics->AddTag(nTagType, 11 + pTag->_header.nDataSize);
+    _pMetrics->nStageNs[nStage] += CFlvMetrics::NowNs() - nStartNs;
+    _pMetrics->nStageCalls[nStage]++;
+}
+
+void CFlvParser::MetricsDump(int64_t nBytesWritten, int64_t nStartNs)
+{
+    if (_pMetrics == NULL)
+        return;
+    _pMetrics->nBytesWritten += nBytesWritten;
+    _pMetrics->nStageNs[FLV_STAGE_DUMP] += CFlvMetrics::NowNs() - nStartNs;
+    _pMetrics->nStageCalls[FLV_STAGE_DUMP]++;
+}
+
 // -------------------------------------------------------------------------------------
 // ---------------------------------- 视频 Tag Data -------------------------------------
 // -------------------------------------------------------------------------------------
 
 CFlvParser::CVideoTag::CVideoTag(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen, CFlvParser *pParser)
 {
-    Init(pHeader, pBuf, nLeftLen);
+    Init(pHeader, pBuf, nLeftLen, pParser);
 
     uint8_t *pd = _pTagData;
     _nFrameType = (pd[0] & 0xf0) >> 4; // 帧类型
     _nCodecID = pd[0] & 0x0f;          // 编码ID
+    _pCtx = pParser->VideoCtx();
 
     // 0x09: 视频流数据()
     // 7: AVC
@@ -484,7 +1018,7 @@ AVCDecoderConfigurationRecord {
     }
 }
 
-_nNalUnitLength 这个变量告诉我们用几个字节来存储NALU的长度, 
+nNalUnitLength 这个变量告诉我们用几个字节来存储NALU的长度, 
 如果 NALULengthSizeMinusOne 是0, 那么每个NALU使用一个字节的前缀来指定长度, 那么每个NALU包的最大长度是255字节, 这个明显太小了, 
 使用2个字节的前缀来指定长度, 那么每个NALU包的最大长度是64K字节, 也不一定够. 一般分辨率达到1280*720 的图像编码出的I帧, 可能大于64K, 
 3字节是比较完美的, 但是因为一些原因(例如对齐)没有被广泛支持, 
@@ -497,77 +1031,170 @@ int CFlvParser::CVideoTag::ParseH264Configuration(CFlvParser *pParser, uint8_t *
 
     uint8_t *pd = pTagData;
 
+    if (_header.nDataSize < 10)
+        return 0;
+
     // NalUnit长度用几个字节记录, 一般是4字节距离NalUnit的长度
-    pParser->_nNalUnitLength = (pd[9] & 0x03) + 1; // lengthSizeMinusOne 9 = 5 + 4(见上面注释)
+    int nNalUnitLength = (pd[9] & 0x03) + 1; // lengthSizeMinusOne 9 = 5 + 4(见上面注释)
+    uint8_t *pSps = NULL, *pPps = NULL;
+    int nSpsLen = 0, nPpsLen = 0;
+    ConfigNalus(pSps, nSpsLen, pPps, nPpsLen);
+
+    // 重复的sequence header继续使用当前的上下文
+    const VideoContext *pCur = pParser->VideoCtx();
+    if (pCur->nNalUnitLength != nNalUnitLength || pCur->vSps.size() != (size_t)nSpsLen ||
+        pCur->vPps.size() != (size_t)nPpsLen || (nSpsLen > 0 && memcmp(&pCur->vSps[0], pSps, nSpsLen) != 0) ||
+        (nPpsLen > 0 && memcmp(&pCur->vPps[0], pPps, nPpsLen) != 0))
+    {
+        VideoContext *pCtx = new VideoContext();
+        pCtx->nNalUnitLength = nNalUnitLength;
+        pCtx->vSps.assign(pSps, pSps + nSpsLen);
+        pCtx->vPps.assign(pPps, pPps + nPpsLen);
+        // 分辨率/帧率等从SPS中得到, 不依赖onMetaData
+        pCtx->bSps = (nSpsLen > 0 && ParseH264Sps(pSps, nSpsLen, pCtx->sps));
+        pParser->_vpVideoCtx.push_back(pCtx);
+    }
+    _pCtx = pParser->VideoCtx();
 
-    int sps_size, pps_size;
+    if (!pParser->_bLazyMedia)
+        BuildMedia(pParser);
 
-    // SPS(序列参数集)的长度
-    sps_size = CFlvParser::ShowU16(pd + 11); // sequenceParameterSetLength 11 = 5 + 6(见上面注释)
+    return 1;
+}
 
-    // PPS(图像参数集)的长度
-    pps_size = CFlvParser::ShowU16(pd + 11 + (2 + sps_size) + 1); // 2: SPS占2字节[6,7], 1: numOfPictureParameterSets 占字节
+int CFlvParser::CVideoTag::ParseNalu(CFlvParser *pParser, uint8_t *pTagData)
+{
+    // 两阶段解析时在DecodeTag()中处理
+    if (pParser->_bParallel)
+        return 1;
 
-    // 元数据
-    _nMediaLen = 4 + sps_size + 4 + pps_size; // 两个4是为了补 startcode
-    _pMedia = new uint8_t[_nMediaLen];
+    return DecodeNalu(pParser, pParser->_vjj, -1);
+}
 
-    // 保存元数据
-    memcpy(_pMedia, &nH264StartCode, 4);
-    memcpy(_pMedia + 4, pd + 11 + 2, sps_size);
-    memcpy(_pMedia + 4 + sps_size, &nH264StartCode, 4);
-    memcpy(_pMedia + 4 + sps_size + 4, pd + 11 + 2 + sps_size + 2 + 1, pps_size);
+int CFlvParser::CVideoTag::DecodeNalu(CFlvParser *pParser, CVideojj *pVjj, int nWorker)
+{
+    // 一个tag可能包含多个nalu, 所以每个nalu前面有 NalUnitLength 字节表示每个nalu的长度.
+    // 假如有2个NALU, 一个长度为300字节, 一个长度为500字节: 300(占4字节) -> data(占300字节) -> 500((占4字节) -> data(占500字节)
+    // 直接在Tag Body中查找SEI, 不需要先生成带起始码的数据
+    // 跨过5个字节, 5字节: 视频数据的参数信息(1字节) -> AVCVIDEOPACKET(4字节)[AVCPacketType(1字节) -> CompositionTime(3字节)]
+    CFlvMetrics *pMetrics = pParser->Metrics(nWorker);
+    uint32_t nTimeStamp = _header.nTotalTS;
+    WalkAvccNalus(_pTagData + 5, _header.nDataSize - 5, _pCtx->nNalUnitLength, [&](const uint8_t *pNalu, int nNaluLen) {
+        if (pMetrics != NULL && nNaluLen > 0)
+            pMetrics->nNaluTypes[pNalu[0] & 0x1f]++;
+        pVjj->Process(pNalu, nNaluLen, nTimeStamp);
+        return true;
+    });
+
+    if (!pParser->_bLazyMedia)
+        BuildMedia(pParser, nWorker);
 
     return 1;
 }
 
-int CFlvParser::CVideoTag::ParseNalu(CFlvParser *pParser, uint8_t *pTagData)
+// AVCDecoderConfigurationRecord中的第一个SPS和第一个PPS, 数据不完整时返回0
+int CFlvParser::CVideoTag::ConfigNalus(uint8_t *&pSps, int &nSpsLen, uint8_t *&pPps, int &nPpsLen)
 {
-    uint8_t *pd = pTagData;
-    int nOffset = 0;
-
-    _pMedia = new uint8_t[_header.nDataSize + 10]; // 10: ???
-    _nMediaLen = 0;
+    uint8_t *pd = _pTagData;
+    int nSize = _header.nDataSize;
+    if (nSize < 13)
+        return 0;
 
-    nOffset = 5; // 跨过5个字节, 5字节: 视频数据的参数信息(1字节) -> AVCVIDEOPACKET(4字节)[AVCPacketType(1字节) -> CompositionTime(3字节)]
+    // SPS(序列参数集)的长度
+    nSpsLen = CFlvParser::ShowU16(pd + 11); // sequenceParameterSetLength 11 = 5 + 6(见上面注释)
+    if (11 + 2 + nSpsLen + 1 + 2 > nSize)
+        return 0;
 
-    // 假如nDataSize为132, 132 - 5 = 127 = _nNalUnitLength(4字节)  + NALU(123字节)
+    // PPS(图像参数集)的长度
+    nPpsLen = CFlvParser::ShowU16(pd + 11 + (2 + nSpsLen) + 1); // 2: SPS占2字节[6,7], 1: numOfPictureParameterSets 占字节
+    if (11 + 2 + nSpsLen + 1 + 2 + nPpsLen > nSize)
+        return 0;
 
-    while (1)
-    {
-        // 如果解析完了一个Tag, 那么就跳出循环
-        if (nOffset >= _header.nDataSize)
-            break;
+    pSps = pd + 11 + 2;
+    pPps = pd + 11 + 2 + nSpsLen + 2 + 1;
+    return 1;
+}
 
-        // 一个tag可能包含多个nalu, 所以每个nalu前面有 NalUnitLength 字节表示每个nalu的长度.
-        // 假如有2个NALU, 一个长度为300字节, 一个长度为500字节: 300(占4字节) -> data(占300字节) -> 500((占4字节) -> data(占500字节)
+/*
+把AVC sequence header中的SPS/PPS, 或者AVC NALU中的所有NALU加上起始码保存到_pMedia
+ */
+int CFlvParser::CVideoTag::BuildMedia(CFlvParser *pParser, int nWorker)
+{
+    if (_pMedia != NULL || _nCodecID != 7 || _header.nDataSize < 2)
+        return 0;
 
-        int nNaluLen; // NALU的长度, 即视频数据被包装成NALU在网上传输
-        switch (pParser->_nNalUnitLength)
-        {
-        case 4: // 一般是4
-            nNaluLen = CFlvParser::ShowU32(pd + nOffset);
-            break;
-        case 3:
-            nNaluLen = CFlvParser::ShowU24(pd + nOffset);
-            break;
-        case 2:
-            nNaluLen = CFlvParser::ShowU16(pd + nOffset);
-            break;
-        default:
-            nNaluLen = CFlvParser::ShowU8(pd + nOffset);
-        }
+    int nAVCPacketType = _pTagData[1];
+    if (nAVCPacketType == 0)
+    {
+        uint8_t *pSps, *pPps;
+        int nSpsLen, nPpsLen;
+        if (!ConfigNalus(pSps, nSpsLen, pPps, nPpsLen))
+            return 0;
+
+        // 元数据
+        _nMediaLen = 4 + nSpsLen + 4 + nPpsLen; // 两个4是为了补 startcode
+        _pMedia = pParser->AllocBuffer(_nMediaLen, nWorker);
+
+        // 保存元数据
+        memcpy(_pMedia, &nH264StartCode, 4);
+        memcpy(_pMedia + 4, pSps, nSpsLen);
+        memcpy(_pMedia + 4 + nSpsLen, &nH264StartCode, 4);
+        memcpy(_pMedia + 4 + nSpsLen + 4, pPps, nPpsLen);
+    }
+    else if (nAVCPacketType == 1)
+    {
+        // 长度字段小于4字节时起始码比长度字段长, 先计算需要的长度
+        int nLen = 0;
+        WalkAvccNalus(_pTagData + 5, _header.nDataSize - 5, _pCtx->nNalUnitLength, [&](const uint8_t *pNalu, int nNaluLen) {
+            nLen += 4 + nNaluLen;
+            return true;
+        });
+
+        _pMedia = pParser->AllocBuffer(nLen > 0 ? nLen : 1, nWorker);
+        _nMediaLen = 0;
+
+        WalkAvccNalus(_pTagData + 5, _header.nDataSize - 5, _pCtx->nNalUnitLength, [&](const uint8_t *pNalu, int nNaluLen) {
+            // 获取NALU的startcode
+            memcpy(_pMedia + _nMediaLen, &nH264StartCode, 4);
+
+            // 复制NALU的数据
+            memcpy(_pMedia + _nMediaLen + 4, pNalu, nNaluLen);
+            _nMediaLen += (4 + nNaluLen); // 4: startcode
+            return true;
+        });
+    }
 
-        // 获取NALU的startcode
-        memcpy(_pMedia + _nMediaLen, &nH264StartCode, 4);
+    if (pParser->_pMetrics != NULL)
+        pParser->Metrics(nWorker)->nBytesCopied += _nMediaLen;
+    return 1;
+}
 
-        // 复制NALU的数据
-        memcpy(_pMedia + _nMediaLen + 4, pd + nOffset + pParser->_nNalUnitLength, nNaluLen);
+// 与BuildMedia()的输出相同, 但起始码和NALU直接交给CFlvWriter
+int CFlvParser::CVideoTag::WriteMedia(CFlvWriter &f)
+{
+    if (_nCodecID != 7 || _header.nDataSize < 2)
+        return 1;
 
-        // 解析NALU
-        pParser->_vjj->Process(_pMedia + _nMediaLen, 4 + nNaluLen, _header.nTotalTS);
-        _nMediaLen += (4 + nNaluLen); // 4: startcode
-        nOffset += (pParser->_nNalUnitLength + nNaluLen);
+    int nAVCPacketType = _pTagData[1];
+    if (nAVCPacketType == 0)
+    {
+        uint8_t *pSps, *pPps;
+        int nSpsLen, nPpsLen;
+        if (!ConfigNalus(pSps, nSpsLen, pPps, nPpsLen))
+            return 1;
+
+        f.Write(&nH264StartCode, 4);
+        f.WriteRef(pSps, nSpsLen);
+        f.Write(&nH264StartCode, 4);
+        f.WriteRef(pPps, nPpsLen);
+    }
+    else if (nAVCPacketType == 1)
+    {
+        WalkAvccNalus(_pTagData + 5, _header.nDataSize - 5, _pCtx->nNalUnitLength, [&](const uint8_t *pNalu, int nNaluLen) {
+            f.Write(&nH264StartCode, 4);
+            f.WriteRef(pNalu, nNaluLen);
+            return true;
+        });
     }
 
     return 1;
@@ -603,7 +1230,7 @@ extracts the channel and sample rate data is encoded in the AAC bitstream.
 
 CFlvParser::CAudioTag::CAudioTag(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen, CFlvParser *pParser)
 {
-    Init(pHeader, pBuf, nLeftLen);
+    Init(pHeader, pBuf, nLeftLen, pParser);
 
     uint8_t *pd = _pTagData;
 
@@ -612,6 +1239,7 @@ CFlvParser::CAudioTag::CAudioTag(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen
     _nSoundRate = (pd[0] & 0x0c) >> 2; // 采样率
     _nSoundSize = (pd[0] & 0x02) >> 1; // 采样精度
     _nSoundType = (pd[0] & 0x01);      // 音频声道
+    _pCtx = pParser->AudioCtx();
 
     // 10: AAC
     if (_nSoundFormat == 10)
@@ -649,16 +1277,36 @@ int CFlvParser::CAudioTag::ParseAudioSpecificConfig(CFlvParser *pParser, uint8_t
 {
     uint8_t *pd = _pTagData;
 
-    // 前2个字节在上层函数已经用了, 此处从第3个字节开始
-    // 0xf8: 1111 1000
-    _aacProfile = ((pd[2] & 0xf8) >> 3);                     // 5bit AAC编码级别
-    _sampleRateIndex = ((pd[2] & 0x07) << 1) | (pd[3] >> 7); // 4bit 真正的采样率索引
-    _channelConfig = (pd[3] >> 3) & 0x0f;                    // 4bit 通道数量
+    // 前2个字节在上层函数已经用了, 此处从第3个字节开始.
+    // SBR/PS显式信令时ADTS头使用核心编码的audioObjectType和采样率
+    uint8_t *pConfig = pd + 2;
+    int nConfigLen = _header.nDataSize - 2;
+    FlvAacConfig config;
+    if (!ParseAacConfig(pConfig, nConfigLen, config))
+        return 0;
 
-    printf("----- AAC ------\n");
-    printf("profile:%d\n", _aacProfile);
-    printf("sample rate index:%d\n", _sampleRateIndex);
-    printf("channel config:%d\n", _channelConfig);
+    // 重复的sequence header继续使用当前的上下文
+    const AudioContext *pCur = pParser->AudioCtx();
+    if (!pCur->bAac || pCur->vConfig.size() != (size_t)nConfigLen || memcmp(&pCur->vConfig[0], pConfig, nConfigLen) != 0)
+    {
+        AudioContext *pCtx = new AudioContext();
+        pCtx->vConfig.assign(pConfig, pConfig + nConfigLen);
+        pCtx->aac = config;
+        pCtx->bAac = true;
+        MakeAdtsTemplate(config.nObjectType, config.nSampleRateIndex, config.nChannelConfig, pCtx->szAdts);
+        pParser->_vpAudioCtx.push_back(pCtx);
+    }
+    _pCtx = pParser->AudioCtx();
+
+    if (pParser->_bVerbose)
+    {
+        printf("----- AAC ------\n");
+        printf("profile:%d\n", config.nObjectType);
+        printf("sample rate index:%d\n", config.nSampleRateIndex);
+        printf("channel config:%d\n", config.nChannelConfig);
+        if (config.bSbr)
+            printf("SBR: %dHz, PS: %d\n", config.nExtSampleRate, config.bPs ? 1 : 0);
+    }
 
     _pMedia = NULL;
     _nMediaLen = 0;
@@ -668,43 +1316,47 @@ int CFlvParser::CAudioTag::ParseAudioSpecificConfig(CFlvParser *pParser, uint8_t
 
 int CFlvParser::CAudioTag::ParseRawAAC(CFlvParser *pParser, uint8_t *pTagData)
 {
-    uint64_t bits = 0; // 占用8字节
-
-    int dataSize = _header.nDataSize - 2; // 减去两字节的 audio tag data 信息部分
-
-    // 制作元数据
-    WriteU64(bits, 12, 0xFFF);
-    WriteU64(bits, 1, 0);
-    WriteU64(bits, 2, 0);
-    WriteU64(bits, 1, 1);
-    WriteU64(bits, 2, _aacProfile - 1);
-    WriteU64(bits, 4, _sampleRateIndex);
-    WriteU64(bits, 1, 0);
-    WriteU64(bits, 3, _channelConfig);
-    WriteU64(bits, 1, 0);
-    WriteU64(bits, 1, 0);
-    WriteU64(bits, 1, 0);
-    WriteU64(bits, 1, 0);
-    WriteU64(bits, 13, 7 + dataSize);
-    WriteU64(bits, 11, 0x7FF);
-    WriteU64(bits, 2, 0);
-
-    // WriteU64执行为上述的操作, 最高的8bit还没有被移位到, 实际是使用7个字节
+    // 两阶段解析时在DecodeTag()中处理
+    if (!pParser->_bLazyMedia && !pParser->_bParallel)
+        BuildMedia(pParser);
+
+    return 1;
+}
+
+// 根据该Tag的AAC配置生成7字节的ADTS头: 复制模板, 只改写aac_frame_length
+void CFlvParser::CAudioTag::MakeAdtsHeader(uint8_t *pHeader)
+{
+    memcpy(pHeader, _pCtx->szAdts, 7);
+    PatchAdtsLength(pHeader, 7 + _header.nDataSize - 2); // 减去两字节的 audio tag data 信息部分
+}
+
+// AAC RAW: ADTS头 + AAC body保存到_pMedia
+int CFlvParser::CAudioTag::BuildMedia(CFlvParser *pParser, int nWorker)
+{
+    if (_pMedia != NULL || _nSoundFormat != 10 || _header.nDataSize < 2 || _pTagData[1] != 1)
+        return 0;
+
+    int dataSize = _header.nDataSize - 2;
     _nMediaLen = 7 + dataSize;
-    _pMedia = new uint8_t[_nMediaLen];
-    uint8_t p64[8];
-    p64[0] = (uint8_t)(bits >> 56); // 是bits的最高8bit，实际为0
-    p64[1] = (uint8_t)(bits >> 48); // 才是ADTS起始头 0xfff的高8bit
-    p64[2] = (uint8_t)(bits >> 40);
-    p64[3] = (uint8_t)(bits >> 32);
-    p64[4] = (uint8_t)(bits >> 24);
-    p64[5] = (uint8_t)(bits >> 16);
-    p64[6] = (uint8_t)(bits >> 8);
-    p64[7] = (uint8_t)(bits);
-
-    memcpy(_pMedia, p64 + 1, 7);                 // ADTS header, p64+1是从ADTS起始头开始
-    memcpy(_pMedia + 7, pTagData + 2, dataSize); // AAC body
+    _pMedia = pParser->AllocBuffer(_nMediaLen, nWorker);
+    MakeAdtsHeader(_pMedia);                      // ADTS header
+    memcpy(_pMedia + 7, _pTagData + 2, dataSize); // AAC body
+    if (pParser->_pMetrics != NULL)
+        pParser->Metrics(nWorker)->nBytesCopied += _nMediaLen;
+
+    return 1;
+}
+
+// 与BuildMedia()的输出相同, 但ADTS头和AAC body直接交给CFlvWriter
+int CFlvParser::CAudioTag::WriteMedia(CFlvWriter &f)
+{
+    if (_nSoundFormat != 10 || _header.nDataSize < 2 || _pTagData[1] != 1)
+        return 1;
 
+    uint8_t szAdts[7];
+    MakeAdtsHeader(szAdts);
+    f.Write(szAdts, 7);
+    f.WriteRef(_pTagData + 2, _header.nDataSize - 2);
     return 1;
 }
 
@@ -718,189 +1370,175 @@ int CFlvParser::CAudioTag::ParseRawAAC(CFlvParser *pParser, uint8_t *pTagData)
  */
 CFlvParser::CMetaDataTag::CMetaDataTag(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen, CFlvParser *pParser)
 {
-    Init(pHeader, pBuf, nLeftLen);
-
-    uint8_t *pd = _pTagData;
-    m_amf1_type = ShowU8(pd + 0);
-    m_amf1_size = ShowU16(pd + 1);
-
-    if (m_amf1_type != 2) // 一般都是0x02
+    Init(pHeader, pBuf, nLeftLen, pParser);
+
+    m_amf1_type = 0;
+    m_amf1_size = 0;
+    m_amf2_type = 0;
+    m_meta = NULL;
+    m_length = 0;
+    m_duration = m_width = m_height = m_videodatarate = m_framerate = m_videocodecid = 0;
+    m_audiodatarate = m_audiosamplerate = m_audiosamplesize = m_audiocodecid = 0;
+    m_stereo = false;
+    m_filesize = 0;
+
+    // AMF1包: 字符串"onMetaData"
+    CFlvAmfReader reader(_pTagData, _header.nDataSize);
+    FlvAmfValue name;
+    if (!reader.Read(name) || name.nType != AMF0_STRING) // 一般都是0x02
     {
-        printf("no metadata\n");
+        if (pParser->_bVerbose)
+            printf("no metadata\n");
         return;
     }
+    m_amf1_type = (uint8_t)name.nType;
+    m_amf1_size = name.nStrLen;
 
-    // +3: 跳过 m_amf1_type 和 m_amf1_size
-    if (strncmp((const char *)"onMetaData", (const char *)(pd + 3), 10) == 0)
+    if (name.StrEquals("onMetaData"))
     {
         // 解析 script
         parseMeta(pParser);
     }
 }
 
-double CFlvParser::CMetaDataTag::hexStr2double(const uint8_t *hex, const uint32_t length)
+// onMetaData中保存到CMetaDataTag的key, 每个key只对应一种类型
+struct MetaField
 {
-    double ret = 0;
-    char hexstr[length * 2];
-    memset(hexstr, 0, sizeof(hexstr));
-
-    for (uint32_t i = 0; i < length; i++)
+    const char *szKey;
+    uint32_t nKeyLen;
+    int nType; // AMF0_NUMBER/AMF0_BOOLEAN/AMF0_STRING
+    double CFlvParser::CMetaDataTag::*pNumber;
+    bool CFlvParser::CMetaDataTag::*pBool;
+    string CFlvParser::CMetaDataTag::*pString;
+};
+
+#define META_NUMBER(key, member) {key, sizeof(key) - 1, AMF0_NUMBER, &CFlvParser::CMetaDataTag::member, NULL, NULL}
+#define META_BOOL(key, member) {key, sizeof(key) - 1, AMF0_BOOLEAN, NULL, &CFlvParser::CMetaDataTag::member, NULL}
+#define META_STRING(key, member) {key, sizeof(key) - 1, AMF0_STRING, NULL, NULL, &CFlvParser::CMetaDataTag::member}
+
+static const MetaField s_metaFields[] = {
+    META_NUMBER("duration", m_duration),
+    META_NUMBER("width", m_width),
+    META_NUMBER("height", m_height),
+    META_NUMBER("videodatarate", m_videodatarate),
+    META_NUMBER("framerate", m_framerate),
+    META_NUMBER("videocodecid", m_videocodecid),
+    META_NUMBER("audiodatarate", m_audiodatarate),
+    META_NUMBER("audiosamplerate", m_audiosamplerate),
+    META_NUMBER("audiosamplesize", m_audiosamplesize),
+    META_BOOL("stereo", m_stereo),
+    META_NUMBER("audiocodecid", m_audiocodecid),
+    META_STRING("major_brand", m_major_brand),
+    META_STRING("minor_version", m_minor_version),
+    META_STRING("compatible_brands", m_compatible_brands),
+    META_STRING("encoder", m_encoder),
+    META_NUMBER("filesize", m_filesize),
+};
+
+static const MetaField *FindMetaField(const FlvAmfProperty &prop)
+{
+    for (size_t i = 0; i < sizeof(s_metaFields) / sizeof(s_metaFields[0]); i++)
     {
-        sprintf(hexstr + i * 2, "%02x", hex[i]);
+        if (prop.KeyEquals(s_metaFields[i].szKey, s_metaFields[i].nKeyLen))
+            return &s_metaFields[i];
     }
+    return NULL;
+}
+
+/*
+keyframes对象(flvmeta/yamdi等工具写入): times是关键帧的时间(秒), filepositions是关键帧Tag在文件中的位置,
+两个Strict Array按下标一一对应. 不是Number的元素记为-1, 长度不同时只保留对应的部分
+ */
+static void ReadKeyframes(const FlvAmfValue &keyframes, vector<double> &vTimes, vector<double> &vPositions)
+{
+    CFlvAmfIterator it(keyframes);
+    FlvAmfProperty prop;
+    while (it.Next(prop))
+    {
+        vector<double> *pv = NULL;
+        if (prop.KeyEquals("times", 5))
+            pv = &vTimes;
+        else if (prop.KeyEquals("filepositions", 13))
+            pv = &vPositions;
+        if (pv == NULL || prop.value.nType != AMF0_STRICT_ARRAY)
+            continue;
 
-    sscanf(hexstr, "%llx", (unsigned long long *)&ret);
+        pv->clear();
+        pv->reserve(prop.value.nCount);
+        CFlvAmfIterator itArray(prop.value);
+        FlvAmfProperty elem;
+        while (itArray.Next(elem))
+            pv->push_back(elem.value.nType == AMF0_NUMBER ? elem.value.dNumber : -1);
+    }
 
-    return ret;
+    size_t n = vTimes.size() < vPositions.size() ? vTimes.size() : vPositions.size();
+    vTimes.resize(n);
+    vPositions.resize(n);
 }
 
-// 解析 AMF2包 中的数组信息(key-value)
+// 解析 AMF2包 中的数组信息(key-value), 不认识的key和其他嵌套的对象/数组直接跳过
 int CFlvParser::CMetaDataTag::parseMeta(CFlvParser *pParser)
 {
     uint8_t *pd = _pTagData;
-    int dataSize = _header.nDataSize;
-
-    uint32_t arrayLen = 0; // 数组元素个数
-    uint32_t offset = 13;  // m_amf1_type(1字节) + m_amf1_size(2字节) + "onMetaData"(10字节) = 13
+    uint32_t dataSize = _header.nDataSize;
 
-    double doubleValue = 0;
-    string strValue = "";
-    bool boolValue = false;
-    uint32_t nameLen = 0;
-    uint32_t valueLen = 0;
-    uint8_t u8Value = 0;
+    CFlvAmfReader reader(pd, dataSize);
+    FlvAmfValue name, data;
+    reader.Read(name); // "onMetaData", 构造函数中已经检查过
+    uint32_t offset = reader.Pos();
 
     // 解析 AMF2包
-    if (pd[offset++] == 0x08) // AMF2包类型 0x8 表示数组
+    if (!reader.Read(data))
     {
-        arrayLen = ShowU32(pd + offset); // 数组元素个数
-        offset += 4;                     // 跳过 arrayLen
-        printf("ArrayLen = %d\n", arrayLen);
+        // 数组不完整(例如被截断)时, 仍然读取前面完整的属性
+        if (offset + 5 > dataSize || pd[offset] != AMF0_ECMA_ARRAY)
+        {
+            if (pParser->_bVerbose)
+                printf("metadata format error!!!");
+            return -1;
+        }
+        data.nType = AMF0_ECMA_ARRAY;
+        data.nCount = ShowU32(pd + offset + 1);
+        data.pData = pd + offset + 5;
+        data.nDataLen = dataSize - offset - 5;
     }
-    else
+    else if (data.nType != AMF0_ECMA_ARRAY && data.nType != AMF0_OBJECT) // AMF2包类型 0x8 表示数组
     {
-        printf("metadata format error!!!");
+        if (pParser->_bVerbose)
+            printf("metadata format error!!!");
         return -1;
     }
+    m_amf2_type = (uint8_t)data.nType;
+
+    if (pParser->_bVerbose && data.nType == AMF0_ECMA_ARRAY)
+        printf("ArrayLen = %d\n", data.nCount); // 数组元素个数
 
     // 解析数组信息(key-value)
-    for (uint32_t i = 0; i < arrayLen; i++)
-    {
-        doubleValue = 0;   // Number类型的value
-        boolValue = false; // Boolean类型的value
-        strValue = "";     // String类型的value
-
-        // 读取key的字符串长度
-        nameLen = ShowU16(pd + offset);
-        offset += 2;
-
-        // 读取key的字符串内容
-        char name[nameLen + 1]; // +1: '\0'
-        memset(name, 0, sizeof(name));
-        memcpy(name, &pd[offset], nameLen);
-        name[nameLen + 1] = '\0';
-        offset += nameLen;
-
-        // 解析value的类型和值
-        uint8_t amfType = pd[offset++]; // value的类型
-        switch (amfType)
+    CFlvAmfIterator it(data);
+    FlvAmfProperty prop;
+    while (it.Next(prop))
+    {
+        if (prop.KeyEquals("keyframes", 9) && prop.value.IsContainer())
         {
-        case 0x0: // Number类型的value, 占用8字节
-            doubleValue = hexStr2double(&pd[offset], 8);
-            offset += 8;
-            break;
-
-        case 0x1: // Boolean类型的value, 占用1字节
-            u8Value = ShowU8(pd + offset);
-            offset += 1;
-
-            if (u8Value != 0x00)
-                boolValue = true;
-            else
-                boolValue = false;
-            break;
-
-        case 0x2: // String类型的value
-            valueLen = ShowU16(pd + offset);
-            offset += 2;
-
-            strValue.append(pd + offset, pd + offset + valueLen);
-            strValue.append("");
-            offset += valueLen;
-            break;
-
-        default:
-            printf("un handle amfType:%d\n", amfType);
-            break;
+            ReadKeyframes(prop.value, m_keyframe_times, m_keyframe_filepositions);
+            continue;
         }
 
-        if (strncmp(name, "duration", 8) == 0)
-        {
-            m_duration = doubleValue;
-        }
-        else if (strncmp(name, "width", 5) == 0)
-        {
-            m_width = doubleValue;
-        }
-        else if (strncmp(name, "height", 6) == 0)
-        {
-            m_height = doubleValue;
-        }
-        else if (strncmp(name, "videodatarate", 13) == 0)
-        {
-            m_videodatarate = doubleValue;
-        }
-        else if (strncmp(name, "framerate", 9) == 0)
-        {
-            m_framerate = doubleValue;
-        }
-        else if (strncmp(name, "videocodecid", 12) == 0)
-        {
-            m_videocodecid = doubleValue;
-        }
-        else if (strncmp(name, "audiodatarate", 13) == 0)
-        {
-            m_audiodatarate = doubleValue;
-        }
-        else if (strncmp(name, "audiosamplerate", 15) == 0)
-        {
-            m_audiosamplerate = doubleValue;
-        }
-        else if (strncmp(name, "audiosamplesize", 15) == 0)
-        {
-            m_audiosamplesize = doubleValue;
-        }
-        else if (strncmp(name, "stereo", 6) == 0)
-        {
-            m_stereo = boolValue;
-        }
-        else if (strncmp(name, "audiocodecid", 12) == 0)
-        {
-            m_audiocodecid = doubleValue;
-        }
-        else if (strncmp(name, "major_brand", 11) == 0)
-        {
-            m_major_brand = strValue;
-        }
-        else if (strncmp(name, "minor_version", 13) == 0)
-        {
-            m_minor_version = strValue;
-        }
-        else if (strncmp(name, "compatible_brands", 17) == 0)
-        {
-            m_compatible_brands = strValue;
-        }
-        else if (strncmp(name, "encoder", 7) == 0)
-        {
-            m_encoder = strValue;
-        }
-        else if (strncmp(name, "filesize", 8) == 0)
-        {
-            m_filesize = doubleValue;
-        }
+        const MetaField *pField = FindMetaField(prop);
+        if (pField == NULL)
+            continue;
+
+        const FlvAmfValue &v = prop.value;
+        if (pField->nType == AMF0_NUMBER && v.nType == AMF0_NUMBER)
+            this->*pField->pNumber = v.dNumber;
+        else if (pField->nType == AMF0_BOOLEAN && v.nType == AMF0_BOOLEAN)
+            this->*pField->pBool = v.bBool;
+        else if (pField->nType == AMF0_STRING && (v.nType == AMF0_STRING || v.nType == AMF0_LONG_STRING))
+            (this->*pField->pString).assign((const char *)v.pStr, v.nStrLen);
     }
 
-    printMeta();
+    if (pParser->_bVerbose)
+        printMeta();
     return 1;
 }
 
@@ -5,23 +5,97 @@
 #include <iostream>
 #include <vector>
 #include "Videojj.h"
+#include "FlvArena.h"
+#include "FlvIndex.h"
+#include "FlvReader.h"
+#include "FlvMetrics.h"
+#include "FlvBits.h"
 using namespace std;
 
+class CFlvTagSink;
+class CFlvWriter;
+class CFlvThreadPool;
+class CFlvNaluDedup;
+
 class CFlvParser
 {
 public:
     CFlvParser();
     virtual ~CFlvParser();
 
-    int Parse(uint8_t *pBuf, int nBufSize, int &nUsedLen);
+    // 解析pBuf中所有完整的Tag, nUsedLen返回已经解析的字节数, 剩余的数据需要和后面的数据一起再次传入.
+    // sink的回调返回0时在该Tag之后停止并返回1(两阶段解析时这一批中已经解析的Tag仍然会回调), 否则返回0.
+    // 长度是64位的, 超过2GB的映射文件可以一次传入
+    int Parse(uint8_t *pBuf, int64_t nBufSize, int64_t &nUsedLen);
+
+    // 上一次Parse()剩余的数据要组成下一个完整的FLV头或Tag(包括前面的PreviousTagSize)至少需要的字节数.
+    // 调用者的输入缓冲区比它小时必须扩大, 否则下一个Tag永远不会完整
+    int64_t NeedBytes() { return _nNeedBytes; }
+
+    // 推送模式: 数据可以按任意长度分块传入, 不完整的Tag保存在解析器内部, 每个完整的Tag立即交给sink.
+    // pData只需要在调用期间有效. 返回值与Parse()相同, sink要求停止时剩余的数据仍然保存在内部,
+    // 下一次调用时先解析这些数据; 没有新数据时可以用Feed(NULL, 0)继续解析
+    int Feed(const uint8_t *pData, int64_t nLen);
+    // 内部保存的还没有解析的字节数
+    int64_t FeedBuffered();
+
+    // 零拷贝模式: Tag 不再复制 Tag Header/Tag Body, 只保存指向 Parse() 输入缓冲区的指针.
+    // 调用者必须保证输入缓冲区在 Tag 被释放(析构)之前一直有效且不被改写.
+    void SetZeroCopy(bool bZeroCopy) { _bZeroCopy = bZeroCopy; }
+
+    // 内存池模式: Tag对象以及Tag Header/Tag Body/_pMedia都从解析器的内存池中分配, 在Reset()或析构时一次性释放.
+    // 需要在开始解析之前设置.
+    void SetArena(bool bUseArena);
+
+    // 释放所有Tag和FLV头, 之后可以解析新的FLV流
+    void Reset();
+
+    // 解析过程中把关键帧和编解码配置的位置记录到pIndex中
+    void SetIndex(CFlvIndex *pIndex) { _pIndex = pIndex; }
+
+    // 随机访问: pFile是整个FLV文件(例如内存映射). 解析FLV头以及nTimeStamp之前最近的关键帧所需的编解码配置Tag,
+    // 返回该关键帧的PreviousTagSize在文件中的位置, 调用者从这个位置继续调用Parse(). 失败返回-1
+    int64_t SeekTo(uint8_t *pFile, int64_t nFileSize, CFlvIndex &index, uint32_t nTimeStamp);
+
+    // 下一次Parse()的输入在整个FLV流中的位置
+    int64_t StreamPos() { return _nStreamPos; }
+
+    // 是否在解析过程中打印AAC配置和metadata, 多个解析器并发运行时可以关闭
+    void SetVerbose(bool bVerbose) { _bVerbose = bVerbose; }
+
+    // 两阶段解析: 先顺序扫描Tag边界和编解码配置, 再用pPool的所有线程并行处理Tag Body(复制Tag数据, 生成_pMedia,
+    // 查找SEI), 最后按Tag的顺序统计/回调/保存. pPool为NULL或者只有一个线程时在Parse()中逐个处理.
+    // 需要在开始解析之前设置, pPool由调用者管理, 必须在解析器之后释放.
+    void SetThreadPool(CFlvThreadPool *pPool);
+
+    // 延迟生成媒体数据: 解析时不生成_pMedia(带起始码的H.264, 带ADTS头的AAC), 第一次调用GetMedia()时才生成.
+    // WriteH264()/WriteAAC()直接从Tag Body写出, 不生成_pMedia. 只输出FLV时可以省掉一次媒体数据的复制.
+    void SetLazyMedia(bool bLazyMedia) { _bLazyMedia = bLazyMedia; }
+
+    // 性能计数: 字节数/内存申请/Tag和NALU的数量/各阶段的耗时累加到pMetrics, 为NULL(默认)时不统计.
+    // pMetrics由调用者管理, Reset()不会清零, 多个解析器不能同时使用同一个pMetrics
+    void SetMetrics(CFlvMetrics *pMetrics) { _pMetrics = pMetrics; }
+
+    // 解析过程中提取的SEI(user_data_unregistered), 默认只注册了Videojj的UUID.
+    // 其他UUID需要在开始解析之前用Sei()->RegisterUuid()注册, Reset()清除消息但保留注册
+    CFlvSeiEngine *Sei() { return _vjj; }
 
     int PrintInfo();
 
     int DumpH264(const std::string &path);
     int DumpAAC(const std::string &path);
     int DumpFlv(const std::string &path);
+    int DumpFmp4(const std::string &path); // 分片MP4, 见CFlvMp4Sink(FlvMp4.h)
 
-private:
+    // 流式模式: 每个Tag解析完成后立即交给pSink, 回调返回后释放该Tag, 内存占用只与最大的Tag有关.
+    // bKeepTags为true时Tag仍然保留在解析器中, 之后还可以调用DumpXXX().
+    void SetSink(CFlvTagSink *pSink, bool bKeepTags = false)
+    {
+        _pSink = pSink;
+        _bKeepTags = bKeepTags;
+    }
+
+public:
     // FLV头
     typedef struct FlvHeader_s
     {
@@ -48,16 +122,45 @@ private:
         ~TagHeader() {}
     };
 
+    /*
+    编解码上下文: 每个流(视频/音频)各自保存当前的配置, 每个sequence header生成一个新的上下文,
+    内容与当前上下文相同时继续使用当前上下文. 之后的Tag只保存指向上下文的指针.
+    上下文创建之后不再修改, 由解析器保存到Reset()/析构, 所以工作线程和延迟生成_pMedia时都可以直接读取,
+    多个解析器之间也没有任何共享的状态
+     */
+    struct VideoContext
+    {
+        int nNalUnitLength;         // NALU长度字段的字节数
+        vector<uint8_t> vSps, vPps; // AVCDecoderConfigurationRecord中第一个SPS/PPS(带NAL头)
+        FlvSpsInfo sps;             // vSps解析出的信息
+        bool bSps;                  // SPS是否解析成功
+
+        VideoContext() : nNalUnitLength(4), bSps(false) {}
+    };
+
+    struct AudioContext
+    {
+        vector<uint8_t> vConfig; // AudioSpecificConfig的原始数据
+        FlvAacConfig aac;        // 解析出的配置, SBR/PS显式信令时nObjectType为核心编码的类型
+        bool bAac;               // 是否解析成功
+        uint8_t szAdts[7];       // 该配置的ADTS头模板, 每帧只改写长度
+
+        AudioContext() : bAac(false) { MakeAdtsTemplate(0, 0, 0, szAdts); }
+    };
+
     class Tag
     {
     public:
-        Tag() : _pTagHeader(NULL), _pTagData(NULL), _pMedia(NULL), _nMediaLen(0) {}
-        void Init(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen);
+        Tag() : _pTagHeader(NULL), _pTagData(NULL), _bOwnData(false), _bArena(false), _pMedia(NULL), _nMediaLen(0) {}
+        virtual ~Tag() {}
+        void Init(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen, CFlvParser *pParser);
 
-        // 在Init()中初始化下面3个成员变量
+        // 在Init()中初始化下面5个成员变量
         TagHeader _header;
         uint8_t *_pTagHeader; // Tag Headler 的二进制数据
         uint8_t *_pTagData;   // Tag Body 的二进制数据
+        bool _bOwnData;       // _pTagHeader/_pTagData 是否是自己申请的内存, false表示指向输入缓冲区(零拷贝)
+        bool _bArena;         // Tag对象及其内存是否来自解析器的内存池
 
         uint8_t *_pMedia; // 指向标签的元数据, 解析后的数据
         int _nMediaLen;   // 元数据的长度
@@ -79,9 +182,19 @@ private:
         int _nFrameType; // 帧类型
         int _nCodecID;   // 视频编解码ID(7:AVC)
 
+        const VideoContext *_pCtx; // 解析该Tag时的视频配置
+
         int ParseH264Tag(CFlvParser *pParser);
         int ParseH264Configuration(CFlvParser *pParser, uint8_t *pTagData);
         int ParseNalu(CFlvParser *pParser, uint8_t *pTagData);
+
+        int BuildMedia(CFlvParser *pParser, int nWorker = -1); // 生成_pMedia, nWorker: 使用哪个工作线程的内存池
+        int WriteMedia(CFlvWriter &f);                         // 不生成_pMedia, 直接写出带起始码的H.264
+
+        int DecodeNalu(CFlvParser *pParser, CVideojj *pVjj, int nWorker); // 查找SEI并生成_pMedia
+
+    private:
+        int ConfigNalus(uint8_t *&pSps, int &nSpsLen, uint8_t *&pPps, int &nPpsLen);
     };
 
     // 音频Tag
@@ -95,14 +208,17 @@ private:
         int _nSoundSize;   // 精度
         int _nSoundType;   // 类型
 
-        // aac
-        static int _aacProfile;      // 对应AAC profile
-        static int _sampleRateIndex; // 采样率索引
-        static int _channelConfig;   // 通道设置
+        const AudioContext *_pCtx; // 解析该Tag时的AAC配置
 
         int ParseAACTag(CFlvParser *pParser);
         int ParseAudioSpecificConfig(CFlvParser *pParser, uint8_t *pTagData);
         int ParseRawAAC(CFlvParser *pParser, uint8_t *pTagData);
+
+        int BuildMedia(CFlvParser *pParser, int nWorker = -1); // 生成_pMedia, nWorker: 使用哪个工作线程的内存池
+        int WriteMedia(CFlvWriter &f);                         // 不生成_pMedia, 直接写出带ADTS头的AAC
+
+    private:
+        void MakeAdtsHeader(uint8_t *pHeader);
     };
 
     // Script Tag
@@ -111,8 +227,7 @@ private:
     public:
         CMetaDataTag(TagHeader *pHeader, uint8_t *pBuf, int nLeftLen, CFlvParser *pParser);
 
-        double hexStr2double(const unsigned char *hex, const unsigned int length);
-        int parseMeta(CFlvParser *pParser);
+        int parseMeta(CFlvParser *pParser); // 使用CFlvAmfReader(FlvAmf.h)解析, Tag Body也可以直接用它遍历
         void printMeta();
 
         uint8_t m_amf1_type;  // AMF1包类型, 总是0x02, 表示字符串.
@@ -139,8 +254,29 @@ private:
         string m_compatible_brands; // 格式规范相关
         string m_encoder;           // 封装工具名称, 如Lavf54.63.104
         double m_filesize;          // 文件大小(字节)
+
+        vector<double> m_keyframe_times;         // keyframes.times: 关键帧的时间(秒), 没有时为空
+        vector<double> m_keyframe_filepositions; // keyframes.filepositions: 关键帧Tag在文件中的位置
     };
 
+    FlvHeader *Header() { return _pFlvHeader; }
+
+    // 当前的视频/音频配置, 还没有遇到sequence header时为默认值
+    const VideoContext *VideoCtx() { return _vpVideoCtx.back(); }
+    const AudioContext *AudioCtx() { return _vpAudioCtx.back(); }
+
+    // Tag的媒体数据, 延迟模式下第一次访问时生成. 没有媒体数据时返回NULL
+    uint8_t *GetMedia(Tag *pTag, int &nMediaLen);
+
+    // 单个Tag的输出, DumpXXX() 和流式输出(CFlvDumpSink)共用.
+    // Tag自身的数据用WriteRef()写出, 流式输出时需要关闭CFlvWriter的引用写入
+    int WriteH264(CFlvWriter &f, Tag *pTag);
+    int WriteAAC(CFlvWriter &f, Tag *pTag);
+    int WriteFlvHeader(CFlvWriter &f);
+    // 写入PreviousTagSize和整个Tag. pDedup不为NULL时去掉AVC NALU Tag中重复的SPS/PPS/SEI(见FlvDedup.h),
+    // 每个输出文件使用自己的pDedup
+    int WriteFlvTag(CFlvWriter &f, Tag *pTag, uint32_t &nLastTagSize, CFlvNaluDedup *pDedup = NULL);
+
     struct FlvStat
     {
         int nMetaNum, nVideoNum, nAudioNum;
@@ -151,6 +287,10 @@ private:
         ~FlvStat() {}
     };
 
+    const FlvStat &GetStat() { return _sStat; }
+
+private:
+
     static uint32_t ShowU32(uint8_t *pBuf)
     {
         // 大端模式
@@ -160,13 +300,6 @@ private:
     static uint32_t ShowU24(uint8_t *pBuf) { return (pBuf[0] << 16) | (pBuf[1] << 8) | (pBuf[2]); }
     static uint32_t ShowU16(uint8_t *pBuf) { return (pBuf[0] << 8) | (pBuf[1]); }
     static uint32_t ShowU8(uint8_t *pBuf) { return (pBuf[0]); }
-    static void WriteU64(uint64_t &x, int length, int value)
-
-    {
-        uint64_t mask = 0xFFFFFFFFFFFFFFFF >> (64 - length);
-        x = (x << length) | ((uint64_t)value & mask);
-    }
-
     static uint32_t WriteU32(uint32_t n)
     {
         uint32_t nn = 0;
@@ -184,19 +317,73 @@ private:
 private:
     FlvHeader *CreateFlvHeader(uint8_t *pBuf);
     int DestroyFlvHeader(FlvHeader *pHeader);
-    Tag *CreateTag(uint8_t *pBuf, int nLeftLen);
-    int DestroyTag(Tag *pTag);
-    int Stat();
+    Tag *CreateTag(uint8_t *pBuf, int64_t nLeftLen);
+    int DestroyTag(Tag *pTag); // 释放Tag的内存以及Tag对象本身
+    void *AllocTag(size_t nSize);
+    uint8_t *AllocBuffer(int nLen, int nWorker = -1); // nWorker >= 0 时从该工作线程的内存池分配
+    void RecycleArena();
+    int FinishTag(Tag *pTag);
+    int DecodeTag(Tag *pTag, CVideojj *pVjj, int nWorker);
+    void DecodePending();
+    int DispatchTag(CFlvTagSink *pSink, Tag *pTag);
+    void ResetContexts();
+    int64_t FeedNeed(const uint8_t *pBuf, int64_t nLen);
+    int FeedParse(uint8_t *pBuf, int64_t nLen, int64_t &nUsedLen);
+    int IndexTag(Tag *pTag, int64_t nOffset);
+    int StatTag(Tag *pTag);
     int StatVideo(Tag *pTag);
     int IsUserDataTag(Tag *pTag);
+    CFlvMetrics *Metrics(int nWorker); // nWorker >= 0 时返回该工作线程自己的计数, 未启用时返回NULL
+    void MetricsTag(Tag *pTag, int64_t nStartNs); // 未知类型的Tag计入script阶段
+    void MetricsDump(int64_t nBytesWritten, int64_t nStartNs);
 
 private:
     FlvHeader *_pFlvHeader;
     vector<Tag *> _vpTag;
     FlvStat _sStat;
     CVideojj *_vjj;
+    bool _bZeroCopy; // 是否零拷贝
+    CFlvArena *_pArena; // 内存池, 为NULL时使用new/delete
+    CFlvTagSink *_pSink;
+    bool _bStop; // sink要求停止解析
+    CFlvInputBuffer *_pFeedBuf; // Feed()中不完整的数据
+    CFlvIndex *_pIndex;
+    int64_t _nStreamPos; // Parse()输入缓冲区的起始位置在整个FLV流中的位置
+    int64_t _nNeedBytes; // 见NeedBytes()
+    bool _bKeepTags; // 流式模式下是否仍然保留Tag
+
+    // 两阶段解析
+    CFlvThreadPool *_pPool;
+    bool _bParallel;                     // 是否把Tag Body的处理推迟到第二阶段
+    vector<Tag *> _vpPending;            // 已经找到边界, 等待第二阶段处理的Tag
+    int _nPendingBytes;
+    vector<CFlvArena *> _vpWorkerArena;  // 每个工作线程的内存池
+    vector<CVideojj *> _vpTaskVjj;       // 每个任务的SEI(与_vjj的UUID注册相同), 按任务顺序合并到_vjj
+
+    bool _bVerbose;
+    bool _bLazyMedia; // 是否延迟生成_pMedia
+
+    CFlvMetrics *_pMetrics;
+    vector<CFlvMetrics> _vWorkerMetrics; // 两阶段解析时每个工作线程的计数, 每一批结束后合并到_pMetrics
+
+    // 编解码上下文, 最后一个是当前的配置. 只在解析线程中追加
+    vector<VideoContext *> _vpVideoCtx;
+    vector<AudioContext *> _vpAudioCtx;
+};
+
+// 流式处理Tag的接口, pTag只在回调期间有效
+class CFlvTagSink
+{
+public:
+    virtual ~CFlvTagSink() {}
+
+    // Tag的回调返回0表示不再需要后面的数据, Parse()在该Tag之后停止
 
-    int _nNalUnitLength; // NalUnit长度表示占用的字节
+    virtual int OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader) { return 1; }
+    virtual int OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag) { return 1; }
+    virtual int OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag) { return 1; }
+    virtual int OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag) { return 1; }
+    virtual int OnOtherTag(CFlvParser *pParser, CFlvParser::Tag *pTag) { return 1; } // 未知类型的Tag
 };
 
 #endif // FLVPARSER_H
@@ -0,0 +1,412 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <iostream>
+#include <fstream>
+
+#include "FlvParser.h"
+#include "FlvReader.h"
+#include "FlvProbe.h"
+
+using namespace std;
+
+FlvProbeInfo::FlvProbeInfo()
+{
+    bHeader = false;
+    nVersion = 0;
+    bHaveVideo = bHaveAudio = false;
+
+    bMeta = false;
+    dDuration = dFileSize = 0;
+    dWidth = dHeight = dVideoDataRate = dFrameRate = dVideoCodecID = 0;
+    dAudioDataRate = dAudioSampleRate = dAudioSampleSize = dAudioCodecID = 0;
+    bStereo = false;
+
+    bVideo = false;
+    nVideoCodecID = 0;
+    bAvcConfig = false;
+    nAvcProfile = nAvcCompatibility = nAvcLevel = 0;
+    nNalUnitLength = 0;
+    nSpsNum = nPpsNum = nSpsLen = nPpsLen = 0;
+    bSps = false;
+    nWidth = nHeight = nChromaFormat = nBitDepth = nSarNum = nSarDen = 0;
+    bInterlaced = false;
+    dSpsFrameRate = 0;
+
+    bAudio = false;
+    nSoundFormat = nSoundRate = nSoundSize = nSoundType = 0;
+    bAacConfig = false;
+    nAacProfile = nSampleRateIndex = nChannelConfig = 0;
+    nSampleRate = nChannels = nFrameLength = 0;
+    bSbr = bPs = false;
+    nExtSampleRate = 0;
+
+    nVideoTags = nAudioTags = nMetaTags = 0;
+    nBytesRead = 0;
+    bComplete = false;
+}
+
+/*
+收集探测信息的sink, 找到所需的信息之后让Parse()停止:
+1. FLV头中声明了视频: 需要AVC的配置, 或者非AVC的第一个视频Tag
+2. FLV头中声明了音频: 需要AAC的配置, 或者非AAC的第一个音频Tag
+ */
+class CFlvProbeSink : public CFlvTagSink
+{
+public:
+    CFlvProbeSink(FlvProbeInfo &info) : _info(info) {}
+
+    virtual int OnHeader(CFlvParser *pParser, CFlvParser::FlvHeader *pHeader)
+    {
+        _info.bHeader = true;
+        _info.nVersion = pHeader->nVersion;
+        _info.bHaveVideo = (pHeader->bHaveVideo != 0);
+        _info.bHaveAudio = (pHeader->bHaveAudio != 0);
+        return 1;
+    }
+
+    virtual int OnVideoTag(CFlvParser *pParser, CFlvParser::CVideoTag *pTag)
+    {
+        _info.nVideoTags++;
+        if (!_info.bVideo)
+        {
+            _info.bVideo = true;
+            _info.nVideoCodecID = pTag->_nCodecID;
+        }
+
+        // AVC sequence header
+        uint8_t *pd = pTag->_pTagData;
+        int nSize = pTag->_header.nDataSize;
+        if (!_info.bAvcConfig && pTag->_nCodecID == 7 && nSize >= 11 && pd[1] == 0)
+        {
+            _info.bAvcConfig = true;
+            _info.nAvcProfile = pd[6];
+            _info.nAvcCompatibility = pd[7];
+            _info.nAvcLevel = pd[8];
+            _info.nNalUnitLength = (pd[9] & 0x03) + 1;
+            _info.nSpsNum = pd[10] & 0x1f;
+            if (nSize >= 13)
+                _info.nSpsLen = ((pd[11] << 8) | pd[12]);
+            // 解析器已经把SPS解析到该Tag的视频上下文中
+            const FlvSpsInfo &sps = pTag->_pCtx->sps;
+            if (pTag->_pCtx->bSps)
+            {
+                _info.bSps = true;
+                _info.nWidth = sps.nWidth;
+                _info.nHeight = sps.nHeight;
+                _info.nChromaFormat = sps.nChromaFormat;
+                _info.nBitDepth = sps.nBitDepth;
+                _info.nSarNum = sps.nSarNum;
+                _info.nSarDen = sps.nSarDen;
+                _info.bInterlaced = sps.bInterlaced;
+                _info.dSpsFrameRate = sps.dFrameRate;
+            }
+            int nPpsPos = 13 + _info.nSpsLen;
+            if (nSize >= nPpsPos + 3)
+            {
+                _info.nPpsNum = pd[nPpsPos];
+                _info.nPpsLen = ((pd[nPpsPos + 1] << 8) | pd[nPpsPos + 2]);
+            }
+        }
+
+        return Done() ? 0 : 1;
+    }
+
+    virtual int OnAudioTag(CFlvParser *pParser, CFlvParser::CAudioTag *pTag)
+    {
+        _info.nAudioTags++;
+        if (!_info.bAudio)
+        {
+            _info.bAudio = true;
+            _info.nSoundFormat = pTag->_nSoundFormat;
+            _info.nSoundRate = pTag->_nSoundRate;
+            _info.nSoundSize = pTag->_nSoundSize;
+            _info.nSoundType = pTag->_nSoundType;
+        }
+
+        // AAC sequence header
+        if (!_info.bAacConfig && pTag->_nSoundFormat == 10 && pTag->_header.nDataSize >= 4 && pTag->_pTagData[1] == 0)
+        {
+            _info.bAacConfig = true;
+            const FlvAacConfig &config = pTag->_pCtx->aac;
+            _info.nAacProfile = config.nObjectType;
+            _info.nSampleRateIndex = config.nSampleRateIndex;
+            _info.nChannelConfig = config.nChannelConfig;
+            if (pTag->_pCtx->bAac)
+            {
+                _info.nSampleRate = config.nSampleRate;
+                _info.nChannels = config.nChannels;
+                _info.nFrameLength = config.nFrameLength;
+                _info.bSbr = config.bSbr;
+                _info.bPs = config.bPs;
+                _info.nExtSampleRate = config.nExtSampleRate;
+            }
+        }
+
+        return Done() ? 0 : 1;
+    }
+
+    virtual int OnScriptTag(CFlvParser *pParser, CFlvParser::CMetaDataTag *pTag)
+    {
+        _info.nMetaTags++;
+        if (!_info.bMeta && pTag->m_amf2_type != 0) // 只有onMetaData才会解析AMF2包
+        {
+            _info.bMeta = true;
+            _info.dDuration = pTag->m_duration;
+            _info.dFileSize = pTag->m_filesize;
+            _info.dWidth = pTag->m_width;
+            _info.dHeight = pTag->m_height;
+            _info.dVideoDataRate = pTag->m_videodatarate;
+            _info.dFrameRate = pTag->m_framerate;
+            _info.dVideoCodecID = pTag->m_videocodecid;
+            _info.dAudioDataRate = pTag->m_audiodatarate;
+            _info.dAudioSampleRate = pTag->m_audiosamplerate;
+            _info.dAudioSampleSize = pTag->m_audiosamplesize;
+            _info.dAudioCodecID = pTag->m_audiocodecid;
+            _info.bStereo = pTag->m_stereo;
+            _info.strMajorBrand = pTag->m_major_brand;
+            _info.strMinorVersion = pTag->m_minor_version;
+            _info.strCompatibleBrands = pTag->m_compatible_brands;
+            _info.strEncoder = pTag->m_encoder;
+        }
+        return 1;
+    }
+
+private:
+    bool Done()
+    {
+        bool bVideoDone = !_info.bHaveVideo || _info.bAvcConfig || (_info.bVideo && _info.nVideoCodecID != 7);
+        bool bAudioDone = !_info.bHaveAudio || _info.bAacConfig || (_info.bAudio && _info.nSoundFormat != 10);
+        _info.bComplete = bVideoDone && bAudioDone;
+        return _info.bComplete;
+    }
+
+    FlvProbeInfo &_info;
+};
+
+/*
+1. 从小的缓冲区开始读取, Tag(例如很大的onMetaData)放不下时再扩大缓冲区
+2. 每次读取后解析, sink找到全部信息时停止, 不再读取后面的数据
+ */
+int ProbeFlv(istream &fin, FlvProbeInfo &info, int64_t nMaxBytes)
+{
+    info = FlvProbeInfo();
+
+    CFlvParser parser;
+    parser.SetVerbose(false);
+    parser.SetZeroCopy(true);
+    parser.SetLazyMedia(true);
+    CFlvProbeSink sink(info);
+    parser.SetSink(&sink);
+
+    CFlvInputBuffer buf(16 * 1024);
+    while (buf.BytesRead() < nMaxBytes)
+    {
+        // 缓冲区放不下下一个完整的Tag(例如很大的onMetaData)时扩大
+        if (parser.NeedBytes() > buf.Capacity() && !buf.Grow(parser.NeedBytes(), FLV_MAX_TAG_BYTES))
+            break;
+        if (buf.Fill(fin, nMaxBytes - buf.BytesRead()) <= 0)
+            break;
+
+        int64_t nUsedLen = 0;
+        int nStop = parser.Parse(buf.Data(), buf.Size(), nUsedLen);
+        buf.Consume(nUsedLen);
+        if (nStop)
+            break;
+    }
+
+    info.nBytesRead = buf.BytesRead();
+    return info.bHeader ? 1 : 0;
+}
+
+int ProbeFlv(const char *path, FlvProbeInfo &info, int64_t nMaxBytes)
+{
+    if (strcmp(path, "-") == 0)
+        return ProbeFlv(cin, info, nMaxBytes);
+
+    ifstream fin(path, ios_base::in | ios_base::binary);
+    if (!fin)
+    {
+        info = FlvProbeInfo();
+        return 0;
+    }
+    return ProbeFlv(fin, info, nMaxBytes);
+}
+
+// ---------------------------------- JSON -------------------------------------
+
+static void JsonString(string &s, const char *sz, size_t nLen)
+{
+    s += '"';
+    for (size_t i = 0; i < nLen; i++)
+    {
+        unsigned char c = (unsigned char)sz[i];
+        if (c == '"' || c == '\\')
+        {
+            s += '\\';
+            s += (char)c;
+        }
+        else if (c < 0x20)
+        {
+            char szEsc[8];
+            snprintf(szEsc, sizeof(szEsc), "\\u%04x", c);
+            s += szEsc;
+        }
+        else
+            s += (char)c;
+    }
+    s += '"';
+}
+
+static void JsonKey(string &s, const char *szKey)
+{
+    if (s[s.size() - 1] != '{')
+        s += ',';
+    s += '"';
+    s += szKey;
+    s += "\":";
+}
+
+static void JsonInt(string &s, const char *szKey, int64_t n)
+{
+    char sz[32];
+    snprintf(sz, sizeof(sz), "%lld", (long long)n);
+    JsonKey(s, szKey);
+    s += sz;
+}
+
+static void JsonNumber(string &s, const char *szKey, double d)
+{
+    char sz[32];
+    snprintf(sz, sizeof(sz), "%.17g", d);
+    JsonKey(s, szKey);
+    s += (d == d && d - d == 0) ? sz : "null"; // NaN和无穷大不是合法的JSON数字
+}
+
+static void JsonBool(string &s, const char *szKey, bool b)
+{
+    JsonKey(s, szKey);
+    s += b ? "true" : "false";
+}
+
+static void JsonStr(string &s, const char *szKey, const string &str)
+{
+    JsonKey(s, szKey);
+    JsonString(s, str.c_str(), str.size());
+}
+
+string ProbeToJson(const char *name, const FlvProbeInfo &info)
+{
+    string s = "{";
+    JsonStr(s, "file", name);
+    JsonBool(s, "flv", info.bHeader);
+    JsonBool(s, "complete", info.bComplete);
+    JsonInt(s, "bytes_read", info.nBytesRead);
+
+    if (info.bHeader)
+    {
+        JsonKey(s, "header");
+        s += "{";
+        JsonInt(s, "version", info.nVersion);
+        JsonBool(s, "video", info.bHaveVideo);
+        JsonBool(s, "audio", info.bHaveAudio);
+        s += "}";
+    }
+
+    JsonKey(s, "tags");
+    s += "{";
+    JsonInt(s, "video", info.nVideoTags);
+    JsonInt(s, "audio", info.nAudioTags);
+    JsonInt(s, "meta", info.nMetaTags);
+    s += "}";
+
+    if (info.bMeta)
+    {
+        JsonKey(s, "metadata");
+        s += "{";
+        JsonNumber(s, "duration", info.dDuration);
+        JsonNumber(s, "filesize", info.dFileSize);
+        JsonNumber(s, "width", info.dWidth);
+        JsonNumber(s, "height", info.dHeight);
+        JsonNumber(s, "videodatarate", info.dVideoDataRate);
+        JsonNumber(s, "framerate", info.dFrameRate);
+        JsonNumber(s, "videocodecid", info.dVideoCodecID);
+        JsonNumber(s, "audiodatarate", info.dAudioDataRate);
+        JsonNumber(s, "audiosamplerate", info.dAudioSampleRate);
+        JsonNumber(s, "audiosamplesize", info.dAudioSampleSize);
+        JsonBool(s, "stereo", info.bStereo);
+        JsonNumber(s, "audiocodecid", info.dAudioCodecID);
+        JsonStr(s, "major_brand", info.strMajorBrand);
+        JsonStr(s, "minor_version", info.strMinorVersion);
+        JsonStr(s, "compatible_brands", info.strCompatibleBrands);
+        JsonStr(s, "encoder", info.strEncoder);
+        s += "}";
+    }
+
+    if (info.bVideo)
+    {
+        JsonKey(s, "video");
+        s += "{";
+        JsonInt(s, "codec_id", info.nVideoCodecID);
+        if (info.bAvcConfig)
+        {
+            JsonKey(s, "avc");
+            s += "{";
+            JsonInt(s, "profile", info.nAvcProfile);
+            JsonInt(s, "compatibility", info.nAvcCompatibility);
+            JsonInt(s, "level", info.nAvcLevel);
+            JsonInt(s, "nalu_length", info.nNalUnitLength);
+            JsonInt(s, "sps_num", info.nSpsNum);
+            JsonInt(s, "sps_size", info.nSpsLen);
+            JsonInt(s, "pps_num", info.nPpsNum);
+            JsonInt(s, "pps_size", info.nPpsLen);
+            s += "}";
+        }
+        if (info.bSps)
+        {
+            JsonKey(s, "sps");
+            s += "{";
+            JsonInt(s, "width", info.nWidth);
+            JsonInt(s, "height", info.nHeight);
+            JsonNumber(s, "framerate", info.dSpsFrameRate);
+            JsonInt(s, "chroma_format", info.nChromaFormat);
+            JsonInt(s, "bit_depth", info.nBitDepth);
+            JsonInt(s, "sar_num", info.nSarNum);
+            JsonInt(s, "sar_den", info.nSarDen);
+            JsonBool(s, "interlaced", info.bInterlaced);
+            s += "}";
+        }
+        s += "}";
+    }
+
+    if (info.bAudio)
+    {
+        JsonKey(s, "audio");
+        s += "{";
+        JsonInt(s, "sound_format", info.nSoundFormat);
+        JsonInt(s, "sound_rate", info.nSoundRate);
+        JsonInt(s, "sound_size", info.nSoundSize);
+        JsonInt(s, "sound_type", info.nSoundType);
+        if (info.bAacConfig)
+        {
+            JsonKey(s, "aac");
+            s += "{";
+            JsonInt(s, "profile", info.nAacProfile);
+            JsonInt(s, "sample_rate_index", info.nSampleRateIndex);
+            JsonInt(s, "channel_config", info.nChannelConfig);
+            JsonInt(s, "sample_rate", info.nSampleRate);
+            JsonInt(s, "channels", info.nChannels);
+            JsonInt(s, "frame_length", info.nFrameLength);
+            JsonBool(s, "sbr", info.bSbr);
+            JsonBool(s, "ps", info.bPs);
+            if (info.bSbr)
+                JsonInt(s, "sbr_sample_rate", info.nExtSampleRate);
+            s += "}";
+        }
+        s += "}";
+    }
+
+    s += "}";
+    return s;
+}
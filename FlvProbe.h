@@ -0,0 +1,56 @@
+﻿#ifndef FLVPROBE_H
+#define FLVPROBE_H
+
+#include <stdint.h>
+#include <istream>
+#include <string>
+
+// 探测结果: FLV头, onMetaData, 以及音视频的编解码配置
+struct FlvProbeInfo
+{
+    bool bHeader; // 是否找到FLV头
+    int nVersion;
+    bool bHaveVideo, bHaveAudio; // FLV头中的标志
+
+    bool bMeta; // 是否找到onMetaData
+    double dDuration, dFileSize;
+    double dWidth, dHeight, dVideoDataRate, dFrameRate, dVideoCodecID;
+    double dAudioDataRate, dAudioSampleRate, dAudioSampleSize, dAudioCodecID;
+    bool bStereo;
+    std::string strMajorBrand, strMinorVersion, strCompatibleBrands, strEncoder;
+
+    bool bVideo;      // 是否找到第一个视频Tag
+    int nVideoCodecID; // 7: AVC
+    bool bAvcConfig;  // 是否找到AVCDecoderConfigurationRecord
+    int nAvcProfile, nAvcCompatibility, nAvcLevel;
+    int nNalUnitLength;
+    int nSpsNum, nPpsNum, nSpsLen, nPpsLen; // 第一个SPS/PPS的长度
+    bool bSps;        // 第一个SPS是否解析成功, 下面的信息不依赖onMetaData
+    int nWidth, nHeight, nChromaFormat, nBitDepth, nSarNum, nSarDen;
+    bool bInterlaced;
+    double dSpsFrameRate; // VUI timing_info中的帧率, 没有时为0
+
+    bool bAudio;      // 是否找到第一个音频Tag
+    int nSoundFormat, nSoundRate, nSoundSize, nSoundType; // 10: AAC
+    bool bAacConfig;  // 是否找到AudioSpecificConfig
+    int nAacProfile, nSampleRateIndex, nChannelConfig;
+    int nSampleRate, nChannels, nFrameLength; // 核心编码的采样率, 声道数, 每帧的采样数
+    bool bSbr, bPs;
+    int nExtSampleRate; // SBR的输出采样率
+
+    int nVideoTags, nAudioTags, nMetaTags; // 探测过程中解析的Tag数
+    int64_t nBytesRead;                    // 读取的字节数
+    bool bComplete;                        // FLV头中声明的音视频配置是否都已找到
+
+    FlvProbeInfo();
+};
+
+// 只读取文件开头: 找到FLV头, onMetaData和音视频的编解码配置之后立即停止, 最多读取nMaxBytes字节.
+// path为"-"时读取标准输入. 找到FLV头返回1, 否则返回0
+int ProbeFlv(const char *path, FlvProbeInfo &info, int64_t nMaxBytes = 1024 * 1024);
+int ProbeFlv(std::istream &fin, FlvProbeInfo &info, int64_t nMaxBytes = 1024 * 1024);
+
+// 单行JSON, name为输入文件名
+std::string ProbeToJson(const char *name, const FlvProbeInfo &info);
+
+#endif // FLVPROBE_H
@@ -0,0 +1,69 @@
+﻿#ifndef FLVQUEUE_H
+#define FLVQUEUE_H
+
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// 有界的单生产者单消费者无锁队列: 只能有一个线程Push, 一个线程Pop.
+// 队列满时Push()等待消费者(背压), 队列空时Pop()等待生产者. 等待时先让出CPU, 一段时间后改为短暂休眠
+template <typename T>
+class CFlvSpscQueue
+{
+public:
+    CFlvSpscQueue(size_t nCapacity) : _vItem(nCapacity + 1), _nHead(0), _nTail(0) {}
+
+    bool TryPush(const T &item)
+    {
+        size_t nTail = _nTail.load(std::memory_order_relaxed);
+        size_t nNext = (nTail + 1 == _vItem.size()) ? 0 : nTail + 1;
+        if (nNext == _nHead.load(std::memory_order_acquire))
+            return false; // 满
+        _vItem[nTail] = item;
+        _nTail.store(nNext, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(T &item)
+    {
+        size_t nHead = _nHead.load(std::memory_order_relaxed);
+        if (nHead == _nTail.load(std::memory_order_acquire))
+            return false; // 空
+        item = _vItem[nHead];
+        _nHead.store((nHead + 1 == _vItem.size()) ? 0 : nHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    void Push(const T &item)
+    {
+        for (int i = 0; !TryPush(item); i++)
+            Backoff(i);
+    }
+
+    void Pop(T &item)
+    {
+        for (int i = 0; !TryPop(item); i++)
+            Backoff(i);
+    }
+
+    static void Backoff(int nTry)
+    {
+        if (nTry < 64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+private:
+    CFlvSpscQueue(const CFlvSpscQueue &);
+    CFlvSpscQueue &operator=(const CFlvSpscQueue &);
+
+    std::vector<T> _vItem; // 多一个位置用来区分满和空
+    std::atomic<size_t> _nHead; // 消费者的位置
+    char _szPad[64];            // _nHead和_nTail放在不同的缓存行
+    std::atomic<size_t> _nTail; // 生产者的位置
+};
+
+#endif // FLVQUEUE_H
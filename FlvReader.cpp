@@ -0,0 +1,216 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>
+#endif
+
+#include "FlvReader.h"
+
+using namespace std;
+
+CFlvFileMap::CFlvFileMap()
+{
+    _pData = NULL;
+    _nSize = 0;
+}
+
+CFlvFileMap::~CFlvFileMap()
+{
+    Close();
+}
+
+/*
+1. 只映射普通文件, 管道/字符设备直接返回0
+2. mmap 整个文件(只读)
+3. madvise(SEQUENTIAL) 让内核加大预读, 并尽快回收已读过的页
+ */
+int CFlvFileMap::Open(const char *path)
+{
+    Close();
+
+#ifdef _WIN32
+    (void)path;
+    return 0;
+#else
+    if (path == NULL || strcmp(path, "-") == 0)
+        return 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // 映射建立之后即可关闭文件描述符
+    if (p == MAP_FAILED)
+        return 0;
+
+    madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    _pData = (uint8_t *)p;
+    _nSize = st.st_size;
+    return 1;
+#endif
+}
+
+void CFlvFileMap::Close()
+{
+#ifndef _WIN32
+    if (_pData != NULL)
+        munmap(_pData, (size_t)_nSize);
+#endif
+    _pData = NULL;
+    _nSize = 0;
+}
+
+CFlvInputBuffer::CFlvInputBuffer(int64_t nCapacity)
+{
+    _pBuf = new uint8_t[(size_t)nCapacity];
+    _nCapacity = nCapacity;
+    _nStart = 0;
+    _nEnd = 0;
+    _nBytesRead = 0;
+    _nBytesCopied = 0;
+    _nRefills = 0;
+}
+
+CFlvInputBuffer::~CFlvInputBuffer()
+{
+    delete[] _pBuf;
+}
+
+// 把未解析的数据移到缓冲区开头, 只复制一次
+void CFlvInputBuffer::Compact()
+{
+    if (_nStart == 0)
+        return;
+
+    int64_t nLeft = _nEnd - _nStart;
+    if (nLeft > 0)
+    {
+        memmove(_pBuf, _pBuf + _nStart, (size_t)nLeft);
+        _nBytesCopied += nLeft;
+    }
+    _nStart = 0;
+    _nEnd = nLeft;
+}
+
+int64_t CFlvInputBuffer::Fill(istream &fin, int64_t nMaxLen)
+{
+    Compact();
+    if (_nEnd == _nCapacity || nMaxLen <= 0)
+        return 0;
+
+    fin.read((char *)_pBuf + _nEnd, (streamsize)(_nCapacity - _nEnd < nMaxLen ? _nCapacity - _nEnd : nMaxLen));
+    int64_t nReadNum = (int64_t)fin.gcount();
+    _nEnd += nReadNum;
+    _nBytesRead += nReadNum;
+    _nRefills++;
+
+    return nReadNum;
+}
+
+int64_t CFlvInputBuffer::FillAt(int fd, int64_t nOffset, int64_t nMaxLen)
+{
+    Compact();
+    if (_nEnd == _nCapacity || nMaxLen <= 0)
+        return 0;
+
+    int64_t nLen = _nCapacity - _nEnd < nMaxLen ? _nCapacity - _nEnd : nMaxLen;
+#ifndef _WIN32
+    ssize_t nReadNum;
+    while ((nReadNum = pread(fd, _pBuf + _nEnd, (size_t)nLen, (off_t)nOffset)) < 0 && errno == EINTR)
+        ;
+#else
+    int nReadNum = -1;
+    if (_lseeki64(fd, nOffset, SEEK_SET) == nOffset)
+        nReadNum = _read(fd, _pBuf + _nEnd, (unsigned int)(nLen < 0x7fffffff ? nLen : 0x7fffffff));
+#endif
+    if (nReadNum <= 0)
+        return 0;
+
+    _nEnd += nReadNum;
+    _nBytesRead += nReadNum;
+    _nRefills++;
+
+    return nReadNum;
+}
+
+int CFlvInputBuffer::Reserve(int64_t nCapacity)
+{
+    if (nCapacity <= _nCapacity)
+        return 1;
+
+    uint8_t *pBuf = new uint8_t[(size_t)nCapacity];
+    int64_t nLeft = _nEnd - _nStart;
+    memcpy(pBuf, _pBuf + _nStart, (size_t)nLeft);
+    _nBytesCopied += nLeft;
+
+    delete[] _pBuf;
+    _pBuf = pBuf;
+    _nCapacity = nCapacity;
+    _nStart = 0;
+    _nEnd = nLeft;
+
+    return 1;
+}
+
+int CFlvInputBuffer::Grow(int64_t nNeed, int64_t nMaxCapacity)
+{
+    if (nNeed <= _nCapacity)
+        return 1;
+    if (nNeed > nMaxCapacity)
+        return 0;
+
+    int64_t nCapacity = _nCapacity * 2;
+    while (nCapacity < nNeed)
+        nCapacity *= 2;
+    return Reserve(nCapacity < nMaxCapacity ? nCapacity : nMaxCapacity);
+}
+
+int CFlvInputBuffer::Append(const uint8_t *pData, int64_t nLen)
+{
+    if (nLen <= 0)
+        return 0;
+    if (_nEnd + nLen > _nCapacity)
+    {
+        Compact();
+        if (_nEnd + nLen > _nCapacity)
+        {
+            int64_t nCapacity = _nCapacity * 2;
+            while (nCapacity < _nEnd + nLen)
+                nCapacity *= 2;
+            Reserve(nCapacity);
+        }
+    }
+
+    memcpy(_pBuf + _nEnd, pData, (size_t)nLen);
+    _nEnd += nLen;
+    _nBytesRead += nLen;
+    _nBytesCopied += nLen;
+    return 1;
+}
+
+void CFlvInputBuffer::Consume(int64_t nLen)
+{
+    _nStart += nLen;
+    if (_nStart >= _nEnd)
+    {
+        // 数据全部解析完, 下次直接从头开始写, 不需要整理
+        _nStart = 0;
+        _nEnd = 0;
+    }
+}
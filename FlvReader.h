@@ -0,0 +1,79 @@
+﻿#ifndef FLVREADER_H
+#define FLVREADER_H
+
+#include <stdint.h>
+#include <istream>
+
+// 把整个输入文件映射到内存, 供 CFlvParser::Parse() 一次性解析.
+// 只支持普通文件; 管道, 标准输入等无法映射的输入由调用者回退到分块读取.
+class CFlvFileMap
+{
+public:
+    CFlvFileMap();
+    virtual ~CFlvFileMap();
+
+    // 成功返回1, 无法映射返回0
+    int Open(const char *path);
+    void Close();
+
+    uint8_t *Data() { return _pData; }
+    int64_t Size() { return _nSize; }
+
+private:
+    CFlvFileMap(const CFlvFileMap &);
+    CFlvFileMap &operator=(const CFlvFileMap &);
+
+    uint8_t *_pData;
+    int64_t _nSize;
+};
+
+// FLV头之后最大的一个单元: PreviousTagSize + Tag Header + 24bit长度的Tag Body
+#define FLV_MAX_TAG_BYTES (4 + 11 + 0xffffffLL)
+
+// 分块读取时使用的输入缓冲区.
+// 未解析完的尾部数据在下一次读取之前用一次memmove移到缓冲区开头, 容量可以按需扩大.
+class CFlvInputBuffer
+{
+public:
+    CFlvInputBuffer(int64_t nCapacity);
+    virtual ~CFlvInputBuffer();
+
+    // 整理缓冲区并从fin读取数据填满剩余空间(最多nMaxLen字节), 返回读取的字节数
+    int64_t Fill(std::istream &fin, int64_t nMaxLen = INT64_MAX);
+    // 同上, 从文件描述符fd的nOffset位置读取(pread, 不改变文件位置), 用于只读取文件中的一段
+    int64_t FillAt(int fd, int64_t nOffset, int64_t nMaxLen = INT64_MAX);
+    // 扩大容量(只增不减), 已有数据保持不变. 成功返回1
+    int Reserve(int64_t nCapacity);
+    // 未解析的数据需要nNeed字节(见CFlvParser::NeedBytes())而容量不够时按2倍扩大, 但不超过nMaxCapacity.
+    // 容量足够或者扩大成功返回1, 超过上限返回0(容量不变)
+    int Grow(int64_t nNeed, int64_t nMaxCapacity);
+    // 把pData追加到未解析数据的后面, 空间不够时扩大容量. 成功返回1, nLen不大于0时返回0(不追加)
+    int Append(const uint8_t *pData, int64_t nLen);
+    // 标记前nLen字节已经解析完
+    void Consume(int64_t nLen);
+
+    uint8_t *Data() { return _pBuf + _nStart; }
+    int64_t Size() { return _nEnd - _nStart; }
+    int64_t Capacity() { return _nCapacity; }
+
+    int64_t BytesRead() { return _nBytesRead; }     // 从输入读取的总字节数
+    int64_t BytesCopied() { return _nBytesCopied; } // 整理/扩容时复制的总字节数
+    int64_t Refills() { return _nRefills; }         // 读取次数
+
+private:
+    CFlvInputBuffer(const CFlvInputBuffer &);
+    CFlvInputBuffer &operator=(const CFlvInputBuffer &);
+
+    void Compact();
+
+    uint8_t *_pBuf;
+    int64_t _nCapacity;
+    int64_t _nStart; // 未解析数据的起始位置
+    int64_t _nEnd;   // 未解析数据的结束位置
+
+    int64_t _nBytesRead;
+    int64_t _nBytesCopied;
+    int64_t _nRefills;
+};
+
+#endif // FLVREADER_H
@@ -0,0 +1,180 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "FlvSei.h"
+#include "FlvBits.h"
+
+using namespace std;
+
+static const int nSeiNaluType = 6;
+static const int nUserDataUnregistered = 5;
+
+static uint64_t GetBE64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static bool LessTime(const FlvSeiMessage &a, const FlvSeiMessage &b) { return a.nTimeStamp < b.nTimeStamp; }
+
+// payload一般只有几十个字节, 不需要1MB的块
+CFlvSeiEngine::CFlvSeiEngine() : _bSorted(true), _arena(64 * 1024)
+{
+}
+
+CFlvSeiEngine::~CFlvSeiEngine()
+{
+}
+
+int CFlvSeiEngine::RegisterUuid(const uint8_t *pUuid, int nMatchLen)
+{
+    if (pUuid == NULL || nMatchLen < 1 || nMatchLen > 16)
+        return -1;
+
+    uint8_t szMask[16];
+    memset(szMask, 0, sizeof(szMask));
+    memset(szMask, 0xff, nMatchLen);
+
+    Uuid uuid;
+    uuid.nMaskHi = GetBE64(szMask);
+    uuid.nMaskLo = GetBE64(szMask + 8);
+    uuid.nHi = GetBE64(pUuid) & uuid.nMaskHi;
+    uuid.nLo = GetBE64(pUuid + 8) & uuid.nMaskLo;
+    _vUuid.push_back(uuid);
+    return (int)_vUuid.size() - 1;
+}
+
+int CFlvSeiEngine::MatchUuid(const uint8_t *p)
+{
+    uint64_t nHi = GetBE64(p);
+    uint64_t nLo = GetBE64(p + 8);
+    for (size_t i = 0; i < _vUuid.size(); i++)
+    {
+        const Uuid &uuid = _vUuid[i];
+        if (((nHi & uuid.nMaskHi) ^ uuid.nHi) == 0 && ((nLo & uuid.nMaskLo) ^ uuid.nLo) == 0)
+            return (int)i;
+    }
+    return -1;
+}
+
+/*
+1. 只处理SEI NALU(nal_unit_type 6), 包含防竞争字节(00 00 03)时先去掉
+2. 依次解析sei_message: payloadType和payloadSize都是若干个0xFF加上最后一个字节的和
+3. payloadType为5(user_data_unregistered)且UUID匹配时保存UUID之后的数据
+ */
+int CFlvSeiEngine::Process(const uint8_t *pNalu, int nNaluLen, uint32_t nTimeStamp)
+{
+    if (nNaluLen < 2 || (pNalu[0] & 0x1f) != nSeiNaluType || _vUuid.empty())
+        return 0;
+
+    const uint8_t *p = pNalu;
+    const uint8_t *pEnd = pNalu + nNaluLen;
+    if (FlvRbspUnescape(pNalu, nNaluLen, _vRbsp))
+    {
+        p = &_vRbsp[0];
+        pEnd = p + _vRbsp.size();
+    }
+
+    int nMatched = 0;
+    p++; // NAL头
+    // 最后剩下的一个字节是rbsp_trailing_bits(0x80)
+    while (pEnd - p > 1 || (pEnd - p == 1 && *p != 0x80))
+    {
+        int nType = 0;
+        while (p < pEnd && *p == 0xff)
+            nType += *p++;
+        if (p >= pEnd)
+            break;
+        nType += *p++;
+
+        int nSize = 0;
+        while (p < pEnd && *p == 0xff)
+            nSize += *p++;
+        if (p >= pEnd)
+            break;
+        nSize += *p++;
+        if (nSize > pEnd - p)
+            break; // 数据不完整
+
+        if (nType == nUserDataUnregistered && nSize >= 16)
+        {
+            int nKind = MatchUuid(p);
+            if (nKind >= 0)
+            {
+                Add(nKind, p + 16, nSize - 16, nTimeStamp);
+                nMatched++;
+            }
+        }
+        p += nSize;
+    }
+
+    return nMatched;
+}
+
+void CFlvSeiEngine::Add(int nKind, const uint8_t *p, int nLen, uint32_t nTimeStamp)
+{
+    FlvSeiMessage msg;
+    msg.nTimeStamp = nTimeStamp;
+    msg.nKind = nKind;
+    msg.pData = (uint8_t *)_arena.Alloc(nLen > 0 ? nLen : 1);
+    msg.nLen = nLen;
+    memcpy(msg.pData, p, nLen);
+
+    // 正常情况下按时间戳顺序追加, 已经是有序的
+    if (!_vMsg.empty() && LessTime(msg, _vMsg.back()))
+        _bSorted = false;
+    _vMsg.push_back(msg);
+}
+
+void CFlvSeiEngine::Append(CFlvSeiEngine &other)
+{
+    // other的内存池随后会被复用, payload需要复制
+    for (size_t i = 0; i < other._vMsg.size(); i++)
+    {
+        const FlvSeiMessage &msg = other._vMsg[i];
+        Add(msg.nKind, msg.pData, msg.nLen, msg.nTimeStamp);
+    }
+    other.Clear();
+}
+
+void CFlvSeiEngine::Clear()
+{
+    _vMsg.clear();
+    _bSorted = true;
+    _arena.Reset();
+}
+
+void CFlvSeiEngine::Sort()
+{
+    if (_bSorted)
+        return;
+    stable_sort(_vMsg.begin(), _vMsg.end(), LessTime);
+    _bSorted = true;
+}
+
+const FlvSeiMessage &CFlvSeiEngine::At(size_t i)
+{
+    Sort();
+    return _vMsg[i];
+}
+
+const FlvSeiMessage *CFlvSeiEngine::Range(uint32_t nFrom, uint32_t nTo, size_t &nCount)
+{
+    Sort();
+    nCount = 0;
+
+    FlvSeiMessage key;
+    key.nTimeStamp = nFrom;
+    vector<FlvSeiMessage>::iterator itBegin = lower_bound(_vMsg.begin(), _vMsg.end(), key, LessTime);
+    key.nTimeStamp = nTo;
+    vector<FlvSeiMessage>::iterator itEnd = upper_bound(itBegin, _vMsg.end(), key, LessTime);
+    if (nFrom > nTo || itBegin == itEnd)
+        return NULL;
+
+    nCount = itEnd - itBegin;
+    return &*itBegin;
+}
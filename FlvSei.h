@@ -0,0 +1,69 @@
+﻿#ifndef FLVSEI_H
+#define FLVSEI_H
+
+#include <stdint.h>
+#include <vector>
+#include "FlvArena.h"
+
+// 一条匹配的SEI user_data_unregistered(payloadType 5)消息
+struct FlvSeiMessage
+{
+    uint32_t nTimeStamp; // 所在Tag的时间戳(ms)
+    int nKind;           // RegisterUuid()的返回值
+    uint8_t *pData;      // UUID之后的数据(已去掉防竞争字节), 保存在引擎的内存池中, Clear()之后失效
+    int nLen;
+};
+
+/*
+SEI提取: 注册若干个16字节的UUID, Process()遍历SEI NALU中所有的sei_message,
+UUID匹配的user_data_unregistered复制到内存池, 并按时间戳排序, 可以按时间范围查询.
+不是SEI的NALU只需要判断NAL头, UUID用两个64位整数比较.
+ */
+class CFlvSeiEngine
+{
+public:
+    CFlvSeiEngine();
+    virtual ~CFlvSeiEngine();
+
+    // 注册一个UUID, 只比较前nMatchLen(1-16)个字节. 返回种类编号(按注册顺序从0开始), 失败返回-1
+    int RegisterUuid(const uint8_t *pUuid, int nMatchLen = 16);
+    int UuidNum() { return (int)_vUuid.size(); }
+    // 使用other的UUID注册, 多个线程各自的引擎需要相同的注册
+    void CopyUuids(const CFlvSeiEngine &other) { _vUuid = other._vUuid; }
+
+    // pNalu从NAL头开始(不含起始码/长度字段), 可以直接传入FLV Tag Body中的NALU. 返回匹配的消息数
+    int Process(const uint8_t *pNalu, int nNaluLen, uint32_t nTimeStamp);
+
+    // 把other中的消息按顺序追加到末尾, 用于合并多个线程的结果. other随后被清空
+    void Append(CFlvSeiEngine &other);
+    // 清除所有消息, 保留UUID注册
+    void Clear();
+
+    // 按时间戳排序(时间戳相同时保持出现的顺序)
+    size_t Count() { return _vMsg.size(); }
+    const FlvSeiMessage &At(size_t i);
+    // 时间戳在[nFrom, nTo]之间的消息, 返回第一条, nCount返回条数, 没有时返回NULL
+    const FlvSeiMessage *Range(uint32_t nFrom, uint32_t nTo, size_t &nCount);
+
+private:
+    CFlvSeiEngine(const CFlvSeiEngine &);
+    CFlvSeiEngine &operator=(const CFlvSeiEngine &);
+
+    struct Uuid
+    {
+        uint64_t nHi, nLo;         // 大端读取的16个字节
+        uint64_t nMaskHi, nMaskLo; // 只比较前nMatchLen个字节
+    };
+
+    int MatchUuid(const uint8_t *p);
+    void Add(int nKind, const uint8_t *p, int nLen, uint32_t nTimeStamp);
+    void Sort();
+
+    std::vector<Uuid> _vUuid;
+    std::vector<FlvSeiMessage> _vMsg;
+    bool _bSorted;
+    CFlvArena _arena;
+    std::vector<uint8_t> _vRbsp; // 去掉防竞争字节的NALU
+};
+
+#endif // FLVSEI_H
@@ -0,0 +1,446 @@
+﻿#include <stdlib.h>
+#include <string.h>
+
+#include "FlvSynth.h"
+#include "FlvBits.h"
+
+using namespace std;
+
+static void PutU8(vector<uint8_t> &v, uint32_t n) { v.push_back((uint8_t)n); }
+static void PutU16(vector<uint8_t> &v, uint32_t n)
+{
+    v.push_back((uint8_t)(n >> 8));
+    v.push_back((uint8_t)n);
+}
+static void PutU24(vector<uint8_t> &v, uint32_t n)
+{
+    v.push_back((uint8_t)(n >> 16));
+    PutU16(v, n);
+}
+static void PutU32(vector<uint8_t> &v, uint32_t n)
+{
+    PutU16(v, n >> 16);
+    PutU16(v, n);
+}
+
+// AMF0
+static void PutAmfString(vector<uint8_t> &v, const char *str)
+{
+    int nLen = (int)strlen(str);
+    PutU16(v, nLen);
+    v.insert(v.end(), str, str + nLen);
+}
+static void PutAmfNumber(vector<uint8_t> &v, const char *key, double d)
+{
+    PutAmfString(v, key);
+    PutU8(v, 0x00);
+    uint64_t n;
+    memcpy(&n, &d, 8);
+    PutU32(v, (uint32_t)(n >> 32));
+    PutU32(v, (uint32_t)n);
+}
+static void PutAmfBool(vector<uint8_t> &v, const char *key, bool b)
+{
+    PutAmfString(v, key);
+    PutU8(v, 0x01);
+    PutU8(v, b ? 1 : 0);
+}
+static void PutAmfStringValue(vector<uint8_t> &v, const char *key, const char *value)
+{
+    PutAmfString(v, key);
+    PutU8(v, 0x02);
+    PutAmfString(v, value);
+}
+
+CFlvSynth::CFlvSynth(const FlvSynthConfig &config)
+{
+    _config = config;
+    if (_config.nNaluLengthSize < 1 || _config.nNaluLengthSize > 4)
+        _config.nNaluLengthSize = 4;
+    if (_config.nFps <= 0)
+        _config.nFps = 30;
+    if (_config.nGop <= 0)
+        _config.nGop = 1;
+    if (_config.nSlices <= 0)
+        _config.nSlices = 1;
+    if (FlvAacSampleRate(_config.nSampleRateIndex) == 0)
+        _config.nSampleRateIndex = 4;
+
+    _nLastTagSize = 0;
+    _nFlushed = 0;
+    _nRandom = 0x9E3779B97F4A7C15ULL ^ _config.nSeed;
+
+    BuildSps();
+}
+
+CFlvSynth::~CFlvSynth()
+{
+}
+
+/*
+High profile, 4:2:0, 帧场编码只用帧, 分辨率不是16的倍数时使用裁剪,
+VUI中带有timing_info, 帧率 = time_scale / (2 * num_units_in_tick)
+ */
+void CFlvSynth::BuildSps()
+{
+    int nMbWidth = (_config.nWidth + 15) / 16;
+    int nMbHeight = (_config.nHeight + 15) / 16;
+
+    vector<uint8_t> vRbsp;
+    CFlvBitWriter bits(vRbsp);
+    bits.PutBits(100, 8); // profile_idc: High
+    bits.PutBits(0, 8);   // constraint_set_flags
+    bits.PutBits(40, 8);  // level_idc: 4.0
+    bits.PutUE(0);    // seq_parameter_set_id
+    bits.PutUE(1);    // chroma_format_idc: 4:2:0
+    bits.PutUE(0);    // bit_depth_luma_minus8
+    bits.PutUE(0);    // bit_depth_chroma_minus8
+    bits.PutBits(0, 1);   // qpprime_y_zero_transform_bypass_flag
+    bits.PutBits(0, 1);   // seq_scaling_matrix_present_flag
+    bits.PutUE(0);    // log2_max_frame_num_minus4
+    bits.PutUE(2);    // pic_order_cnt_type
+    bits.PutUE(1);    // max_num_ref_frames
+    bits.PutBits(0, 1);   // gaps_in_frame_num_value_allowed_flag
+    bits.PutUE(nMbWidth - 1);
+    bits.PutUE(nMbHeight - 1);
+    bits.PutBits(1, 1); // frame_mbs_only_flag
+    bits.PutBits(1, 1); // direct_8x8_inference_flag
+
+    int nCropRight = (nMbWidth * 16 - _config.nWidth) / 2;
+    int nCropBottom = (nMbHeight * 16 - _config.nHeight) / 2;
+    bool bCrop = (nCropRight != 0 || nCropBottom != 0);
+    bits.PutBits(bCrop ? 1 : 0, 1);
+    if (bCrop)
+    {
+        bits.PutUE(0);
+        bits.PutUE(nCropRight);
+        bits.PutUE(0);
+        bits.PutUE(nCropBottom);
+    }
+
+    bits.PutBits(1, 1); // vui_parameters_present_flag
+    bits.PutBits(0, 1); // aspect_ratio_info_present_flag
+    bits.PutBits(0, 1); // overscan_info_present_flag
+    bits.PutBits(0, 1); // video_signal_type_present_flag
+    bits.PutBits(0, 1); // chroma_loc_info_present_flag
+    bits.PutBits(1, 1); // timing_info_present_flag
+    bits.PutBits(1, 32);               // num_units_in_tick
+    bits.PutBits(2 * _config.nFps, 32); // time_scale
+    bits.PutBits(1, 1);                // fixed_frame_rate_flag
+    bits.PutBits(0, 1); // nal_hrd_parameters_present_flag
+    bits.PutBits(0, 1); // vcl_hrd_parameters_present_flag
+    bits.PutBits(0, 1); // pic_struct_present_flag
+    bits.PutBits(0, 1); // bitstream_restriction_flag
+    bits.Trailing();
+
+    _vSps.clear();
+    _vSps.push_back(0x67);
+    FlvRbspEscape(&vRbsp[0], (int)vRbsp.size(), _vSps);
+
+    vRbsp.clear();
+    CFlvBitWriter pps(vRbsp);
+    pps.PutUE(0);   // pic_parameter_set_id
+    pps.PutUE(0);   // seq_parameter_set_id
+    pps.PutBits(0, 1);  // entropy_coding_mode_flag
+    pps.PutBits(0, 1);  // bottom_field_pic_order_in_frame_present_flag
+    pps.PutUE(0);   // num_slice_groups_minus1
+    pps.PutUE(0);   // num_ref_idx_l0_default_active_minus1
+    pps.PutUE(0);   // num_ref_idx_l1_default_active_minus1
+    pps.PutBits(0, 1);  // weighted_pred_flag
+    pps.PutBits(0, 2);  // weighted_bipred_idc
+    pps.PutSE(0);   // pic_init_qp_minus26
+    pps.PutSE(0);   // pic_init_qs_minus26
+    pps.PutSE(0);   // chroma_qp_index_offset
+    pps.PutBits(1, 1);  // deblocking_filter_control_present_flag
+    pps.PutBits(0, 1);  // constrained_intra_pred_flag
+    pps.PutBits(0, 1);  // redundant_pic_cnt_present_flag
+    pps.Trailing();
+
+    _vPps.clear();
+    _vPps.push_back(0x68);
+    FlvRbspEscape(&vRbsp[0], (int)vRbsp.size(), _vPps);
+}
+
+// xorshift64*
+uint32_t CFlvSynth::Random()
+{
+    _nRandom ^= _nRandom >> 12;
+    _nRandom ^= _nRandom << 25;
+    _nRandom ^= _nRandom >> 27;
+    return (uint32_t)((_nRandom * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// 随机的slice数据, 不会出现 00 00 00/01/02/03, 即不会模拟出起始码
+void CFlvSynth::FillPayload(uint8_t *p, int nLen)
+{
+    int i = 0;
+    for (; i + 4 <= nLen; i += 4)
+    {
+        uint32_t n = Random();
+        memcpy(p + i, &n, 4);
+    }
+    for (; i < nLen; i++)
+        p[i] = (uint8_t)Random();
+
+    for (i = 2; i < nLen; i++)
+    {
+        if (p[i - 2] == 0 && p[i - 1] == 0 && p[i] <= 3)
+            p[i] = 0x03;
+    }
+}
+
+int CFlvSynth::PutTag(vector<uint8_t> &vOut, int nType, uint32_t nTimeStamp, const uint8_t *pBody, int nBodySize)
+{
+    if (nBodySize > 0xffffff)
+        return 0; // DataSize只有24bit, 写入会截断长度, 之后的Tag全部错位
+    PutU32(vOut, _nLastTagSize);
+    PutU8(vOut, nType);
+    PutU24(vOut, nBodySize);
+    PutU24(vOut, nTimeStamp & 0xffffff);
+    PutU8(vOut, nTimeStamp >> 24);
+    PutU24(vOut, 0); // StreamID
+    vOut.insert(vOut.end(), pBody, pBody + nBodySize);
+    _nLastTagSize = 11 + nBodySize;
+    return 1;
+}
+
+int CFlvSynth::PutMetaData(vector<uint8_t> &vOut, double dDuration)
+{
+    vector<uint8_t> &v = _vBody;
+    v.clear();
+    PutU8(v, 0x02);
+    PutAmfString(v, "onMetaData");
+    PutU8(v, 0x08);
+    PutU32(v, _config.bAudio ? 14 : 8);
+    PutAmfNumber(v, "duration", dDuration);
+    PutAmfNumber(v, "width", _config.nWidth);
+    PutAmfNumber(v, "height", _config.nHeight);
+    PutAmfNumber(v, "videodatarate", _config.nVideoKbps);
+    PutAmfNumber(v, "framerate", _config.nFps);
+    PutAmfNumber(v, "videocodecid", 7);
+    if (_config.bAudio)
+    {
+        PutAmfNumber(v, "audiodatarate", _config.nAudioKbps);
+        PutAmfNumber(v, "audiosamplerate", FlvAacSampleRate(_config.nSampleRateIndex));
+        PutAmfNumber(v, "audiosamplesize", 16);
+        PutAmfBool(v, "stereo", _config.nChannels >= 2);
+        PutAmfNumber(v, "audiocodecid", 10);
+        PutAmfNumber(v, "filesize", 0);
+    }
+    PutAmfStringValue(v, "encoder", "FlvSynth");
+    PutAmfStringValue(v, "major_brand", "isom");
+    PutU24(v, 0x000009); // object end
+    return PutTag(vOut, 0x12, 0, &v[0], (int)v.size());
+}
+
+int CFlvSynth::PutVideoConfig(vector<uint8_t> &vOut)
+{
+    vector<uint8_t> &v = _vBody;
+    v.clear();
+    PutU8(v, 0x17); // keyframe + AVC
+    PutU8(v, 0);    // AVC sequence header
+    PutU24(v, 0);   // CompositionTime
+    PutU8(v, 1);    // configurationVersion
+    PutU8(v, _vSps[1]);
+    PutU8(v, _vSps[2]);
+    PutU8(v, _vSps[3]);
+    PutU8(v, 0xfc | (_config.nNaluLengthSize - 1));
+    PutU8(v, 0xe1); // 1个SPS
+    PutU16(v, (uint32_t)_vSps.size());
+    v.insert(v.end(), _vSps.begin(), _vSps.end());
+    PutU8(v, 1); // 1个PPS
+    PutU16(v, (uint32_t)_vPps.size());
+    v.insert(v.end(), _vPps.begin(), _vPps.end());
+    return PutTag(vOut, 0x09, 0, &v[0], (int)v.size());
+}
+
+/*
+一帧分成nSlices个NALU, 长度字段只有1/2字节时再按最大长度拆分
+ */
+int CFlvSynth::PutVideoFrame(vector<uint8_t> &vOut, uint32_t nTimeStamp, bool bKeyframe, int nFrameBytes)
+{
+    int nMaxNalu = (_config.nNaluLengthSize == 1) ? 0xff : (_config.nNaluLengthSize == 2) ? 0xffff : 0x7fffff;
+    int nSlice = (nFrameBytes + _config.nSlices - 1) / _config.nSlices;
+    if (nSlice < 2)
+        nSlice = 2;
+
+    vector<uint8_t> &v = _vBody;
+    v.clear();
+    PutU8(v, bKeyframe ? 0x17 : 0x27);
+    PutU8(v, 1);  // AVC NALU
+    PutU24(v, 0); // CompositionTime
+
+    int nLeft = nFrameBytes;
+    while (nLeft > 0)
+    {
+        int nNalu = nLeft < nSlice ? nLeft : nSlice;
+        if (nNalu > nMaxNalu)
+            nNalu = nMaxNalu;
+        if (nNalu < 2)
+            nNalu = 2;
+
+        for (int i = _config.nNaluLengthSize - 1; i >= 0; i--)
+            PutU8(v, nNalu >> (8 * i));
+        size_t nPos = v.size();
+        v.resize(nPos + nNalu);
+        v[nPos] = bKeyframe ? 0x65 : 0x41; // IDR slice / non-IDR slice
+        FillPayload(&v[nPos + 1], nNalu - 1);
+        nLeft -= nNalu;
+    }
+
+    return PutTag(vOut, 0x09, nTimeStamp, &v[0], (int)v.size());
+}
+
+/*
+PutVideoFrame()的NALU个数不超过 nSlices + nFrameBytes / nMaxNalu + 1, 每个NALU多一个长度字段, 所以
+5 + nFrameBytes + nNaluLengthSize * (nSlices + nFrameBytes / nMaxNalu + 1) <= 0xFFFFFF 时Tag Body一定放得下
+ */
+int CFlvSynth::MaxVideoFrameBytes()
+{
+    int64_t nMaxNalu = (_config.nNaluLengthSize == 1) ? 0xff : (_config.nNaluLengthSize == 2) ? 0xffff : 0x7fffff;
+    int64_t nPrefix = _config.nNaluLengthSize;
+    int64_t nLeft = 0xffffff - 5 - nPrefix * (_config.nSlices + 1);
+    return nLeft > 0 ? (int)(nLeft * nMaxNalu / (nMaxNalu + nPrefix)) : 0;
+}
+
+int CFlvSynth::PutAudioConfig(vector<uint8_t> &vOut)
+{
+    vector<uint8_t> v;
+    v.push_back(0xaf); // AAC, 44kHz, 16bit, stereo
+    v.push_back(0);    // AAC sequence header
+
+    // AudioSpecificConfig
+    CFlvBitWriter bits(v);
+    bits.PutBits(2, 5); // audioObjectType: AAC LC
+    bits.PutBits(_config.nSampleRateIndex, 4);
+    bits.PutBits(_config.nChannels, 4);
+    bits.PutBits(0, 3); // frameLengthFlag, dependsOnCoreCoder, extensionFlag
+    return PutTag(vOut, 0x08, 0, &v[0], (int)v.size());
+}
+
+int CFlvSynth::PutAudioFrame(vector<uint8_t> &vOut, uint32_t nTimeStamp, int nFrameBytes)
+{
+    vector<uint8_t> &v = _vBody;
+    v.resize(2 + nFrameBytes);
+    v[0] = 0xaf;
+    v[1] = 1; // AAC raw
+    FillPayload(&v[2], nFrameBytes);
+    return PutTag(vOut, 0x08, nTimeStamp, &v[0], (int)v.size());
+}
+
+int CFlvSynth::Flush(FILE *fp, vector<uint8_t> &vOut, bool bForce)
+{
+    if (fp == NULL || vOut.empty() || (!bForce && vOut.size() < (4 << 20)))
+        return 1;
+
+    if (fwrite(&vOut[0], 1, vOut.size(), fp) != vOut.size())
+        return 0;
+    _nFlushed += vOut.size();
+    vOut.clear();
+    return 1;
+}
+
+/*
+1. FLV头, onMetaData, AVC/AAC sequence header
+2. 按时间顺序交替写入视频帧和音频帧, 关键帧是普通帧的4倍大小, 平均码率等于nVideoKbps
+3. 达到nTargetBytes之后结束
+ */
+int CFlvSynth::Run(FILE *fp, vector<uint8_t> &vOut, FlvSynthResult *pResult)
+{
+    FlvSynthResult result;
+    _nLastTagSize = 0;
+    _nFlushed = 0;
+    _nRandom = 0x9E3779B97F4A7C15ULL ^ _config.nSeed;
+
+    const uint8_t szFlvHeader[9] = {'F', 'L', 'V', 1, (uint8_t)(_config.bAudio ? 0x05 : 0x01), 0, 0, 0, 9};
+    vOut.insert(vOut.end(), szFlvHeader, szFlvHeader + 9);
+
+    // 时长按目标大小估算
+    double dBytesPerSecond = (_config.nVideoKbps + (_config.bAudio ? _config.nAudioKbps : 0)) * 1000.0 / 8;
+    if (!PutMetaData(vOut, dBytesPerSecond > 0 ? _config.nTargetBytes / dBytesPerSecond : 0) || !PutVideoConfig(vOut))
+        return 0;
+    result.nMetaTags = 1;
+    result.nVideoTags = 1;
+    if (_config.bAudio)
+    {
+        if (!PutAudioConfig(vOut))
+            return 0;
+        result.nAudioTags = 1;
+    }
+
+    int nSampleRate = FlvAacSampleRate(_config.nSampleRateIndex);
+    int nAudioFrameBytes = (int)((int64_t)_config.nAudioKbps * 1000 / 8 * 1024 / nSampleRate);
+    if (nAudioFrameBytes < 4)
+        nAudioFrameBytes = 4;
+    if (nAudioFrameBytes > 0xffffff - 2)
+        nAudioFrameBytes = 0xffffff - 2;
+    // 码率很高而帧率很低时一帧可能超过一个Tag的上限, 截断到上限(实际码率会低于nVideoKbps)
+    int nMaxFrameBytes = MaxVideoFrameBytes();
+
+    // 一个GOP的总大小 = (nGop - 1 + 4) * P帧大小
+    double dGopBytes = (double)_config.nVideoKbps * 1000 / 8 * _config.nGop / _config.nFps;
+    int nPBytes = (int)(dGopBytes / (_config.nGop + 3));
+    if (nPBytes < 16)
+        nPBytes = 16;
+    if (nPBytes > nMaxFrameBytes)
+        nPBytes = nMaxFrameBytes;
+
+    int64_t nFrame = 0, nAudioFrame = 0;
+    uint32_t nTimeStamp = 0;
+    while (_nFlushed + (int64_t)vOut.size() < _config.nTargetBytes)
+    {
+        nTimeStamp = (uint32_t)(nFrame * 1000 / _config.nFps);
+
+        // 先写时间戳不晚于当前视频帧的音频帧
+        while (_config.bAudio && nAudioFrame * 1024 * 1000 / nSampleRate <= nTimeStamp)
+        {
+            if (!PutAudioFrame(vOut, (uint32_t)(nAudioFrame * 1024 * 1000 / nSampleRate), nAudioFrameBytes))
+                return 0;
+            nAudioFrame++;
+            result.nAudioTags++;
+        }
+
+        bool bKeyframe = (nFrame % _config.nGop) == 0;
+        // 帧大小在平均值上下随机浮动25%
+        int nBytes = bKeyframe ? nPBytes * 4 : nPBytes;
+        nBytes += (int)(Random() % (nBytes / 2 + 1)) - nBytes / 4;
+        if (nBytes > nMaxFrameBytes)
+            nBytes = nMaxFrameBytes;
+        if (!PutVideoFrame(vOut, nTimeStamp, bKeyframe, nBytes))
+            return 0;
+        nFrame++;
+        result.nVideoTags++;
+
+        if (!Flush(fp, vOut, false))
+            return 0;
+    }
+
+    PutU32(vOut, _nLastTagSize);
+    if (!Flush(fp, vOut, true))
+        return 0;
+
+    result.nBytes = _nFlushed + (fp == NULL ? (int64_t)vOut.size() : 0);
+    result.nDuration = nTimeStamp;
+    if (pResult != NULL)
+        *pResult = result;
+    return 1;
+}
+
+int CFlvSynth::Generate(const char *path, FlvSynthResult *pResult)
+{
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return 0;
+
+    vector<uint8_t> vOut;
+    int nResult = Run(fp, vOut, pResult);
+    if (fclose(fp) != 0)
+        nResult = 0;
+    return nResult;
+}
+
+int CFlvSynth::Generate(vector<uint8_t> &vOut, FlvSynthResult *pResult)
+{
+    vOut.clear();
+    return Run(NULL, vOut, pResult);
+}
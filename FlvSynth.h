@@ -0,0 +1,81 @@
+﻿#ifndef FLVSYNTH_H
+#define FLVSYNTH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// 合成FLV文件的参数, 相同的参数(包括nSeed)总是生成完全相同的文件
+struct FlvSynthConfig
+{
+    int nWidth, nHeight;   // 分辨率, 写入SPS和onMetaData
+    int nFps;              // 帧率
+    int nVideoKbps;        // 视频码率
+    int nGop;              // 关键帧间隔(帧)
+    int nSlices;           // 每帧的slice(NALU)个数
+    int nNaluLengthSize;   // NALU长度字段的字节数, 1~4. 1和2字节时NALU会被拆分以满足长度限制
+    bool bAudio;           // 是否包含AAC音频
+    int nAudioKbps;        // 音频码率
+    int nSampleRateIndex;  // AAC采样率索引, 4: 44100
+    int nChannels;         // 声道数
+    int64_t nTargetBytes;  // 生成的文件大小(达到该大小后结束, 实际会略大)
+    uint32_t nSeed;        // 随机数种子
+
+    FlvSynthConfig()
+        : nWidth(1280), nHeight(720), nFps(30), nVideoKbps(4000), nGop(60), nSlices(1), nNaluLengthSize(4),
+          bAudio(true), nAudioKbps(128), nSampleRateIndex(4), nChannels(2), nTargetBytes(64 << 20), nSeed(1)
+    {
+    }
+};
+
+// 生成结果的统计
+struct FlvSynthResult
+{
+    int64_t nBytes;
+    int nVideoTags, nAudioTags, nMetaTags;
+    uint32_t nDuration; // ms
+
+    FlvSynthResult() : nBytes(0), nVideoTags(0), nAudioTags(0), nMetaTags(0), nDuration(0) {}
+};
+
+// 确定性的FLV生成器: onMetaData + AVC/AAC sequence header + 交替的视频/音频Tag
+class CFlvSynth
+{
+public:
+    CFlvSynth(const FlvSynthConfig &config);
+    virtual ~CFlvSynth();
+
+    // 写到文件, 成功返回1
+    int Generate(const char *path, FlvSynthResult *pResult = NULL);
+    // 写到内存
+    int Generate(std::vector<uint8_t> &vOut, FlvSynthResult *pResult = NULL);
+
+    // 按参数生成的SPS/PPS(不含起始码)
+    const std::vector<uint8_t> &Sps() { return _vSps; }
+    const std::vector<uint8_t> &Pps() { return _vPps; }
+
+private:
+    int Run(FILE *fp, std::vector<uint8_t> &vOut, FlvSynthResult *pResult);
+    int Flush(FILE *fp, std::vector<uint8_t> &vOut, bool bForce);
+
+    void BuildSps();
+    // 以下写Tag的函数成功返回1, Tag Body超过DataSize的24bit时返回0(不写入)
+    int PutTag(std::vector<uint8_t> &vOut, int nType, uint32_t nTimeStamp, const uint8_t *pBody, int nBodySize);
+    int PutMetaData(std::vector<uint8_t> &vOut, double dDuration);
+    int PutVideoConfig(std::vector<uint8_t> &vOut);
+    int PutVideoFrame(std::vector<uint8_t> &vOut, uint32_t nTimeStamp, bool bKeyframe, int nFrameBytes);
+    int PutAudioConfig(std::vector<uint8_t> &vOut);
+    int PutAudioFrame(std::vector<uint8_t> &vOut, uint32_t nTimeStamp, int nFrameBytes);
+    int MaxVideoFrameBytes(); // Tag Body不超过0xFFFFFF的最大帧大小
+    void FillPayload(uint8_t *p, int nLen);
+    uint32_t Random();
+
+    FlvSynthConfig _config;
+    std::vector<uint8_t> _vSps, _vPps;
+    std::vector<uint8_t> _vBody; // 组装Tag Body的临时缓冲区
+    uint32_t _nLastTagSize;
+    int64_t _nFlushed; // 已经写入文件的字节数
+    uint64_t _nRandom;
+};
+
+#endif // FLVSYNTH_H
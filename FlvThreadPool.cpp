@@ -0,0 +1,98 @@
+﻿#include "FlvThreadPool.h"
+
+using namespace std;
+
+CFlvThreadPool::CFlvThreadPool(int nThreads)
+{
+    _pFn = NULL;
+    _nTasks = 0;
+    _nNext = 0;
+    _nBusy = 0;
+    _nRound = 0;
+    _bStop = false;
+
+    // 调用者线程也参与执行, 所以只需要创建 nThreads-1 个线程
+    for (int i = 1; i < nThreads; i++)
+        _vThread.push_back(thread(&CFlvThreadPool::Worker, this, i));
+}
+
+CFlvThreadPool::~CFlvThreadPool()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _bStop = true;
+    }
+    _cvStart.notify_all();
+
+    for (size_t i = 0; i < _vThread.size(); i++)
+        _vThread[i].join();
+}
+
+int CFlvThreadPool::HardwareThreads()
+{
+    int n = (int)thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+void CFlvThreadPool::Run(int nTasks, const function<void(int, int)> &fn)
+{
+    if (nTasks <= 0)
+        return;
+
+    // 只有一个任务或者没有工作线程时直接执行, 不需要唤醒其他线程
+    if (nTasks == 1 || _vThread.empty())
+    {
+        for (int i = 0; i < nTasks; i++)
+            fn(i, 0);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _pFn = &fn;
+        _nTasks = nTasks;
+        _nNext = 0;
+        _nBusy = (int)_vThread.size();
+        _nRound++;
+    }
+    _cvStart.notify_all();
+
+    Work(0);
+
+    unique_lock<mutex> lock(_mutex);
+    _cvDone.wait(lock, [this] { return _nBusy == 0; });
+    _pFn = NULL;
+}
+
+void CFlvThreadPool::Worker(int nThread)
+{
+    unsigned nRound = 0;
+    while (1)
+    {
+        {
+            unique_lock<mutex> lock(_mutex);
+            _cvStart.wait(lock, [&] { return _bStop || _nRound != nRound; });
+            if (_bStop)
+                return;
+            nRound = _nRound;
+        }
+
+        Work(nThread);
+
+        lock_guard<mutex> lock(_mutex);
+        if (--_nBusy == 0)
+            _cvDone.notify_one();
+    }
+}
+
+// 每次取一个任务, 直到所有任务都被取走
+void CFlvThreadPool::Work(int nThread)
+{
+    while (1)
+    {
+        int nTask = _nNext.fetch_add(1);
+        if (nTask >= _nTasks)
+            break;
+        (*_pFn)(nTask, nThread);
+    }
+}
@@ -0,0 +1,46 @@
+﻿#ifndef FLVTHREADPOOL_H
+#define FLVTHREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// 固定数量的工作线程, 以 parallel-for 的方式执行任务:
+// Run(nTasks, fn) 把 0..nTasks-1 分给所有线程(包括调用者线程)执行, 全部完成后返回.
+class CFlvThreadPool
+{
+public:
+    CFlvThreadPool(int nThreads);
+    virtual ~CFlvThreadPool();
+
+    // fn(nTask, nThread), nThread 的范围是 0..Threads()-1, 可以用来索引每个线程自己的数据
+    void Run(int nTasks, const std::function<void(int, int)> &fn);
+    int Threads() { return (int)_vThread.size() + 1; }
+
+    // 硬件线程数, 获取失败时返回1
+    static int HardwareThreads();
+
+private:
+    CFlvThreadPool(const CFlvThreadPool &);
+    CFlvThreadPool &operator=(const CFlvThreadPool &);
+
+    void Worker(int nThread);
+    void Work(int nThread);
+
+    std::vector<std::thread> _vThread;
+    std::mutex _mutex;
+    std::condition_variable _cvStart;
+    std::condition_variable _cvDone;
+
+    const std::function<void(int, int)> *_pFn;
+    int _nTasks;
+    std::atomic<int> _nNext; // 下一个要执行的任务
+    int _nBusy;              // 还没有完成本轮任务的工作线程数
+    unsigned _nRound;        // 每次Run()加1, 工作线程据此判断是否有新任务
+    bool _bStop;
+};
+
+#endif // FLVTHREADPOOL_H
@@ -0,0 +1,339 @@
+﻿#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+#include "FlvWriter.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+static const size_t nMinRefSize = 256;   // 小于该大小的数据复制比单独占一个iovec更划算
+static const size_t nStageAlign = 4096;
+
+CFlvWriter::CFlvWriter(size_t nStageSize)
+{
+    _fd = -1;
+#ifdef _WIN32
+    _fp = NULL;
+#endif
+    _nStageSize = nStageSize;
+    _nStageUsed = 0;
+#ifndef _WIN32
+    void *p = NULL;
+    _pStage = (posix_memalign(&p, nStageAlign, nStageSize) == 0) ? (uint8_t *)p : NULL;
+#else
+    _pStage = (uint8_t *)malloc(nStageSize);
+#endif
+    _bAllowRef = true;
+    _bError = false;
+    _pQueue = NULL;
+    _nBytesWritten = 0;
+    _nSyscalls = 0;
+    _vIov.reserve(IOV_MAX);
+}
+
+CFlvWriter::~CFlvWriter()
+{
+    Close();
+    if (_pQueue != NULL)
+        _pQueue->Submit(this, _pStage, 0); // 暂存区属于队列, 通过写线程归还
+    else
+        free(_pStage);
+}
+
+int CFlvWriter::Open(const char *path)
+{
+    Close();
+    _bError = false;
+#ifndef _WIN32
+    _fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    return _fd >= 0 && _pStage != NULL ? 1 : 0;
+#else
+    _fp = fopen(path, "wb");
+    _fd = (_fp != NULL) ? 0 : -1;
+    return _fp != NULL && _pStage != NULL ? 1 : 0;
+#endif
+}
+
+bool CFlvWriter::IsOpen()
+{
+    return _fd >= 0;
+}
+
+int CFlvWriter::Close()
+{
+    if (_fd < 0)
+        return 1;
+
+    Flush();
+    if (_pQueue != NULL)
+        _pQueue->Drain();
+#ifndef _WIN32
+    if (close(_fd) != 0)
+        _bError = true;
+#else
+    if (fclose((FILE *)_fp) != 0)
+        _bError = true;
+    _fp = NULL;
+#endif
+    _fd = -1;
+    return _bError ? 0 : 1;
+}
+
+// 与上一个iovec相连时合并(连续写入暂存区的数据)
+void CFlvWriter::AddIov(const void *p, size_t nLen)
+{
+    if (!_vIov.empty())
+    {
+        struct iovec &last = _vIov.back();
+        if ((uint8_t *)last.iov_base + last.iov_len == (const uint8_t *)p)
+        {
+            last.iov_len += nLen;
+            return;
+        }
+    }
+
+    struct iovec iov;
+    iov.iov_base = (void *)p;
+    iov.iov_len = nLen;
+    _vIov.push_back(iov);
+}
+
+int CFlvWriter::Write(const void *p, size_t nLen)
+{
+    if (_fd < 0 || nLen == 0)
+        return _fd >= 0 ? 1 : 0;
+    if (_pQueue != NULL)
+        return WriteQueued(p, nLen);
+
+    // 大块数据: 和之前的数据一起立即写出, 不经过暂存区
+    if (nLen >= _nStageSize / 4)
+    {
+        AddIov(p, nLen);
+        return Flush();
+    }
+
+    if (_nStageUsed + nLen > _nStageSize && !Flush())
+        return 0;
+
+    uint8_t *pDst = _pStage + _nStageUsed;
+    memcpy(pDst, p, nLen);
+    _nStageUsed += nLen;
+    AddIov(pDst, nLen);
+
+    if (_vIov.size() >= IOV_MAX)
+        return Flush();
+    return 1;
+}
+
+int CFlvWriter::WriteRef(const void *p, size_t nLen)
+{
+    if (!_bAllowRef || _pQueue != NULL || nLen < nMinRefSize)
+        return Write(p, nLen);
+    if (_fd < 0)
+        return 0;
+
+    AddIov(p, nLen);
+    if (_vIov.size() >= IOV_MAX)
+        return Flush();
+    return 1;
+}
+
+int CFlvWriter::Flush()
+{
+    if (_pQueue != NULL)
+    {
+        // 整块交给写线程, 换一块空闲的暂存区
+        if (_nStageUsed > 0)
+        {
+            _pQueue->Submit(this, _pStage, _nStageUsed);
+            _pStage = _pQueue->GetBuffer();
+            _nStageUsed = 0;
+        }
+        return _bError ? 0 : 1;
+    }
+
+    int nResult = 1;
+    size_t nDone = 0;
+    while (nDone < _vIov.size())
+    {
+        int nCount = (int)(_vIov.size() - nDone);
+        if (nCount > IOV_MAX)
+            nCount = IOV_MAX;
+        if (!WriteIov(&_vIov[nDone], nCount))
+        {
+            nResult = 0;
+            break;
+        }
+        nDone += nCount;
+    }
+
+    _vIov.clear();
+    _nStageUsed = 0;
+    return nResult;
+}
+
+// 写出nCount个iovec, 处理部分写入和EINTR
+int CFlvWriter::WriteIov(struct iovec *pIov, int nCount)
+{
+    if (_bError)
+        return 0;
+
+    while (nCount > 0)
+    {
+#ifndef _WIN32
+        ssize_t n = writev(_fd, pIov, nCount);
+        _nSyscalls++;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            _bError = true;
+            return 0;
+        }
+#else
+        size_t n = fwrite(pIov->iov_base, 1, pIov->iov_len, (FILE *)_fp);
+        _nSyscalls++;
+        if (n != pIov->iov_len)
+        {
+            _bError = true;
+            return 0;
+        }
+#endif
+        _nBytesWritten += n;
+
+        // 跳过已经写完的iovec
+        size_t nLeft = (size_t)n;
+        while (nCount > 0 && nLeft >= pIov->iov_len)
+        {
+            nLeft -= pIov->iov_len;
+            pIov++;
+            nCount--;
+        }
+        if (nCount > 0 && nLeft > 0)
+        {
+            pIov->iov_base = (uint8_t *)pIov->iov_base + nLeft;
+            pIov->iov_len -= nLeft;
+        }
+    }
+
+    return 1;
+}
+
+void CFlvWriter::SetQueue(CFlvWriteQueue *pQueue)
+{
+    if (_pQueue != NULL || pQueue == NULL)
+        return;
+
+    Flush();
+    free(_pStage);
+    _pQueue = pQueue;
+    _pStage = pQueue->GetBuffer();
+    _nStageSize = pQueue->BufferSize();
+}
+
+// 异步写出时所有数据都复制到暂存区, 写满一块就提交
+int CFlvWriter::WriteQueued(const void *p, size_t nLen)
+{
+    const uint8_t *pSrc = (const uint8_t *)p;
+    while (nLen > 0)
+    {
+        size_t n = _nStageSize - _nStageUsed;
+        if (n > nLen)
+            n = nLen;
+        memcpy(_pStage + _nStageUsed, pSrc, n);
+        _nStageUsed += n;
+        pSrc += n;
+        nLen -= n;
+
+        if (_nStageUsed == _nStageSize && !Flush())
+            return 0;
+    }
+    return 1;
+}
+
+// ---------------------------------- 写线程 -------------------------------------
+
+CFlvWriteQueue::CFlvWriteQueue(int nBuffers, size_t nBufferSize) : _qBlock(nBuffers + 1), _qFree(nBuffers)
+{
+    _nBufferSize = nBufferSize;
+    _nSubmitted = 0;
+    _nDone = 0;
+    for (int i = 0; i < nBuffers; i++)
+    {
+#ifndef _WIN32
+        void *p = NULL;
+        if (posix_memalign(&p, nStageAlign, nBufferSize) != 0)
+            p = NULL;
+#else
+        void *p = malloc(nBufferSize);
+#endif
+        if (p == NULL)
+            continue;
+        _vBuffer.push_back((uint8_t *)p);
+        _qFree.Push((uint8_t *)p);
+    }
+
+    _thread = std::thread(&CFlvWriteQueue::Run, this);
+}
+
+CFlvWriteQueue::~CFlvWriteQueue()
+{
+    Submit(NULL, NULL, 0);
+    _thread.join();
+
+    for (size_t i = 0; i < _vBuffer.size(); i++)
+        free(_vBuffer[i]);
+}
+
+uint8_t *CFlvWriteQueue::GetBuffer()
+{
+    uint8_t *p;
+    _qFree.Pop(p);
+    return p;
+}
+
+void CFlvWriteQueue::Submit(CFlvWriter *pWriter, uint8_t *pData, size_t nLen)
+{
+    Block block;
+    block.pWriter = pWriter;
+    block.pData = pData;
+    block.nLen = nLen;
+    _nSubmitted++;
+    _qBlock.Push(block);
+}
+
+void CFlvWriteQueue::Drain()
+{
+    for (int i = 0; _nDone.load(std::memory_order_acquire) != _nSubmitted; i++)
+        CFlvSpscQueue<Block>::Backoff(i);
+}
+
+void CFlvWriteQueue::Run()
+{
+    while (1)
+    {
+        Block block;
+        _qBlock.Pop(block);
+        if (block.pWriter == NULL)
+            break;
+
+        if (block.nLen > 0)
+        {
+            struct iovec iov;
+            iov.iov_base = block.pData;
+            iov.iov_len = block.nLen;
+            block.pWriter->WriteIov(&iov, 1);
+        }
+        _qFree.Push(block.pData);
+        _nDone.fetch_add(1, std::memory_order_release);
+    }
+}
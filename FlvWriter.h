@@ -0,0 +1,116 @@
+﻿#ifndef FLVWRITER_H
+#define FLVWRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include "FlvQueue.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#else
+struct iovec
+{
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
+class CFlvWriteQueue;
+
+// 输出文件的批量写入: 小块数据复制到对齐的暂存区, 大块数据只记录指针,
+// 攒够一批之后用一次writev写出, 减少系统调用和iostream的开销.
+class CFlvWriter
+{
+public:
+    CFlvWriter(size_t nStageSize = 1024 * 1024);
+    virtual ~CFlvWriter();
+
+    int Open(const char *path); // 成功返回1
+    bool IsOpen();
+    int Close(); // 写出剩余数据并关闭, 成功返回1
+
+    // 数据在返回后就可以释放: 小块复制到暂存区, 大块直接写出
+    int Write(const void *p, size_t nLen);
+    // 数据在下一次Flush()/Close()之前保持有效, 只记录指针(SetAllowRef(false)时与Write()相同)
+    int WriteRef(const void *p, size_t nLen);
+    int Flush();
+
+    // 数据的生命周期不能保证时(例如流式输出, Tag在回调之后就释放)需要关闭
+    void SetAllowRef(bool bAllowRef) { _bAllowRef = bAllowRef; }
+
+    // 异步写出: 在Open()之后设置, 之后所有数据都复制到pQueue分配的暂存区, 写满或者Flush()时整块交给写线程.
+    // Flush()不再等待磁盘, Close()等待写线程写完. pQueue必须在CFlvWriter之后释放
+    void SetQueue(CFlvWriteQueue *pQueue);
+
+    int64_t BytesWritten() { return _nBytesWritten; }
+    int64_t Syscalls() { return _nSyscalls; }
+
+private:
+    CFlvWriter(const CFlvWriter &);
+    CFlvWriter &operator=(const CFlvWriter &);
+
+    void AddIov(const void *p, size_t nLen);
+    int WriteIov(struct iovec *pIov, int nCount);
+    int WriteQueued(const void *p, size_t nLen);
+
+    friend class CFlvWriteQueue;
+
+    int _fd;
+#ifdef _WIN32
+    void *_fp;
+#endif
+    uint8_t *_pStage;    // 暂存区
+    size_t _nStageSize;
+    size_t _nStageUsed;
+    std::vector<struct iovec> _vIov; // 等待写出的数据
+    bool _bAllowRef;
+    std::atomic<bool> _bError; // 异步写出时由写线程设置
+    CFlvWriteQueue *_pQueue;
+
+    int64_t _nBytesWritten;
+    int64_t _nSyscalls;
+};
+
+/*
+写线程: 设置了队列的CFlvWriter把写满的暂存区交给写线程, 由写线程按提交的顺序写到各自的文件.
+暂存区由队列统一分配, 没有空闲的暂存区时提交者等待(背压). 一个队列只能由一个线程提交,
+同时使用的CFlvWriter必须少于nBuffers个.
+ */
+class CFlvWriteQueue
+{
+public:
+    CFlvWriteQueue(int nBuffers = 8, size_t nBufferSize = 1024 * 1024);
+    virtual ~CFlvWriteQueue(); // 写完已经提交的数据之后结束写线程
+
+private:
+    CFlvWriteQueue(const CFlvWriteQueue &);
+    CFlvWriteQueue &operator=(const CFlvWriteQueue &);
+
+    friend class CFlvWriter;
+
+    struct Block
+    {
+        CFlvWriter *pWriter; // 为NULL表示结束写线程
+        uint8_t *pData;
+        size_t nLen; // 为0时只归还暂存区
+    };
+
+    uint8_t *GetBuffer();
+    void Submit(CFlvWriter *pWriter, uint8_t *pData, size_t nLen);
+    void Drain(); // 等待已经提交的数据全部写完
+    size_t BufferSize() { return _nBufferSize; }
+    void Run();
+
+    size_t _nBufferSize;
+    std::vector<uint8_t *> _vBuffer;
+    CFlvSpscQueue<Block> _qBlock;   // 提交者 -> 写线程
+    CFlvSpscQueue<uint8_t *> _qFree; // 写线程 -> 提交者
+    int64_t _nSubmitted;             // 只由提交者访问
+    std::atomic<int64_t> _nDone;
+    std::thread _thread;
+};
+
+#endif // FLVWRITER_H
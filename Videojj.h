@@ -1,29 +1,21 @@
 ﻿#ifndef VIDEOJJ_H
 #define VIDEOJJ_H
 
-#include <vector>
 #include <cstdint>
-class CFlvParser;
+#include "FlvSei.h"
 
-typedef struct VjjSEI_s
+// Videojj的SEI在CFlvSeiEngine中的种类编号
+enum
 {
-	char *szUD;
-	int nLen;
-	int nTimeStamp; // ms
-} VjjSEI;
+	VJJ_SEI_KIND = 0
+};
 
-class CVideojj
+// 预先注册了Videojj UUID的SEI引擎, 解析器默认使用. 其他种类的SEI可以继续用RegisterUuid()注册
+class CVideojj : public CFlvSeiEngine
 {
 public:
 	CVideojj();
 	virtual ~CVideojj();
-
-	int Process(uint8_t *pNalu, int nNaluLen, int nTimeStamp);
-
-private:
-	friend class CFlvParser;
-
-	std::vector<VjjSEI> _vVjjSEI;
 };
 
 #endif // VIDEOJJ_H
@@ -2,80 +2,193 @@
 #include <string.h>
 #include <iostream>
 #include <fstream>
-#include "FlvParser.h"
+#include "FlvBatch.h"
+#include "FlvThreadPool.h"
+#include "FlvProbe.h"
+#include "FlvMetrics.h"
+#include "FlvClip.h"
+#include "FlvDumpSink.h"
 using namespace std;
 
-void Process(fstream &fin, const char *filename);
-
-/* 
-1. 读取输入文件(flv类型的视频文件)
-2. 调用Process进行处理
-3. 退出
- */
-int main(int argc, char *argv[])
+static void Usage()
 {
-    cout << "Hi, this is FLV parser test program!\n";
-    if (argc != 3)
-    {
-        cout << "FlvParser.exe [input flv] [output flv]" << endl;
-        return 0;
-    }
-
-    fstream fin;
-    fin.open(argv[1], ios_base::in | ios_base::binary);
-    if (!fin)
-        return 0;
-
-    Process(fin, argv[2]);
-
-    fin.close();
+    cout << "FlvParser.exe [-m|-P] [-r] [-f] [-t threads] [-M json|prom] [-B MB] [-i index] [-s ms] [input flv|-] [output flv]" << endl;
+    cout << "FlvParser.exe -l [-r] [-i index] [unix socket path|-] [output flv]" << endl;
+    cout << "FlvParser.exe [-m] [-r] [-f] [-j threads] [-M json|prom] -b [list file|directory] [output dir]" << endl;
+    cout << "FlvParser.exe -p [-n bytes] [input flv|-]..." << endl;
+    cout << "FlvParser.exe -c start_ms end_ms [-r] [-f] [input flv] [output flv]" << endl;
+    cout << "  -M  print performance counters after parsing, as json or prom (Prometheus text format)" << endl;
+    cout << "  -m  keep all tags in memory and dump after parsing (default: streaming)" << endl;
+    cout << "  -P  pipelined streaming: read, parse and write in three threads connected by bounded queues" << endl;
+    cout << "  -r  remux only, write the FLV output without the .264/.aac files" << endl;
+    cout << "  -f  also write fragmented MP4 (audio and video in one file): parser.mp4, or <name>.mp4 in batch mode" << endl;
+    cout << "  -b  batch mode, process every file in the list (one path per line) or every .flv in the directory" << endl;
+    cout << "  -j  number of worker threads in batch mode (default: number of CPUs)" << endl;
+    cout << "  -t  number of threads decoding tag bodies of a single file (default: 1)" << endl;
+    cout << "  -B  largest input buffer in MB when a tag does not fit in the 2MB read buffer (default: 64)" << endl;
+    cout << "  -i  without -s: write the keyframe index to this file (no index is written without -i)" << endl;
+    cout << "      with -s: read the index from this file (default: [input flv].idx)" << endl;
+    cout << "  -s  start from the last keyframe at or before this timestamp, using the index" << endl;
+    cout << "  -l  live mode, parse each chunk as soon as it is read from stdin or from one connection on the unix socket" << endl;
+    cout << "  -p  probe mode, read only the header, onMetaData and codec configs and print one JSON line per input" << endl;
+    cout << "  -n  read at most this many bytes per input in probe mode (default: 1048576)" << endl;
+    cout << "  -c  extract the clip between two timestamps, jumping to the keyframe through the onMetaData keyframes table" << endl;
+}
 
-    return 1;
+static void PrintMetrics(CFlvMetrics *pMetrics, const char *format)
+{
+    if (pMetrics == NULL)
+        return;
+    if (strcmp(format, "json") == 0)
+        cout << pMetrics->ToJson() << endl;
+    else
+        cout << pMetrics->ToPrometheus();
 }
 
 /* 
-1. 读取文件
-2. 开始解析
-3. 打印解析信息
-4. 把解析之后的数据输出到另外一个文件中
+1. 解析命令行参数
+2. 探测模式: 每个输入只读取开头, 输出一行JSON
+3. 单文件模式: 输出到指定的FLV文件以及当前目录下的parser.264和parser.aac(-r时不输出), -f时还有parser.mp4
+4. 批量模式: 多线程处理所有文件, 每个文件输出到输出目录下同名的.flv/.264/.aac
+5. 退出
  */
-void Process(fstream &fin, const char *filename)
+int main(int argc, char *argv[])
 {
-    CFlvParser parser;
-
-    int nBufSize = 2 * 1024 * 1024; // 2MB
-    int nFlvPos = 0;
-    uint8_t *pBuf, *pBak;
-    pBuf = new uint8_t[nBufSize];
-    pBak = new uint8_t[nBufSize];
+    bool bInMemory = false;
+    bool bBatch = false;
+    bool bRemuxOnly = false;
+    bool bProbe = false;
+    bool bLive = false;
+    bool bPipeline = false;
+    bool bMp4 = false;
+    int64_t nProbeBytes = 1024 * 1024;
+    int nThreads = CFlvThreadPool::HardwareThreads();
+    int nDecodeThreads = 1;
+    const char *indexPath = NULL;
+    int64_t nSeekTime = -1;
+    const char *metricsFormat = NULL;
+    int64_t nClipStart = -1, nClipEnd = -1;
+    int64_t nMaxBufferMB = 64;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++)
+    {
+        if (strcmp(argv[i], "-m") == 0)
+            bInMemory = true;
+        else if (strcmp(argv[i], "-P") == 0)
+            bPipeline = true;
+        else if (strcmp(argv[i], "-f") == 0)
+            bMp4 = true;
+        else if (strcmp(argv[i], "-r") == 0)
+            bRemuxOnly = true;
+        else if (strcmp(argv[i], "-l") == 0)
+            bLive = true;
+        else if (strcmp(argv[i], "-p") == 0)
+            bProbe = true;
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0)
+            nProbeBytes = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0)
+            bBatch = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            nThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            nDecodeThreads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0)
+            nMaxBufferMB = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            indexPath = argv[++i];
+        else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc &&
+                 (strcmp(argv[i + 1], "json") == 0 || strcmp(argv[i + 1], "prom") == 0))
+            metricsFormat = argv[++i];
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc && atoll(argv[i + 1]) >= 0)
+            nSeekTime = atoll(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 2 < argc && atoll(argv[i + 1]) >= 0 &&
+                 atoll(argv[i + 2]) >= atoll(argv[i + 1]))
+        {
+            nClipStart = atoll(argv[++i]);
+            nClipEnd = atoll(argv[++i]);
+        }
+        else
+        {
+            Usage();
+            return 0;
+        }
+    }
 
-    while (1)
+    // 探测模式的输出只有JSON, 不打印其他信息
+    if (bProbe && i < argc)
     {
-        int nReadNum = 0;
-        int nUsedLen = 0;
-        fin.read((char *)pBuf + nFlvPos, nBufSize - nFlvPos);
-        nReadNum = fin.gcount();
-        if (nReadNum == 0)
-            break;
+        int nResult = 1;
+        for (; i < argc; i++)
+        {
+            FlvProbeInfo info;
+            if (!ProbeFlv(argv[i], info, nProbeBytes))
+                nResult = 0;
+            cout << ProbeToJson(argv[i], info) << endl;
+        }
+        return nResult;
+    }
 
-        nFlvPos += nReadNum;
+    cout << "Hi, this is FLV parser test program!\n";
+    CFlvMetrics metrics;
+    CFlvMetrics *pMetrics = metricsFormat != NULL ? &metrics : NULL;
+    if (argc - i != 2)
+    {
+        Usage();
+        return 0;
+    }
 
-        parser.Parse(pBuf, nFlvPos, nUsedLen);
-        if (nFlvPos != nUsedLen)
+    if (bBatch)
+    {
+        vector<string> vFiles;
+        if (!CollectFlvInputs(argv[i], vFiles))
         {
-            memcpy(pBak, pBuf + nUsedLen, nFlvPos - nUsedLen);
-            memcpy(pBuf, pBak, nFlvPos - nUsedLen);
+            cout << "can not read " << argv[i] << endl;
+            return 0;
         }
-        nFlvPos -= nUsedLen;
+        int nResult = RunFlvBatch(vFiles, argv[i + 1], nThreads, bInMemory, bRemuxOnly, bMp4, pMetrics);
+        PrintMetrics(pMetrics, metricsFormat);
+        return nResult;
     }
 
-    parser.PrintInfo();
-    parser.DumpH264("parser.264");
-    parser.DumpAAC("parser.aac");
+    if (nClipStart >= 0)
+    {
+        FlvClipResult clip;
+        CFlvDumpSink sink(bRemuxOnly ? NULL : "parser.264", bRemuxOnly ? NULL : "parser.aac", argv[i + 1],
+                          bMp4 ? "parser.mp4" : NULL);
+        if (!ExtractFlvClip(argv[i], (uint32_t)nClipStart, (uint32_t)nClipEnd, &sink, clip))
+        {
+            cout << "can not read " << argv[i] << endl;
+            return 0;
+        }
+        sink.Finish();
+        cout << "clip: start at keyframe " << clip.nStartTime << "ms, offset " << clip.nStartPos
+             << (clip.bKeyframeTable ? " (keyframes table)" : " (scan)") << ", " << clip.nVideoNum << " video and "
+             << clip.nAudioNum << " audio tags, read " << clip.nBytesRead << " bytes" << endl;
+        return 1;
+    }
 
-    // dump into flv
-    parser.DumpFlv(filename);
+    FlvJob job;
+    job.strInput = argv[i];
+    job.strFlvPath = argv[i + 1];
+    if (!bRemuxOnly)
+    {
+        job.strH264Path = "parser.264";
+        job.strAACPath = "parser.aac";
+    }
+    if (bMp4)
+        job.strMp4Path = "parser.mp4";
+    job.bInMemory = bInMemory && !bLive;
+    job.bLive = bLive;
+    if (indexPath != NULL)
+        job.strIndexPath = indexPath;
+    job.nSeekTime = nSeekTime;
+    job.nDecodeThreads = nDecodeThreads;
+    job.pMetrics = pMetrics;
+    job.bPipeline = bPipeline && !bInMemory;
+    job.nMaxBufferSize = nMaxBufferMB * 1024 * 1024;
 
-    delete[] pBak;
-    delete[] pBuf;
+    FlvJobResult result;
+    int nResult = ProcessFlvJob(job, result);
+    PrintMetrics(pMetrics, metricsFormat);
+    return nResult;
 }